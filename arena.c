@@ -0,0 +1,120 @@
+/**
+ * arena.c - memory that gets allocated in small pieces but freed all at once
+ * (the loaded .list/.map data, the watches), taken from large blocks. An
+ * intern table keeps a single copy of each distinct string (source file
+ * names repeat on every .list line) in its arena.
+ **/
+
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+#define ARENA_ALIGN 8
+
+void* arena_alloc(type_arena* a, int size)
+{
+  size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+  type_arena_block* b = a->blocks;
+  if (b == NULL || b->used + size > b->size)
+  {
+    int bsize = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+    b = malloc(sizeof(type_arena_block) + bsize);
+    b->used = 0;
+    b->size = bsize;
+    b->next = a->blocks;
+    a->blocks = b;
+  }
+
+  void* p = b->data + b->used;
+  b->used += size;
+  return p;
+}
+
+char* arena_strdup(type_arena* a, const char* s)
+{
+  int len = strlen(s) + 1;
+  char* p = arena_alloc(a, len);
+
+  memcpy(p, s, len);
+  return p;
+}
+
+// copies 'len' chars of 's' (adding a terminator)
+char* arena_strndup(type_arena* a, const char* s, int len)
+{
+  char* p = arena_alloc(a, len + 1);
+
+  memcpy(p, s, len);
+  p[len] = '\0';
+  return p;
+}
+
+void arena_free(type_arena* a)
+{
+  while (a->blocks != NULL)
+  {
+    type_arena_block* next = a->blocks->next;
+    free(a->blocks);
+    a->blocks = next;
+  }
+}
+
+// hashes 'len' bytes (FNV-1a)
+unsigned int hash_bytes(const void* p, int len)
+{
+  const unsigned char* b = p;
+  unsigned int h = 2166136261u;
+
+  for (int k = 0; k < len; k++)
+    h = (h ^ b[k]) * 16777619u;
+  return h;
+}
+
+unsigned int hash_string(const char* s)
+{
+  return hash_bytes(s, strlen(s));
+}
+
+// returns the single copy of 's' (adding it if need be)
+char* intern(type_intern* t, const char* s)
+{
+  if (t->count * 2 >= t->size)
+  {
+    int size = t->size ? t->size * 2 : 64;
+    char** slots = calloc(size, sizeof(char*));
+    for (int k = 0; k < t->size; k++)
+      if (t->slots[k] != NULL)
+      {
+        unsigned int h = hash_string(t->slots[k]) & (size - 1);
+        while (slots[h] != NULL)
+          h = (h + 1) & (size - 1);
+        slots[h] = t->slots[k];
+      }
+    free(t->slots);
+    t->slots = slots;
+    t->size = size;
+  }
+
+  unsigned int h = hash_string(s) & (t->size - 1);
+  while (t->slots[h] != NULL)
+  {
+    if (strcmp(t->slots[h], s) == 0)
+      return t->slots[h];
+    h = (h + 1) & (t->size - 1);
+  }
+
+  t->slots[h] = arena_strdup(t->arena, s);
+  t->count++;
+  return t->slots[h];
+}
+
+// forgets the interned strings (their arena gets freed by its owner)
+void intern_free(type_intern* t)
+{
+  free(t->slots);
+  t->slots = NULL;
+  t->size = 0;
+  t->count = 0;
+}
@@ -0,0 +1,35 @@
+/**
+ * arena.h - bump allocators (freed all at once), string interning and hashing
+ */
+
+typedef struct arena_block
+{
+  struct arena_block* next;
+  int used;
+  int size;
+  char data[];
+} type_arena_block;
+
+typedef struct
+{
+  type_arena_block* blocks;   // the newest block first
+} type_arena;
+
+typedef struct
+{
+  type_arena* arena;   // where the strings live
+  char** slots;        // open-addressed hash set of the interned strings
+  int size;            // (a power of two)
+  int count;
+} type_intern;
+
+void* arena_alloc(type_arena* a, int size);
+char* arena_strdup(type_arena* a, const char* s);
+char* arena_strndup(type_arena* a, const char* s, int len);
+void arena_free(type_arena* a);
+
+char* intern(type_intern* t, const char* s);
+void intern_free(type_intern* t);
+
+unsigned int hash_bytes(const void* p, int len);
+unsigned int hash_string(const char* s);
@@ -0,0 +1,38 @@
+#!/bin/bash
+# Times m65dbg's startup (loading a .list file) for listings of growing size.
+#
+# usage: ./bench_startup.sh [m65dbg binary] [line counts...]
+#
+# Each listing holds one 'nop' per line at a random (but repeatable) address,
+# spread over a few source files. The debugger gets /dev/null as its device,
+# so no monitor is needed; it loads the listing and quits on the empty input.
+# To compare against an older loader, build that one and pass its binary.
+
+BIN=$(realpath "${1:-./m65dbg}")
+shift
+COUNTS=${@:-25000 50000 100000 200000}
+
+# writes a listing of $1 lines to stdout
+gen_list()
+{
+  awk -v lines=$1 'BEGIN {
+    srand(1)
+    for (k = 0; k < lines; k++)
+      printf "%04X  EA        |  nop    | src%d.a65:%d\n", int(rand() * 65536), k % 16, k
+  }'
+}
+
+printf "%8s %10s\n" lines time
+for n in $COUNTS
+do
+  dir=$(mktemp -d)
+  gen_list $n > $dir/test.list
+
+  start=$(date +%s%N)
+  (cd $dir && echo "" | "$BIN" -d /dev/null > /dev/null 2>&1)
+  end=$(date +%s%N)
+
+  ms=$(( (end - start) / 1000000 ))
+  printf "%8d %6d.%02d s\n" $n $((ms / 1000)) $((ms % 1000 / 10))
+  rm -rf $dir
+done
@@ -1,15 +1,31 @@
 #define _BSD_SOURCE _BSD_SOURCE
 #include <stdio.h>
 #include <string.h>
-#include <dirent.h>
 #include <stdlib.h>
 #include <ctype.h>
 #include <unistd.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <stdarg.h>
+#include <pthread.h>
 #include "commands.h"
 #include "serial.h"
 #include "gs4510.h"
+#include "expr.h"
+#include "trace.h"
+#include "coverage.h"
+#include "emu.h"
+#include "journal.h"
+#include "xref.h"
+#include "arena.h"
+#include "listfile.h"
+#include "listcache.h"
+#include "listwatch.h"
+#include "srcfile.h"
+#include "project.h"
 
 int get_sym_value(char* token);
+void resolve_breakpoints(void);
 
 typedef struct
 {
@@ -22,18 +38,37 @@ typedef struct
 	int sp;
 	int mapl;
 	int maph;
+  int p;      // processor status (-1 = unknown)
 } reg_data;
 
+typedef struct
+{
+  bool active;
+  int addr;
+  char* addr_text; // as typed (resolved again when the symbols get reloaded)
+  int count;       // stop on every count'th hit (0 = every hit)
+  int hits;        // number of hits (where the condition was true)
+  bool has_cond;
+  char* cond_text;
+  type_expr cond;  // compiled condition
+} type_breakpoint;
+
 typedef struct
 {
   int addr;
   unsigned int b[16];
 } mem_data;
 
+void predicted_run(reg_data* reg, int steps, int ret_pc, int ret_sp);
+void step_target(reg_data* reg);
+void journal_instruction(reg_data* reg);
+char* addr_header(int addr);
+
 bool outputFlag = true;
 
 char outbuf[BUFSIZE] = { 0 };	// the buffer of what command is output to the remote monitor
 char inbuf[BUFSIZE] = { 0 }; // the buffer of what is read in from the remote monitor
+char stopinfo[BUFSIZE] = { 0 }; // the register display of the last stop
 
 char* type_names[] = { "BYTE  ", "WORD  ", "DWORD ", "STRING" };
 
@@ -41,6 +76,8 @@ bool autocls = false; // auto-clearscreen flag
 bool autowatch = false; // auto-watch flag
 bool ctrlcflag = false; // a flag to keep track of whether ctrl-c was caught
 int  traceframe = 0;  // tracks which frame within the backtrace
+int  srcContext = 10; // how many source lines are shown either side of the current one
+type_breakpoint brkpt = { 0 }; // the (single) hardware breakpoint
 
 type_command_details command_details[] =
 {
@@ -48,17 +85,24 @@ type_command_details command_details[] =
   { "help", cmdHelp, NULL,  "Shows help information on m65dbg commands" },
 	{ "dump", cmdDump, "<addr> [<count>]", "Dumps memory (CPU context) at given address (with character representation in right-column" },
 	{ "mdump", cmdMDump, "<addr> [<count>]", "Dumps memory (28-bit addresses) at given address (with character representation in right-column" },
-  { "dis", cmdDisassemble, "[<addr> [<count>]]", "Disassembles the instruction at <addr> or at PC. If <count> exists, it will dissembly that many instructions onwards" },
-  { "step", cmdStep, NULL, "Step into next instruction" }, // equate to pressing 'enter' in raw monitor
+  { "dis", cmdDisassemble, "[<addr> [<count>]] / -<n> [<count>] / ~<n>", "Disassembles the instruction at <addr> or at PC. If <count> exists, it will dissembly that many instructions onwards. With -<n>, first shows the <n> instructions leading up to PC (~<n> shows <n> either side of PC)" },
+  { "step", cmdStep, "[<count>]", "Step into next instruction (or <count> instructions, predicted on the host and run in one go)" }, // equate to pressing 'enter' in raw monitor
   { "n", cmdNext, NULL, "Step over to next instruction" },
+  { "sstep", cmdSourceStep, NULL, "Step into next source line (using the .list file)" },
+  { "snext", cmdSourceNext, NULL, "Step over to next source line (using the .list file)" },
   { "finish", cmdFinish, NULL, "Continue running until function returns (ie, step-out-from)" },
+  { "journal", cmdJournal, "[on [<KB>]/off/clear]", "Journals the registers and overwritten memory of every stepped instruction (in a ring buffer of <KB> kilobytes), so that 'rstep' can undo them" },
+  { "rstep", cmdReverseStep, "[<count>]", "Steps backwards by one (or <count>) journaled instructions, restoring memory and the PC" },
+  { "rnext", cmdReverseNext, "[<count>]", "Like 'rstep', but steps backwards over a subroutine that was returned from (back to its call)" },
   { "pb", cmdPrintByte, "<addr>", "Prints the byte-value of the given address" },
   { "pw", cmdPrintWord, "<addr>", "Prints the word-value of the given address" },
   { "pd", cmdPrintDWord, "<addr>", "Prints the dword-value of the given address" },
   { "ps", cmdPrintString, "<addr>", "Prints the null-terminated string-value found at the given address" },
   { "cls", cmdClearScreen, NULL, "Clears the screen" },
   { "autocls", cmdAutoClearScreen, "0/1", "If set to 1, clears the screen prior to every step/next command" },
-	{ "break", cmdSetBreakpoint, "<addr>", "Sets the hardware breakpoint to the desired address" },
+	{ "break", cmdSetBreakpoint, "<addr> [count <N>] [if <expr>]", "Sets the hardware breakpoint to the desired address. With 'count', only stops on every N'th hit. With 'if', only stops when <expr> is true (e.g. A==$20 && [buf+3]!=0, where a bare A or B is the register, so write $A/$B for the values)" },
+  { "cont", cmdContinue, NULL, "Continues running until the breakpoint or a watchpoint is hit (automatically continuing while the breakpoint's count/condition is not met)" },
+  { "watch", cmdWatchpoint, "write <addr>[-<endaddr>] / list / del <#>/all", "Stops 'cont' when the given memory range is written to, showing the old and new values" },
   { "wb", cmdWatchByte, "<addr>", "Watches the byte-value of the given address" },
   { "ww", cmdWatchWord, "<addr>", "Watches the word-value of the given address" },
   { "wd", cmdWatchDWord, "<addr>", "Watches the dword-value of the given address" },
@@ -66,9 +110,16 @@ type_command_details command_details[] =
   { "watches", cmdWatches, NULL, "Lists all watches and their present values" },
   { "wdel", cmdDeleteWatch, "<watch#>/all", "Deletes the watch number specified (use 'watches' command to get a list of existing watch numbers)" },
   { "autowatch", cmdAutoWatch, "0/1", "If set to 1, shows all watches prior to every step/next/dis command" },
+  { "context", cmdContext, "[<lines>]", "Sets how many source lines are shown either side of the current one (10 by default)" },
+  { "reload", cmdReload, NULL, "Reloads all the .list and .map files from scratch (rebuilt ones are picked up automatically)" },
   { "symbol", cmdSymbolValue, "<symbol>", "retrieves the value of the symbol from the .map file" },
   { "save", cmdSave, "<binfile> <addr28> <count>", "saves out a memory dump to <binfile> starting from <addr28> and for <count> bytes" },
   { "load", cmdLoad, "<binfile> <addr28>", "loads in <binfile> to <addr28>" },
+  { "xref", cmdXref, "<addr> / build <addr28> <len> / file <binfile> <addr28>", "Lists the instructions that call, jump/branch to, load from, store to or modify <addr>, from an index built by decoding target memory or a binary file (and kept next to the .list file)" },
+  { "disfile", cmdDisfile, "<addr28> <len> <out.s>", "Disassembles <len> bytes from <addr28> into an assembler source file, telling code from data by following the code from the reset/interrupt vectors and the .map file's symbols" },
+  { "profile", cmdProfile, "<seconds> [<collapsedfile>]", "Samples the PC of the running target for the given time, then shows a flat profile per symbol and source line. Optionally writes a collapsed-stack file (for flamegraphs)" },
+  { "trace", cmdTrace, "record <file> [<count>] / show <file> [<from#> [<count>]] / find <file> <addr>", "Records 'tc' traced execution into a compact binary file (until ctrl-c, or <count> instructions), or queries such a file" },
+  { "coverage", cmdCoverage, "[on/off/clear/trace <file>/report <lcovfile>]", "Collects code coverage from traces/profiles (when on), and summarises/reports it per .list source line (lcov format)" },
 	{ "back", cmdBackTrace, NULL, "produces a rough backtrace from the current contents of the stack" },
 	{ "up", cmdUpFrame, NULL, "The 'dis' disassembly command will disassemble one stack-level up from the current frame" },
 	{ "down", cmdDownFrame, NULL, "The 'dis' disassembly command will disassemble one stack-level down from the current frame" },
@@ -80,123 +131,212 @@ char* get_extension(char* fname)
   return strrchr(fname, '.');
 }
 
-typedef struct tfl
+typedef struct
 {
 	int addr;
+  int list;    // the .list file it came from (index into listNames)
   char* file;
 	int lineno;
-	struct tfl *next;
 } type_fileloc;
 
+// the .list files' lines, appended to while loading and then sorted by address (see index_list)
 type_fileloc* lstFileLoc = NULL;
+int lstFileLocCount = 0;
+int lstFileLocSize = 0;
+bool lstFileLocSorted = true;
+
+#define FILELOC_PAGES 0x100
+int fileLocPage[FILELOC_PAGES + 1];  // index of the first entry in each 256-byte page (the last one: past $FFFF)
 
 type_symmap_entry* lstSymMap = NULL;
+type_symmap_entry** symIndex = NULL;  // lstSymMap as an array, for binary searches
+int symIndexCount = 0;
+type_symmap_entry** symHash = NULL;   // open-addressed hash table of the symbols, by name
+int symHashSize = 0;                  // (a power of two)
+type_symmap_entry** symNames = NULL;  // the symbols sorted by name, for prefix searches
 
 type_watch_entry* lstWatches = NULL;
 
+type_arena listArena = { 0 };   // the .list file names
+type_intern listFiles = { &listArena };
+type_arena symArena = { 0 };    // lstSymMap
+type_list_cache listCache = { 0 };  // the mapped cache that the .list/.map data lives in (if it came from there)
+char** listNames = NULL;  // the .list files loaded, in name order
+int listNameCount = 0;
+char* projectDir = ".";   // where the .list files get searched for (see project.c)
+char* listCacheFile = NULL;
+
+char* xrefFile = NULL;  // where the cross-reference index is kept (next to the first .list file)
+
 void add_to_list(type_fileloc fl)
 {
-	type_fileloc* iter = lstFileLoc;
+  if (lstFileLocCount == lstFileLocSize)
+  {
+    lstFileLocSize = lstFileLocSize ? lstFileLocSize * 2 : 1024;
+    lstFileLoc = realloc(lstFileLoc, lstFileLocSize * sizeof(type_fileloc));
+  }
 
-  // first entry in list?
-  if (lstFileLoc == NULL)
-	{
-		lstFileLoc = malloc(sizeof(type_fileloc));
-		lstFileLoc->addr = fl.addr;
-		lstFileLoc->file = strdup(fl.file);
-		lstFileLoc->lineno = fl.lineno;
-		lstFileLoc->next = NULL;
-		return;
-	}
+  fl.file = intern(&listFiles, fl.file);
+  lstFileLoc[lstFileLocCount++] = fl;
+  lstFileLocSorted = false;
+}
 
-  while (iter != NULL)
-	{
-	  // replace existing?
-	  if (iter->addr == fl.addr)
-		{
-			iter->file = strdup(fl.file);
-			iter->lineno = fl.lineno;
-			return;
-		}
-		// insert entry?
-		if (iter->addr > fl.addr)
-		{
-		  type_fileloc* flcpy = malloc(sizeof(type_fileloc));
-			flcpy->addr = iter->addr;
-			flcpy->file = iter->file;
-			flcpy->lineno = iter->lineno;
-			flcpy->next = iter->next;
-
-			iter->addr = fl.addr;
-			iter->file = strdup(fl.file);
-			iter->lineno = fl.lineno;
-			iter->next = flcpy;
-			return;
-		}
-		// add to end?
-		if (iter->next == NULL)
-		{
-		  type_fileloc* flnew = malloc(sizeof(type_fileloc));
-			flnew->addr = fl.addr;
-			flnew->file = strdup(fl.file);
-			flnew->lineno = fl.lineno;
-			flnew->next = NULL;
+// the order of the .list lines: by address, then by .list file (in the order they're loaded)
+bool fileloc_before(type_fileloc* a, type_fileloc* b)
+{
+  return a->addr < b->addr || (a->addr == b->addr && a->list < b->list);
+}
 
-			iter->next = flnew;
-			return;
-		}
+// a (stable) natural merge sort, so that duplicates within a .list file stay in load order. Each
+// .list file is mostly in address order already, so there are only a few runs to merge.
+void sort_filelocs(type_fileloc* a, int n)
+{
+  type_fileloc* src = a;
+  type_fileloc* dst = malloc(n * sizeof(type_fileloc));
+  int* runs = malloc((n + 1) * sizeof(int));
+  int nruns = 0;
 
-		iter = iter->next;
-	}
+  for (int k = 0; k < n; k++)
+    if (k == 0 || fileloc_before(&a[k], &a[k-1]))
+      runs[nruns++] = k;
+  runs[nruns] = n;
+
+  while (nruns > 1)
+  {
+    int m = 0;
+    for (int r = 0; r < nruns; r += 2)
+    {
+      int lo = runs[r];
+      int mid = runs[r + 1];
+      int hi = r + 2 <= nruns ? runs[r + 2] : n;
+      int i = lo, j = mid, k = lo;
+
+      while (i < mid && j < hi)
+        dst[k++] = fileloc_before(&src[j], &src[i]) ? src[j++] : src[i++];
+      while (i < mid)
+        dst[k++] = src[i++];
+      while (j < hi)
+        dst[k++] = src[j++];
+      runs[m++] = lo;
+    }
+    runs[m] = n;
+    nruns = m;
+
+    type_fileloc* t = src;
+    src = dst;
+    dst = t;
+  }
+
+  if (src != a)
+  {
+    memcpy(a, src, n * sizeof(type_fileloc));
+    dst = src;
+  }
+  free(dst);
+  free(runs);
 }
 
-void add_to_symmap(type_symmap_entry sme)
+// sorts the .list lines by address (keeping the last one loaded for each), and builds the page table
+void index_list(void)
 {
-	type_symmap_entry* iter = lstSymMap;
+  sort_filelocs(lstFileLoc, lstFileLocCount);
 
-  // first entry in list?
-  if (lstSymMap == NULL)
-	{
-		lstSymMap = malloc(sizeof(type_symmap_entry));
-		lstSymMap->addr = sme.addr;
-		lstSymMap->sval = strdup(sme.sval);
-		lstSymMap->symbol = strdup(sme.symbol);
-		lstSymMap->next = NULL;
-		return;
-	}
+  int n = 0;
+  for (int k = 0; k < lstFileLocCount; k++)
+  {
+    if (n > 0 && lstFileLoc[n-1].addr == lstFileLoc[k].addr)
+      n--;
+    lstFileLoc[n++] = lstFileLoc[k];
+  }
+  lstFileLocCount = n;
+  lstFileLocSize = n;
+  lstFileLoc = realloc(lstFileLoc, (n + 1) * sizeof(type_fileloc));
 
-  while (iter != NULL)
-	{
-		// insert entry?
-		if (iter->addr >= sme.addr)
-		{
-		  type_symmap_entry* smecpy = malloc(sizeof(type_symmap_entry));
-			smecpy->addr = iter->addr;
-			smecpy->sval = iter->sval;
-			smecpy->symbol = iter->symbol;
-			smecpy->next = iter->next;
-
-			iter->addr = sme.addr;
-			iter->sval = strdup(sme.sval);
-			iter->symbol = strdup(sme.symbol);
-			iter->next = smecpy;
-			return;
-		}
-		// add to end?
-		if (iter->next == NULL)
-		{
-		  type_symmap_entry* smenew = malloc(sizeof(type_symmap_entry));
-			smenew->addr = sme.addr;
-			smenew->sval = strdup(sme.sval);
-			smenew->symbol = strdup(sme.symbol);
-			smenew->next = NULL;
+  int k = 0;
+  for (int page = 0; page <= FILELOC_PAGES; page++)
+  {
+    while (k < lstFileLocCount && lstFileLoc[k].addr < page * 256)
+      k++;
+    fileLocPage[page] = k;
+  }
 
-			iter->next = smenew;
-			return;
-		}
+  lstFileLocSorted = true;
+}
 
-		iter = iter->next;
-	}
+// returns the index of the first .list line at or above 'addr'
+int fileloc_lower_bound(int addr)
+{
+  int lo = 0, hi = lstFileLocCount;
+
+  if (!lstFileLocSorted)
+    index_list();
+
+  if (addr >= 0 && addr < FILELOC_PAGES * 256)
+  {
+    lo = fileLocPage[addr >> 8];
+    hi = fileLocPage[(addr >> 8) + 1];
+  }
+  else if (addr >= FILELOC_PAGES * 256)
+    lo = fileLocPage[FILELOC_PAGES];
+  else
+    return 0;
+
+  while (lo < hi)
+  {
+    int mid = (lo + hi) / 2;
+    if (lstFileLoc[mid].addr < addr)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  return lo;
+}
+
+type_symmap_entry** symMerge = NULL;  // (for cmp_sym_merge)
+
+int cmp_sym_merge(const void* a, const void* b)
+{
+  int i = *(const int*)a;
+  int j = *(const int*)b;
+
+  if (symMerge[i]->addr != symMerge[j]->addr)
+    return symMerge[i]->addr < symMerge[j]->addr ? -1 : 1;
+  if (symMerge[i]->list != symMerge[j]->list)
+    return symMerge[i]->list > symMerge[j]->list ? -1 : 1;
+  return i - j;
+}
+
+// merges symbols (in the order loaded) into lstSymMap, which stays sorted by address (the latest .list file's first, for equal ones)
+void merge_symbols(type_symmap_entry** added, int n)
+{
+  int total = n;
+
+  for (type_symmap_entry* iter = lstSymMap; iter != NULL; iter = iter->next)
+    total++;
+  if (total == 0)
+    return;
+
+  symMerge = malloc(total * sizeof(type_symmap_entry*));
+  int* order = malloc(total * sizeof(int));
+  for (int k = 0; k < n; k++)
+    symMerge[k] = added[n - 1 - k];
+  int k = n;
+  for (type_symmap_entry* iter = lstSymMap; iter != NULL; iter = iter->next)
+    symMerge[k++] = iter;
+  for (k = 0; k < total; k++)
+    order[k] = k;
+
+  qsort(order, total, sizeof(int), cmp_sym_merge);
+
+  lstSymMap = symMerge[order[0]];
+  for (k = 0; k < total - 1; k++)
+    symMerge[order[k]]->next = symMerge[order[k + 1]];
+  symMerge[order[total - 1]]->next = NULL;
+
+  free(order);
+  free(symMerge);
+  symMerge = NULL;
 }
 
 void add_to_watchlist(type_watch_entry we)
@@ -233,34 +373,168 @@ void add_to_watchlist(type_watch_entry we)
 
 type_fileloc* find_in_list(int addr)
 {
-	type_fileloc* iter = lstFileLoc;
-
-	while (iter != NULL)
-	{
-	  if (iter->addr == addr)
-			return iter;
+  int k = fileloc_lower_bound(addr);
 
-		iter = iter->next;
-	}
+  if (k < lstFileLocCount && lstFileLoc[k].addr == addr)
+    return &lstFileLoc[k];
 
 	return NULL;
 }
 
-type_symmap_entry* find_in_symmap(char* sym)
+type_fileloc* find_fileloc_floor(int addr)
 {
-	type_symmap_entry* iter = lstSymMap;
+  int k = fileloc_lower_bound(addr + 1);
 
-	while (iter != NULL)
-	{
-	  if (strcmp(sym, iter->symbol) == 0)
-			return iter;
+  return k > 0 ? &lstFileLoc[k-1] : NULL;
+}
 
-		iter = iter->next;
-	}
+// binary-searches the symbol index for the (last) symbol at or below 'addr'
+type_symmap_entry* find_symmap_floor(int addr)
+{
+  int lo = 0, hi = symIndexCount;  // first entry above 'addr' lies within [lo, hi]
+
+  while (lo < hi)
+  {
+    int mid = (lo + hi) / 2;
+    if (symIndex[mid]->addr <= addr)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  return lo == 0 ? NULL : symIndex[lo - 1];
+}
+
+#define SYM_MAX_OFFSET 0xFF   // how far past a symbol an address still gets shown relative to it
+
+// (see dis_symbol_func)
+bool addr_to_symbol(int addr, bool exact, char* str, int size)
+{
+  type_symmap_entry* sme = find_symmap_floor(addr);
+
+  if (sme == NULL || (exact && sme->addr != addr) || addr - sme->addr > SYM_MAX_OFFSET)
+    return false;
+
+  if (sme->addr == addr)
+    snprintf(str, size, "%s", sme->symbol);
+  else
+    snprintf(str, size, "%s+$%X", sme->symbol, addr - sme->addr);
+  return true;
+}
+
+int cmp_symbol_name(const void* a, const void* b)
+{
+  return strcmp((*(type_symmap_entry**)a)->symbol, (*(type_symmap_entry**)b)->symbol);
+}
+
+// builds the address-sorted index of lstSymMap (which is kept sorted by address)
+void index_symmap_addresses(void)
+{
+  int count = 0;
+
+  for (type_symmap_entry* iter = lstSymMap; iter != NULL; iter = iter->next)
+    count++;
+
+  free(symIndex);
+  symIndex = malloc(count * sizeof(type_symmap_entry*));
+  symIndexCount = 0;
+  for (type_symmap_entry* iter = lstSymMap; iter != NULL; iter = iter->next)
+    symIndex[symIndexCount++] = iter;
+}
+
+// builds the address-sorted index of lstSymMap, and the name indices
+void build_symmap_index(void)
+{
+  index_symmap_addresses();
+  int count = symIndexCount;
+
+  // (where a name appears twice, the lowest address wins, as it always has)
+  free(symHash);
+  for (symHashSize = 16; symHashSize < count * 2; symHashSize *= 2)
+    ;
+  symHash = calloc(symHashSize, sizeof(type_symmap_entry*));
+  for (int k = 0; k < count; k++)
+  {
+    unsigned int h = hash_string(symIndex[k]->symbol) & (symHashSize - 1);
+    while (symHash[h] != NULL && strcmp(symHash[h]->symbol, symIndex[k]->symbol) != 0)
+      h = (h + 1) & (symHashSize - 1);
+    if (symHash[h] == NULL)
+      symHash[h] = symIndex[k];
+  }
+
+  free(symNames);
+  symNames = malloc(count * sizeof(type_symmap_entry*));
+  memcpy(symNames, symIndex, count * sizeof(type_symmap_entry*));
+  qsort(symNames, count, sizeof(type_symmap_entry*), cmp_symbol_name);
+
+  dis_symbolizer = addr_to_symbol;
+}
+
+// like build_symmap_index(), but takes the name indices (as indices into symIndex) from the cache
+void load_symmap_index(int* names, int* hash, int hashsize)
+{
+  index_symmap_addresses();
+
+  free(symHash);
+  symHashSize = hashsize;
+  symHash = malloc(symHashSize * sizeof(type_symmap_entry*));
+  for (int k = 0; k < symHashSize; k++)
+    symHash[k] = hash[k] < 0 ? NULL : symIndex[hash[k]];
+
+  free(symNames);
+  symNames = malloc(symIndexCount * sizeof(type_symmap_entry*));
+  for (int k = 0; k < symIndexCount; k++)
+    symNames[k] = symIndex[names[k]];
+
+  dis_symbolizer = addr_to_symbol;
+}
+
+type_symmap_entry* find_in_symmap(char* sym)
+{
+  if (symHash == NULL)
+    return NULL;
+
+  unsigned int h = hash_string(sym) & (symHashSize - 1);
+  while (symHash[h] != NULL)
+  {
+    if (strcmp(symHash[h]->symbol, sym) == 0)
+      return symHash[h];
+    h = (h + 1) & (symHashSize - 1);
+  }
 
 	return NULL;
 }
 
+/**
+ * finds the symbols whose names start with 'prefix'
+ *
+ * returns:
+ *   the number of them (with *first pointing to the first, in name order)
+ */
+int find_symbols_by_prefix(const char* prefix, type_symmap_entry*** first)
+{
+  int len = strlen(prefix);
+  int lo = 0, hi = symIndexCount;
+
+  if (symNames == NULL)
+    return 0;
+
+  while (lo < hi)
+  {
+    int mid = (lo + hi) / 2;
+    if (strncmp(symNames[mid]->symbol, prefix, len) < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  *first = &symNames[lo];
+  int n = 0;
+  while (lo + n < symIndexCount && strncmp(symNames[lo + n]->symbol, prefix, len) == 0)
+    n++;
+  return n;
+}
+
 type_watch_entry* find_in_watchlist(char* name)
 {
   type_watch_entry* iter = lstWatches;
@@ -318,83 +592,6 @@ bool delete_from_watchlist(int wnum)
 	return false;
 }
 
-// loads the *.map file corresponding to the provided *.list file (if one exists)
-void load_map(char* fname)
-{
-  char strMapFile[200];
-	strcpy(strMapFile, fname);
-	char* sdot = strrchr(strMapFile, '.');
-	*sdot = '\0';
-	strcat(strMapFile, ".map");
-
-  // check if file exists
-	if (access(strMapFile, F_OK) != -1)
-	{
-		printf("Loading \"%s\"...\n", strMapFile);
-
-		// load the map file
-		FILE* f = fopen(strMapFile, "rt");
-
-		while (!feof(f))
-		{
-			char line[1024];
-			char sval[256];
-			fgets(line, 1024, f);
-
-			int addr;
-			char sym[1024];
-			sscanf(line, "$%04X %s", &addr, sym);
-			sscanf(line, "%s", sval);
-
-			//printf("%s : %04X\n", sym, addr);
-			type_symmap_entry sme;
-			sme.addr = addr;
-			sme.sval = sval; 
-			sme.symbol = sym;
-			add_to_symmap(sme);
-		}
-	}
-}
-
-// loads the given *.list file
-void load_list(char* fname)
-{
-  FILE* f = fopen(fname, "rt");
-	char line[1024];
-
-  while (!feof(f))
-	{
-	  fgets(line, 1024, f);
-
-		if (strlen(line) == 0)
-		  continue;
-
-		char *s = strrchr(line, '|');
-		if (s != NULL && *s != '\0')
-		{
-			s++;
-			if (strlen(s) < 5)
-			  continue;
-
-			int addr;
-      char file[1024];
-			int lineno;
-			strcpy(file, &strtok(s, ":")[1]);
-			sscanf(strtok(NULL, ":"), "%d", &lineno);
-			sscanf(line, " %X", &addr);
-
-			//printf("%04X : %s:%d\n", addr, file, lineno);
-			type_fileloc fl;
-			fl.addr = addr;
-			fl.file = file;
-			fl.lineno = lineno;
-			add_to_list(fl);
-		}
-	}
-
-	load_map(fname);
-}
-
 #define KNRM  "\x1B[0m"
 #define KRED  "\x1B[31m"
 #define KGRN  "\x1B[32m"
@@ -409,141 +606,726 @@ void load_list(char* fname)
 
 void show_location(type_fileloc* fl)
 {
-  FILE* f = fopen(fl->file, "rt");
+  type_source_file* f = source_open(fl->file);
+  const char* text;
+  int len;
+
   if (f == NULL)
     return;
-	char line[1024];
-	int cnt = 1;
 
-	while (!feof(f))
-	{
-		fgets(line, 1024, f);
-		if (cnt >= (fl->lineno - 10) && cnt <= (fl->lineno + 10) )
-		{
-		  if (cnt == fl->lineno)
-		  {
-				printf("%s> %d: %s%s", KINV, cnt, line, KNRM);
-			}
-			else
-				printf("> %d: %s", cnt, line);
-			//break;
-		}
-		cnt++;
-	}
-	fclose(f);
+  for (int cnt = fl->lineno - srcContext; cnt <= fl->lineno + srcContext; cnt++)
+  {
+    if (cnt < 1)
+      continue;
+    if (!source_line(f, cnt, &text, &len))
+      break;
+
+    if (cnt == fl->lineno)
+      printf("%s> %d: %.*s%s\n", KINV, cnt, len, text, KNRM);
+    else
+      printf("> %d: %.*s\n", cnt, len, text);
+  }
 }
 
-// search the current directory for *.list files
-void listSearch(void)
+// forgets everything loaded from the .list/.map files
+void unload_list(void)
+{
+  free(lstFileLoc);
+  lstFileLoc = NULL;
+  lstFileLocCount = 0;
+  lstFileLocSize = 0;
+  lstFileLocSorted = true;
+  intern_free(&listFiles);
+  arena_free(&listArena);
+
+  lstSymMap = NULL;
+  arena_free(&symArena);
+  build_symmap_index();
+
+  cache_close(&listCache);
+
+  for (int k = 0; k < listNameCount; k++)
+    free(listNames[k]);
+  free(listNames);
+  listNames = NULL;
+  listNameCount = 0;
+
+  source_close_all();
+}
+
+// finds a source file that a .list file refers to: next to the .list file, or else in the
+// project directory (where the assembler may have been run from), or else as it's named
+void resolve_source(char* path, int size, char* list_name, char* name)
 {
-  DIR           *d;
-  struct dirent *dir;
-  d = opendir(".");
-  if (d)
+  char* slash = strrchr(list_name, '/');
+
+  if (name[0] != '/' && slash != NULL)
   {
-    while ((dir = readdir(d)) != NULL)
-    {
-		  char* ext = get_extension(dir->d_name);
-		  if (ext != NULL && strcmp(ext, ".list") == 0)
-			{
-				printf("Loading \"%s\"...\n", dir->d_name);
-				load_list(dir->d_name);
-			}
-    }
+    snprintf(path, size, "%.*s/%s", (int)(slash - list_name), list_name, name);
+    if (access(path, F_OK) != -1)
+      return;
+  }
 
-    closedir(d);
+  if (name[0] != '/' && strcmp(projectDir, ".") != 0)
+  {
+    char* p = project_path(projectDir, name);
+    snprintf(path, size, "%s", p);
+    free(p);
+    if (access(path, F_OK) != -1)
+      return;
   }
+
+  snprintf(path, size, "%s", name);
 }
 
-reg_data get_regs(void)
+// merges a parsed .list file (or other debug-info file, and its symbol file) into the indexes, as listNames[list]
+void add_list_file(type_list_file* f, int list, type_symmap_entry*** syms, int* nsyms)
 {
-  reg_data reg = { 0 };
-  char* line;
-  serialWrite("r\n");
-  serialRead(inbuf, BUFSIZE);
-  line = strstr(inbuf+2, "\n") + 1;
-  sscanf(line,"%04X %02X %02X %02X %02X %02X %04X %04X %04X",
-    &reg.pc, &reg.a, &reg.x, &reg.y, &reg.z, &reg.b, &reg.sp, &reg.mapl, &reg.maph);
+  char name[1024];
+  char file[1024];
+  const char* last = NULL;
+  int lastlen = 0;
 
-  return reg;
-}
+  printf("Loading \"%s\"...\n", f->list_name);
+  for (int k = 0; k < f->nlines; k++)
+  {
+    type_list_line* l = &f->lines[k];
 
+    // (the lines of a source file come in runs, so it only gets looked for once per run)
+    if (last == NULL || l->filelen != lastlen || memcmp(l->file, last, lastlen) != 0)
+    {
+      last = l->file;
+      lastlen = l->filelen;
+      int len = l->filelen < (int)sizeof(name) ? l->filelen : (int)sizeof(name) - 1;
+      memcpy(name, l->file, len);
+      name[len] = '\0';
+      resolve_source(file, sizeof(file), f->list_name, name);
+    }
 
-mem_data get_mem(int addr)
-{
-  mem_data mem = { 0 };
-  char str[100];
-  sprintf(str, "d%04X\n", addr); // use 'd' instead of 'm' (for memory in cpu context)
-  serialWrite(str);
-  serialRead(inbuf, BUFSIZE);
-  sscanf(inbuf, " :%X %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X",
-  &mem.addr, &mem.b[0], &mem.b[1], &mem.b[2], &mem.b[3], &mem.b[4], &mem.b[5], &mem.b[6], &mem.b[7], &mem.b[8], &mem.b[9], &mem.b[10], &mem.b[11], &mem.b[12], &mem.b[13], &mem.b[14], &mem.b[15]); 
+    type_fileloc fl;
+    fl.addr = l->addr;
+    fl.list = list;
+    fl.file = file;
+    fl.lineno = l->lineno;
+    add_to_list(fl);
+  }
 
-  return mem;
+  // (some debug-info files have the symbols in them, rather than in a file of their own)
+  if (f->map_name != NULL)
+    printf("Loading \"%s\"...\n", f->map_name);
+  *syms = realloc(*syms, (*nsyms + f->nsyms) * sizeof(type_symmap_entry*));
+  for (int k = 0; k < f->nsyms; k++)
+  {
+    type_map_line* m = &f->syms[k];
+    type_symmap_entry* sme = arena_alloc(&symArena, sizeof(type_symmap_entry));
+    sme->addr = m->addr;
+    sme->list = list;
+    sme->symbol = arena_strndup(&symArena, m->sym, m->symlen);
+    if (m->sval != NULL)
+      sme->sval = arena_strndup(&symArena, m->sval, m->svallen);
+    else
+    {
+      char sval[16];
+      snprintf(sval, sizeof(sval), "$%04X", m->addr);
+      sme->sval = arena_strdup(&symArena, sval);
+    }
+    (*syms)[(*nsyms)++] = sme;
+  }
 }
 
-mem_data get_mem28(int addr)
-{
-  mem_data mem = { 0 };
-  char str[100];
-  sprintf(str, "m%04X\n", addr);
-  serialWrite(str);
-  serialRead(inbuf, BUFSIZE);
-  sscanf(inbuf, " :%X %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X",
-  &mem.addr, &mem.b[0], &mem.b[1], &mem.b[2], &mem.b[3], &mem.b[4], &mem.b[5], &mem.b[6], &mem.b[7], &mem.b[8], &mem.b[9], &mem.b[10], &mem.b[11], &mem.b[12], &mem.b[13], &mem.b[14], &mem.b[15]); 
-
-  return mem;
-}
+#define LIST_CACHE_FILE "m65dbg.cache"
 
-// read all 32 lines at once (to hopefully speed things up for saving memory dumps)
-mem_data* get_mem28array(int addr)
+// sums up the names, sizes and modification times of the source files (the cache's key)
+char* list_cache_key(type_list_file* files, int count, int* keylen)
 {
-  static mem_data multimem[32];
-  mem_data* mem;
-  char str[100];
-  sprintf(str, "M%04X\n", addr);
-  serialWrite(str);
-  serialRead(inbuf, BUFSIZE);
-  char* strLine = strtok(inbuf, "\n");
-  for (int k = 0; k < 32; k++)
+  char* key = NULL;
+  int len = 0;
+
+  for (int k = 0; k < count; k++)
   {
-    mem = &multimem[k];
-    sscanf(strLine, " :%X %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X",
-    &mem->addr, &mem->b[0], &mem->b[1], &mem->b[2], &mem->b[3], &mem->b[4], &mem->b[5], &mem->b[6], &mem->b[7], &mem->b[8], &mem->b[9], &mem->b[10], &mem->b[11], &mem->b[12], &mem->b[13], &mem->b[14], &mem->b[15]); 
-    strLine = strtok(NULL, "\n");
+    char* names[2] = { files[k].list_name, files[k].map_name };
+    for (int i = 0; i < 2; i++)
+    {
+      struct stat st;
+      if (names[i] == NULL || stat(names[i], &st) != 0)
+        continue;
+
+      key = realloc(key, len + strlen(names[i]) + 64);
+      len += sprintf(key + len, "%s %lld %lld.%09ld\n", names[i], (long long)st.st_size,
+        (long long)st.st_mtim.tv_sec, st.st_mtim.tv_nsec);
+    }
   }
 
-  return multimem;
+  *keylen = len;
+  return key;
 }
 
-// write buffer to client ram
-void put_mem28array(int addr, unsigned char* data, int size)
+// loads the .list/.map data from the cache (if it's there for the given key)
+bool load_list_cache(char* key, int keylen)
 {
-  char str[10];
-  sprintf(outbuf, "s%08X", addr);
+  type_list_cache* c = &listCache;
 
-  int i = 0;
-  while(i < size) 
+  if (!cache_open(c, listCacheFile, key, keylen, listNameCount))
+    return false;
+
+  lstFileLoc = malloc((c->nlines + 1) * sizeof(type_fileloc));
+  for (int k = 0; k < c->nlines; k++)
   {
-    sprintf(str, " %02X", data[i]);
-    strcat(outbuf, str);
-    i++;
+    lstFileLoc[k].addr = c->lines[k].addr;
+    lstFileLoc[k].list = c->lines[k].list;
+    lstFileLoc[k].file = c->strings + c->lines[k].file;
+    lstFileLoc[k].lineno = c->lines[k].lineno;
   }
-  strcat(outbuf, "\n");
+  lstFileLocCount = c->nlines;
+  lstFileLocSize = c->nlines;
+  index_list();
 
-  serialWrite(outbuf);
-  serialRead(inbuf, BUFSIZE);
+  type_symmap_entry* nodes = arena_alloc(&symArena, (c->nsyms + 1) * sizeof(type_symmap_entry));
+  for (int k = 0; k < c->nsyms; k++)
+  {
+    nodes[k].addr = c->syms[k].addr;
+    nodes[k].list = c->syms[k].list;
+    nodes[k].symbol = c->strings + c->syms[k].symbol;
+    nodes[k].sval = c->strings + c->syms[k].sval;
+    nodes[k].next = k + 1 < c->nsyms ? &nodes[k + 1] : NULL;
+  }
+  lstSymMap = c->nsyms > 0 ? nodes : NULL;
+  load_symmap_index(c->names, c->hash, c->hashsize);
+
+  return true;
 }
 
-void cmdRawHelp(void)
+typedef struct
 {
-  serialWrite("?\n");
-  serialRead(inbuf, BUFSIZE);
-  printf("%s", inbuf);
+  type_symmap_entry* sme;
+  int idx;
+} type_sym_slot;
 
-  printf("! - reset machine\n"
-         "f<low> <high> <byte> - Fill memory\n"
-         "g<addr> - Set PC\n"
+int cmp_sym_slot(const void* a, const void* b)
+{
+  const type_symmap_entry* x = ((const type_sym_slot*)a)->sme;
+  const type_symmap_entry* y = ((const type_sym_slot*)b)->sme;
+
+  return x < y ? -1 : x > y;
+}
+
+// the index of a symbol in symIndex (looked up in 'slots', sorted by entry)
+int sym_slot_index(type_sym_slot* slots, type_symmap_entry* sme)
+{
+  type_sym_slot key = { sme, 0 };
+
+  return ((type_sym_slot*)bsearch(&key, slots, symIndexCount, sizeof(type_sym_slot), cmp_sym_slot))->idx;
+}
+
+// adds a string to the cache's string table, returning its offset
+unsigned int cache_string(type_list_cache* c, int* size, char* str)
+{
+  int len = strlen(str) + 1;
+
+  if (c->strsize + len > *size)
+  {
+    *size = (*size + len) * 2;
+    c->strings = realloc(c->strings, *size);
+  }
+  memcpy(c->strings + c->strsize, str, len);
+  c->strsize += len;
+
+  return c->strsize - len;
+}
+
+void save_list_cache(char* key, int keylen)
+{
+  type_list_cache c = { 0 };
+  int strsize = 0;
+
+  // (the file names are interned, so each one only gets stored once)
+  char* last_file = NULL;
+  unsigned int last_offset = 0;
+  c.nlines = lstFileLocCount;
+  c.lines = malloc((c.nlines + 1) * sizeof(type_cache_line));
+  for (int k = 0; k < c.nlines; k++)
+  {
+    if (lstFileLoc[k].file != last_file)
+    {
+      last_file = lstFileLoc[k].file;
+      last_offset = cache_string(&c, &strsize, last_file);
+    }
+    c.lines[k].addr = lstFileLoc[k].addr;
+    c.lines[k].file = last_offset;
+    c.lines[k].lineno = lstFileLoc[k].lineno;
+    c.lines[k].list = lstFileLoc[k].list;
+  }
+
+  c.nsyms = symIndexCount;
+  c.syms = malloc((c.nsyms + 1) * sizeof(type_cache_sym));
+  type_sym_slot* slots = malloc((c.nsyms + 1) * sizeof(type_sym_slot));
+  for (int k = 0; k < c.nsyms; k++)
+  {
+    c.syms[k].addr = symIndex[k]->addr;
+    c.syms[k].symbol = cache_string(&c, &strsize, symIndex[k]->symbol);
+    c.syms[k].sval = cache_string(&c, &strsize, symIndex[k]->sval);
+    c.syms[k].list = symIndex[k]->list;
+    slots[k].sme = symIndex[k];
+    slots[k].idx = k;
+  }
+  qsort(slots, c.nsyms, sizeof(type_sym_slot), cmp_sym_slot);
+
+  c.names = malloc((c.nsyms + 1) * sizeof(int));
+  for (int k = 0; k < c.nsyms; k++)
+    c.names[k] = sym_slot_index(slots, symNames[k]);
+  c.hashsize = symHashSize;
+  c.hash = malloc(c.hashsize * sizeof(int));
+  for (int k = 0; k < c.hashsize; k++)
+    c.hash[k] = symHash[k] == NULL ? -1 : sym_slot_index(slots, symHash[k]);
+
+  if (!cache_write(&c, listCacheFile, key, keylen))
+    printf("Error writing the cache \"%s\"!\n", listCacheFile);
+
+  free(c.lines);
+  free(c.syms);
+  free(c.names);
+  free(c.hash);
+  free(c.strings);
+  free(slots);
+}
+
+int cmp_string(const void* a, const void* b)
+{
+  return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+// watches the search roots and the directories that the .list files are in, for rebuilt ones
+void watch_list_dirs(type_project* proj, type_list_file* files, int count)
+{
+  char** dirs = malloc((proj->nroots + count + 1) * sizeof(char*));
+  int ndirs = 0;
+
+  for (int k = 0; k < proj->nroots; k++)
+    dirs[ndirs++] = strdup(proj->roots[k]);
+  for (int k = 0; k < count; k++)
+  {
+    char* slash = strrchr(files[k].list_name, '/');
+    dirs[ndirs++] = slash == NULL ? strdup(".") : strndup(files[k].list_name, slash - files[k].list_name);
+  }
+  qsort(dirs, ndirs, sizeof(char*), cmp_string);
+
+  int n = 0;
+  for (int k = 0; k < ndirs; k++)
+    if (n > 0 && strcmp(dirs[n-1], dirs[k]) == 0)
+      free(dirs[k]);
+    else
+      dirs[n++] = dirs[k];
+
+  listwatch_start(dirs, n);
+
+  for (int k = 0; k < n; k++)
+    free(dirs[k]);
+  free(dirs);
+}
+
+// search the project (the current directory, unless told otherwise) for *.list files (and
+// the other assemblers' debug-info files), and parse them all at once (unless they're cached)
+void listSearch(void)
+{
+  type_project proj;
+  type_list_file* files = NULL;
+  int count = 0;
+
+  free(listCacheFile);
+  listCacheFile = project_path(projectDir, LIST_CACHE_FILE);
+
+  if (!project_load(&proj, projectDir))
+    return;
+
+  // (in name order, so that the cache key doesn't depend on the directory order)
+  char** names = project_find(&proj, is_list_file, &count);
+  files = malloc((count + 1) * sizeof(type_list_file));
+  for (int k = 0; k < count; k++)
+  {
+    list_file_names(&files[k], names[k]);
+    free(names[k]);
+  }
+  free(names);
+
+  // (from now on, rebuilt listings get picked up by listRefresh())
+  watch_list_dirs(&proj, files, count);
+  project_free(&proj);
+
+  if (count == 0)
+  {
+    free(files);
+    return;
+  }
+
+  listNames = malloc(count * sizeof(char*));
+  for (int k = 0; k < count; k++)
+    listNames[k] = strdup(files[k].list_name);
+  listNameCount = count;
+
+  if (xrefFile == NULL)
+  {
+    xrefFile = malloc(strlen(files[0].list_name) + 1);
+    strcpy(xrefFile, files[0].list_name);
+    strcpy(get_extension(xrefFile), ".xref");
+  }
+
+  int keylen;
+  char* key = list_cache_key(files, count, &keylen);
+  if (load_list_cache(key, keylen))
+    printf("Loaded %d source lines and %d symbols from \"%s\"\n", lstFileLocCount, symIndexCount, listCacheFile);
+  else
+  {
+    parse_list_files(files, count);
+
+    type_symmap_entry** syms = NULL;
+    int nsyms = 0;
+    for (int k = 0; k < count; k++)
+      add_list_file(&files[k], k, &syms, &nsyms);
+
+    merge_symbols(syms, nsyms);
+    free(syms);
+    build_symmap_index();
+    index_list();
+    save_list_cache(key, keylen);
+  }
+
+  for (int k = 0; k < count; k++)
+    free_list_file(&files[k]);
+  free(files);
+  free(key);
+
+  if (xref_load(xrefFile))
+    printf("Loaded %d cross-references from \"%s\"\n", xref_count(), xrefFile);
+}
+
+// the index of a .list file in (sorted) 'names', or -1 if it's not there
+int find_list_name(char** names, int count, char* name)
+{
+  char** found = bsearch(&name, names, count, sizeof(char*), cmp_string);
+  return found != NULL ? found - names : -1;
+}
+
+// swaps a batch of reparsed .list files in, for what had been loaded from them
+void apply_list_update(type_list_update* u)
+{
+  // the .list files from now on (new ones get added, deleted ones dropped)
+  char** names = malloc((listNameCount + u->count) * sizeof(char*));
+  int count = 0;
+  for (int k = 0; k < listNameCount; k++)
+    if (access(listNames[k], F_OK) != -1)
+      names[count++] = strdup(listNames[k]);
+  for (int k = 0; k < u->count; k++)
+    if (find_list_name(listNames, listNameCount, u->files[k].list_name) < 0 &&
+        access(u->files[k].list_name, F_OK) != -1)
+      names[count++] = strdup(u->files[k].list_name);
+  qsort(names, count, sizeof(char*), cmp_string);
+
+  // the new index of each old .list file (-1 for the reparsed and the deleted ones)
+  int* moved = malloc((listNameCount + 1) * sizeof(int));
+  for (int k = 0; k < listNameCount; k++)
+    moved[k] = find_list_name(names, count, listNames[k]);
+  for (int k = 0; k < u->count; k++)
+  {
+    int old = find_list_name(listNames, listNameCount, u->files[k].list_name);
+    if (old >= 0)
+      moved[old] = -1;
+  }
+
+  // set the loaded data aside, and start over with what's left of it (in the same order)
+  type_fileloc* old_lines = lstFileLoc;
+  int old_count = lstFileLocCount;
+  type_symmap_entry* old_syms = lstSymMap;
+  type_arena old_list_arena = listArena;
+  type_intern old_files = listFiles;
+  type_arena old_sym_arena = symArena;
+  type_list_cache old_cache = listCache;
+
+  lstFileLoc = NULL;
+  lstFileLocCount = 0;
+  lstFileLocSize = 0;
+  memset(&listArena, 0, sizeof(type_arena));
+  memset(&listFiles, 0, sizeof(type_intern));
+  listFiles.arena = &listArena;
+  memset(&symArena, 0, sizeof(type_arena));
+  memset(&listCache, 0, sizeof(type_list_cache));
+  lstSymMap = NULL;
+
+  for (int k = 0; k < old_count; k++)
+    if (moved[old_lines[k].list] >= 0)
+    {
+      type_fileloc fl = old_lines[k];
+      fl.list = moved[fl.list];
+      add_to_list(fl);
+    }
+
+  // (lstSymMap has the latest first for equal addresses, merge_symbols() wants them in load order)
+  int nsyms = 0;
+  for (type_symmap_entry* iter = old_syms; iter != NULL; iter = iter->next)
+    if (moved[iter->list] >= 0)
+      nsyms++;
+  type_symmap_entry** syms = malloc((nsyms + 1) * sizeof(type_symmap_entry*));
+  int k = nsyms;
+  for (type_symmap_entry* iter = old_syms; iter != NULL; iter = iter->next)
+    if (moved[iter->list] >= 0)
+    {
+      type_symmap_entry* sme = arena_alloc(&symArena, sizeof(type_symmap_entry));
+      sme->addr = iter->addr;
+      sme->list = moved[iter->list];
+      sme->symbol = arena_strdup(&symArena, iter->symbol);
+      sme->sval = arena_strdup(&symArena, iter->sval);
+      syms[--k] = sme;
+    }
+
+  for (k = 0; k < u->count; k++)
+  {
+    int list = find_list_name(names, count, u->files[k].list_name);
+    if (list >= 0)
+      add_list_file(&u->files[k], list, &syms, &nsyms);
+  }
+
+  merge_symbols(syms, nsyms);
+  free(syms);
+  build_symmap_index();
+  index_list();
+
+  free(old_lines);
+  intern_free(&old_files);
+  arena_free(&old_list_arena);
+  arena_free(&old_sym_arena);
+  cache_close(&old_cache);
+  for (k = 0; k < listNameCount; k++)
+    free(listNames[k]);
+  free(listNames);
+  free(moved);
+  listNames = names;
+  listNameCount = count;
+}
+
+// (for main's loop to wait on, along with stdin)
+int listRefreshFd(void)
+{
+  return listwatch_fd();
+}
+
+// takes in the .list/.map files that have been rebuilt (and reparsed in the background) since last time
+void listRefresh(void)
+{
+  type_list_update* u = listwatch_take();
+
+  if (u == NULL)
+    return;
+
+  while (u != NULL)
+  {
+    type_list_update* next = u->next;
+    apply_list_update(u);
+    listwatch_free(u);
+    u = next;
+  }
+
+  // (the cache is up to date again)
+  type_list_file* files = malloc((listNameCount + 1) * sizeof(type_list_file));
+  for (int k = 0; k < listNameCount; k++)
+    list_file_names(&files[k], listNames[k]);
+  int keylen;
+  char* key = list_cache_key(files, listNameCount, &keylen);
+  save_list_cache(key, keylen);
+  for (int k = 0; k < listNameCount; k++)
+    free_list_file(&files[k]);
+  free(files);
+  free(key);
+
+  printf("Reloaded: %d source lines and %d symbols\n", lstFileLocCount, symIndexCount);
+  resolve_breakpoints();
+}
+
+// parses the register values out of the monitor's register display
+// (the line following the "PC   A  X ..." header)
+bool parse_regs(char* str, reg_data* reg)
+{
+  char* line = strstr(str+2, "\n");
+  if (line == NULL)
+    return false;
+  line++;
+
+  int n = sscanf(line,"%04X %02X %02X %02X %02X %02X %04X %04X %04X",
+    &reg->pc, &reg->a, &reg->x, &reg->y, &reg->z, &reg->b, &reg->sp, &reg->mapl, &reg->maph);
+
+  // the P-FLAGS column shows each flag as its letter ("NVEBDIZC"), or '.' if clear
+  reg->p = -1;
+  char* end = strchr(line, '\n');
+  for (char* tok = line; tok != NULL && (end == NULL || tok < end); tok = strchr(tok, ' '))
+  {
+    while (*tok == ' ')
+      tok++;
+
+    int k, p = 0;
+    for (k = 0; k < 8; k++)
+    {
+      if (tok[k] == "NVEBDIZC"[k])
+        p |= 0x80 >> k;
+      else if (tok[k] != '.')
+        break;
+    }
+    if (k == 8 && (tok[8] == ' ' || tok[8] == '\n' || tok[8] == '\r' || tok[8] == '\0'))
+    {
+      reg->p = p;
+      break;
+    }
+  }
+
+  return n == 9;
+}
+
+reg_data get_regs(void)
+{
+  reg_data reg = { 0 };
+  reg.p = -1;
+  serialWrite("r\n");
+  serialRead(inbuf, BUFSIZE);
+  parse_regs(inbuf, &reg);
+
+  return reg;
+}
+
+// fills an array of register values, as expected by expr_eval()
+void regs_to_array(reg_data* reg, int* regs)
+{
+  regs[R_PC] = reg->pc;
+  regs[R_A] = reg->a;
+  regs[R_X] = reg->x;
+  regs[R_Y] = reg->y;
+  regs[R_Z] = reg->z;
+  regs[R_B] = reg->b;
+  regs[R_SP] = reg->sp;
+}
+
+
+mem_data get_mem(int addr)
+{
+  mem_data mem = { 0 };
+  char str[100];
+  sprintf(str, "d%04X\n", addr); // use 'd' instead of 'm' (for memory in cpu context)
+  serialWrite(str);
+  serialRead(inbuf, BUFSIZE);
+  sscanf(inbuf, " :%X %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X",
+  &mem.addr, &mem.b[0], &mem.b[1], &mem.b[2], &mem.b[3], &mem.b[4], &mem.b[5], &mem.b[6], &mem.b[7], &mem.b[8], &mem.b[9], &mem.b[10], &mem.b[11], &mem.b[12], &mem.b[13], &mem.b[14], &mem.b[15]); 
+
+  return mem;
+}
+
+mem_data get_mem28(int addr)
+{
+  mem_data mem = { 0 };
+  char str[100];
+  sprintf(str, "m%04X\n", addr);
+  serialWrite(str);
+  serialRead(inbuf, BUFSIZE);
+  sscanf(inbuf, " :%X %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X",
+  &mem.addr, &mem.b[0], &mem.b[1], &mem.b[2], &mem.b[3], &mem.b[4], &mem.b[5], &mem.b[6], &mem.b[7], &mem.b[8], &mem.b[9], &mem.b[10], &mem.b[11], &mem.b[12], &mem.b[13], &mem.b[14], &mem.b[15]); 
+
+  return mem;
+}
+
+// read all 32 lines at once (to hopefully speed things up for saving memory dumps)
+mem_data* get_mem28array(int addr)
+{
+  static mem_data multimem[32];
+  mem_data* mem;
+  char str[100];
+  sprintf(str, "M%04X\n", addr);
+  serialWrite(str);
+  serialRead(inbuf, BUFSIZE);
+  char* strLine = strtok(inbuf, "\n");
+  for (int k = 0; k < 32; k++)
+  {
+    mem = &multimem[k];
+    sscanf(strLine, " :%X %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X",
+    &mem->addr, &mem->b[0], &mem->b[1], &mem->b[2], &mem->b[3], &mem->b[4], &mem->b[5], &mem->b[6], &mem->b[7], &mem->b[8], &mem->b[9], &mem->b[10], &mem->b[11], &mem->b[12], &mem->b[13], &mem->b[14], &mem->b[15]); 
+    strLine = strtok(NULL, "\n");
+  }
+
+  return multimem;
+}
+
+// read 512 bytes (cpu context) in a single round trip, into a flat buffer
+void get_mem_block(int addr, unsigned char* dest)
+{
+  char str[100];
+  sprintf(str, "D%04X\n", addr);
+  serialWrite(str);
+  serialRead(inbuf, BUFSIZE);
+
+  memset(dest, 0, 512);
+  char* strLine = inbuf;
+  for (int k = 0; k < 32 && strLine != NULL; k++)
+  {
+    mem_data mem = { 0 };
+    sscanf(strLine, " :%X %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X",
+    &mem.addr, &mem.b[0], &mem.b[1], &mem.b[2], &mem.b[3], &mem.b[4], &mem.b[5], &mem.b[6], &mem.b[7], &mem.b[8], &mem.b[9], &mem.b[10], &mem.b[11], &mem.b[12], &mem.b[13], &mem.b[14], &mem.b[15]);
+    for (int i = 0; i < 16; i++)
+      dest[k*16 + i] = mem.b[i];
+
+    strLine = strchr(strLine, '\n');
+    if (strLine != NULL)
+      strLine++;
+  }
+}
+
+/**
+ * reads 'len' bytes (28-bit addresses) into 'dest', 512 bytes per round
+ * trip, showing the progress
+ *
+ * returns:
+ *   false if interrupted by ctrl-c
+ */
+bool read_mem28_block(int addr, int len, unsigned char* dest)
+{
+  for (int cnt = 0; cnt < len; cnt += 512)
+  {
+    mem_data* multimem = get_mem28array(addr + cnt);
+
+    for (int k = 0; k < 512 && cnt + k < len; k++)
+      dest[cnt + k] = multimem[k / 16].b[k % 16];
+
+    printf("0x%X bytes read...\r", cnt + 512 < len ? cnt + 512 : len);
+    fflush(stdout);
+    if (ctrlcflag)
+      return false;
+  }
+  printf("\n");
+
+  return true;
+}
+
+// write buffer to client ram
+void put_mem28array(int addr, unsigned char* data, int size)
+{
+  char str[10];
+  sprintf(outbuf, "s%08X", addr);
+
+  int i = 0;
+  while(i < size) 
+  {
+    sprintf(str, " %02X", data[i]);
+    strcat(outbuf, str);
+    i++;
+  }
+  strcat(outbuf, "\n");
+
+  serialWrite(outbuf);
+  serialRead(inbuf, BUFSIZE);
+}
+
+void cmdRawHelp(void)
+{
+  serialWrite("?\n");
+  serialRead(inbuf, BUFSIZE);
+  printf("%s", inbuf);
+
+  printf("! - reset machine\n"
+         "f<low> <high> <byte> - Fill memory\n"
+         "g<addr> - Set PC\n"
          "m<addr28> - Dump 16-bytes of memory (28bit addresses)\n"
          "M<addr28> - Dump 512-bytes of memory (28bit addresses)\n"
          "d<addr> - Dump 16-bytes of memory (CPU context)\n"
@@ -689,132 +1471,202 @@ void cmdMDump(void)
 	}
 }
 
-// return the last byte count
+// a window of target memory (cpu context), refilled 512 bytes at a time
+typedef struct
+{
+  int addr;       // -1 = empty
+  unsigned char b[512];
+} type_mem_window;
+
+// returns a pointer to (at least) 'need' bytes of memory at 'addr'
+unsigned char* window_bytes(type_mem_window* w, int addr, int need)
+{
+  addr &= 0xffff;
+  if (w->addr == -1 || addr < w->addr || addr + need > w->addr + 512)
+  {
+    w->addr = addr;
+    get_mem_block(addr, w->b);
+  }
+
+  return &w->b[addr - w->addr];
+}
+
 int disassemble_addr_into_string(char* str, int addr)
 {
-  int last_bytecount = 0;
-  char s[32] = { 0 };
+  unsigned char b[DIS_MAX_LEN] = { 0 };
 
 	// get memory at current pc
 	mem_data mem = get_mem(addr);
+  for (int k = 0; k < DIS_MAX_LEN; k++)
+    b[k] = mem.b[k];
 
-	// now, try to disassemble it
-
-	// Program counter
-	sprintf(str, "$%04X ", addr & 0xffff);
-
-	type_opcode_mode mode = opcode_mode[mode_lut[mem.b[0]]];
-	sprintf(s, " %10s:%d ", mode.name, mode.val);
-	strcat(str, s);
+  return disassemble_bytes(str, DIS_LINE_SIZE, addr, b);
+}
 
-	// Opcode and arguments
-	sprintf(s, "%02X ", mem.b[0]);
-	strcat(str, s);
+#define DIS_BATCH 64   // lines disassembled per batch (between ctrl-c checks)
 
-	last_bytecount = mode.val + 1;
+/**
+ * disassembles 'count' instructions onwards from 'addr', reading the
+ * memory 512 bytes per round trip.
+ *
+ * returns:
+ *   the number of lines disassembled
+ */
+int disassemble_lines(type_dis_line* lines, int addr, int count)
+{
+  static type_mem_window w;
+  w.addr = -1;
 
-	if (last_bytecount == 1)
-	{
-		strcat(str, "      ");
-	}
-	if (last_bytecount == 2)
-	{
-		sprintf(s, "%02X    ", mem.b[1]);
-		strcat(str, s);
-	}
-	if (last_bytecount == 3)
-	{
-		sprintf(s, "%02X %02X ", mem.b[1], mem.b[2]);
-		strcat(str, s);
-	}
+  for (int k = 0; k < count; k++)
+  {
+    unsigned char* b = window_bytes(&w, addr, DIS_MAX_LEN);
+    lines[k].addr = addr & 0xffff;
+    lines[k].len = disassemble_bytes(lines[k].text, DIS_LINE_SIZE, addr, b);
+    addr += lines[k].len;
+  }
 
-	// Instruction name
-	strcat(str, instruction_lut[mem.b[0]]);
+  return count;
+}
 
-	switch(mode_lut[mem.b[0]])
-	{
-		case M_impl: break;
-		case M_InnX:
-			sprintf(s, " ($%02X,X)", mem.b[1]);
-			strcat(str, s);
-			break;
-		case M_nn:
-			sprintf(s, " $%02X", mem.b[1]);
-			strcat(str, s);
-			break;
-		case M_immnn:
-			sprintf(s, " #$%02X", mem.b[1]);
-			strcat(str, s);
-			break;
-		case M_A: break;
-		case M_nnnn:
-			sprintf(s, " $%02X%02X", mem.b[2], mem.b[1]);
-			strcat(str, s);
-			break;
-		case M_nnrr:
-			sprintf(s, " $%02X,$%04X", mem.b[1], (addr + 3 + mem.b[2]) );
-			strcat(str, s);
-			break;
-		case M_rr:
-			if (mem.b[1] & 0x80)
-				sprintf(s, " $%04X", (addr + 2 - 256 + mem.b[1]) );
-			else
-				sprintf(s, " $%04X", (addr + 2 + mem.b[1]) );
-			strcat(str, s);
-			break;
-		case M_InnY:
-			sprintf(s, " ($%02X),Y", mem.b[1]);
-			strcat(str, s);
-			break;
-		case M_InnZ:
-			sprintf(s, " ($%02X),Z", mem.b[1]);
-			strcat(str, s);
-			break;
-		case M_rrrr:
-			sprintf(s, " $%04X", (addr + 2 + (mem.b[2] << 8) + mem.b[1]) & 0xffff );
-			strcat(str, s);
-			break;
-		case M_nnX:
-			sprintf(s, " $%02X,X", mem.b[1]);
-			strcat(str, s);
-			break;
-		case M_nnnnY:
-			sprintf(s, " $%02X%02X,Y", mem.b[2], mem.b[1]);
-			strcat(str, s);
-			break;
-		case M_nnnnX:
-			sprintf(s, " $%02X%02X,X", mem.b[2], mem.b[1]);
-			strcat(str, s);
-			break;
-		case M_Innnn:
-			sprintf(s, " ($%02X%02X)", mem.b[2], mem.b[1]);
-			strcat(str, s);
-			break;
-		case M_InnnnX:
-			sprintf(s, " ($%02X%02X,X)", mem.b[2], mem.b[1]);
-			strcat(str, s);
-			break;
-		case M_InnSPY:
-			sprintf(s, " ($%02X,SP),Y", mem.b[1]);
-			strcat(str, s);
-			break;
-		case M_nnY:
-			sprintf(s, " $%02X,Y", mem.b[1]);
-			strcat(str, s);
-			break;
-		case M_immnnnn:
-			sprintf(s, " #$%02X%02X", mem.b[2], mem.b[1]);
-			strcat(str, s);
-			break;
-	}
+#define DIS_BACK_WINDOW 512   // how far back the instructions leading to an address are looked for
 
-  return last_bytecount;
+// how likely an instruction is to be real code (for telling data apart from code when decoding backwards)
+int dis_weight(unsigned char* b)
+{
+  const type_opcode_desc* d = decode_opcode(b);
+  int op = b[d->prefix];
+
+  if (d->name[0] == '\0' || op == 0x00)
+    return -4;
+  if (d->prefix == 0 && !(opcode_desc_6502[op].flags & OPF_UNDOC) &&
+      strcmp(opcode_desc_6502[op].name, d->name) == 0)
+    return 2;   // plain 6502
+  return 1;
 }
 
-int* get_backtrace_addresses(void)
+/**
+ * finds the instruction starts leading up to 'addr', using the .list file's
+ * addresses as known boundaries: decodes forward from the earliest one in
+ * the window, jumping to the next known boundary whenever an instruction
+ * would overlap it ('b' holds the bytes from 'start' to 'addr').
+ *
+ * returns:
+ *   the number of starts put into 'starts' (0 if the .list file doesn't help)
+ */
+int list_boundaries(int addr, int start, unsigned char* b, int* starts)
 {
-	// get current register values
-	reg_data reg = get_regs();
+  static int known[DIS_BACK_WINDOW];
+  int nknown = 0;
+
+  for (int k = fileloc_lower_bound(start); k < lstFileLocCount && lstFileLoc[k].addr < addr; k++)
+    known[nknown++] = lstFileLoc[k].addr;
+
+  if (nknown == 0)
+    return 0;
+
+  int n = 0;
+  int k = 0;
+  for (int a = known[0]; a < addr; )
+  {
+    starts[n++] = a;
+    while (k < nknown && known[k] <= a)
+      k++;
+
+    int next = a + decode_opcode(&b[a - start])->len;
+    int limit = k < nknown ? known[k] : addr;
+    a = next > limit ? limit : next;
+  }
+
+  return n;
+}
+
+/**
+ * finds the instruction starts leading up to 'addr' without any help: decodes
+ * forward from every byte in the window, keeping the chains that land exactly
+ * on 'addr', and picks the one whose instructions look the most like code
+ * (where the chains of many candidate starts merge weighs in as well)
+ *
+ * returns:
+ *   the number of starts put into 'starts'
+ */
+int scored_boundaries(int addr, int start, unsigned char* b, int* starts)
+{
+  static int next[DIS_BACK_WINDOW];
+  static int score[DIS_BACK_WINDOW];
+  static int votes[DIS_BACK_WINDOW];
+  int len = addr - start;
+  int best = -1;
+
+  // which starts lead to 'addr' (next[k] = -1: none), and how many chains pass through each
+  memset(votes, 0, sizeof(votes));
+  for (int k = len - 1; k >= 0; k--)
+  {
+    int n = k + decode_opcode(&b[k])->len;
+    next[k] = (n == len || (n < len && next[n] != -1)) ? n : -1;
+    for (int j = next[k]; j != -1 && j < len; j = next[j])
+      votes[j]++;
+  }
+
+  // chains are scored from their end
+  for (int k = len - 1; k >= 0; k--)
+  {
+    if (next[k] == -1)
+      continue;
+    score[k] = dis_weight(&b[k]) + (votes[k] > 1) + (next[k] < len ? score[next[k]] : 0);
+    if (best == -1 || score[k] >= score[best])
+      best = k;
+  }
+
+  int n = 0;
+  for (int k = best; k != -1 && k < len; k = next[k])
+    starts[n++] = start + k;
+
+  return n;
+}
+
+/**
+ * finds (up to) 'count' instructions leading up to 'addr', all from a single
+ * read of the 512 bytes before it (which is left in 'b', from '*start' on)
+ *
+ * returns:
+ *   the number found (their addresses being put into 'starts', in order)
+ */
+int find_preceding_instructions(int addr, int count, int* starts, unsigned char* b, int* start)
+{
+  static int found[DIS_BACK_WINDOW];
+
+  addr &= 0xffff;
+  *start = addr > DIS_BACK_WINDOW ? addr - DIS_BACK_WINDOW : 0;
+  memset(b, 0, DIS_BACK_WINDOW + DIS_MAX_LEN);
+  get_mem_block(*start, b);
+  memset(&b[addr - *start], 0, DIS_MAX_LEN);  // (the window ends at 'addr')
+
+  // the .list file's boundaries, extended further back by scoring if need be
+  int n = list_boundaries(addr, *start, b, found);
+  int first = n > 0 ? found[0] : addr;
+  if (n < count && first > *start)
+  {
+    static int more[DIS_BACK_WINDOW];
+    int m = scored_boundaries(first, *start, b, more);
+    memmove(found + m, found, n * sizeof(int));
+    memcpy(found, more, m * sizeof(int));
+    n += m;
+  }
+
+  if (n > count)
+  {
+    memmove(found, found + n - count, count * sizeof(int));
+    n = count;
+  }
+  memcpy(starts, found, n * sizeof(int));
+
+  return n;
+}
+
+int* get_backtrace_addresses(void)
+{
+	// get current register values
+	reg_data reg = get_regs();
 
   static int addresses[8];
 
@@ -830,16 +1682,27 @@ int* get_backtrace_addresses(void)
 	return addresses;
 }
 
-void cmdDisassemble(void)
+// prints a disassembled line, headed by its label (if any)
+void print_dis_line(type_dis_line* line, bool highlight)
 {
-  char str[128] = { 0 };
-  int last_bytecount = 0;
+  type_symmap_entry* sme = find_symmap_floor(line->addr);
+  if (sme != NULL && sme->addr == line->addr)
+    printf("%s:\n", sme->symbol);
+
+  if (highlight)
+    printf("%s%s%s\n", KINV, line->text, KNRM);
+  else
+    printf("%s\n", line->text);
+}
 
+void cmdDisassemble(void)
+{
   if (autowatch)
 	  cmdWatches();
 
   int addr;
 	int cnt = 1; // number of lines to disassemble
+  int before = 0; // number of lines to disassemble ahead of the pc
 
 	// get current register values
 	reg_data reg = get_regs();
@@ -847,7 +1710,17 @@ void cmdDisassemble(void)
 	// get address from parameter?
   char* token = strtok(NULL, " ");
   
-  if (token != NULL)
+  if (token != NULL && (token[0] == '~' || (token[0] == '-' && isxdigit((unsigned char)token[1]))))
+  {
+    // -<n> = the n instructions leading up to the pc, ~<n> = n either side of it
+    addr = reg.pc;
+    before = get_sym_value(&token[1]);
+    if (token[0] == '~')
+      cnt = before + 1;
+    else if ((token = strtok(NULL, " ")) != NULL)
+      cnt = get_sym_value(token);
+  }
+  else if (token != NULL)
 	{
 	  if (strcmp(token, "-") == 0) // '-' equates to current pc
 		{
@@ -879,35 +1752,50 @@ void cmdDisassemble(void)
 		printf("<<< FRAME#: %d >>>\n", traceframe);
 	}
 
+  static type_dis_line lines[DIS_BATCH];
   int idx = 0;
 
+  if (before > 0)
+  {
+    static int starts[DIS_BACK_WINDOW];
+    static unsigned char b[DIS_BACK_WINDOW + DIS_MAX_LEN];
+    int start;
+
+    int n = find_preceding_instructions(addr, before, starts, b, &start);
+    for (int k = 0; k < n; k++)
+    {
+      lines[0].addr = starts[k];
+      lines[0].len = disassemble_bytes(lines[0].text, DIS_LINE_SIZE, starts[k], &b[starts[k] - start]);
+      print_dis_line(&lines[0], false);
+    }
+  }
+
 	while (idx < cnt)
 	{
-    last_bytecount = disassemble_addr_into_string(str, addr);
+    int n = disassemble_lines(lines, addr, cnt - idx < DIS_BATCH ? cnt - idx : DIS_BATCH);
 
-    // print from .list ref? (i.e., find source in .a65 file?)
-    if (idx == 0)
-		{
-			type_fileloc *found = find_in_list(addr);
-			if (found)
-			{
-				printf("> %s:%d\n", found->file, found->lineno);
-				show_location(found);
-        printf("---------------------------------------\n");
-			}
-		}
+    for (int k = 0; k < n; k++, idx++)
+    {
+      // print from .list ref? (i.e., find source in .a65 file?)
+      if (idx == 0 && before == 0)
+      {
+        type_fileloc *found = find_in_list(addr);
+        if (found)
+        {
+          printf("> %s:%d\n", found->file, found->lineno);
+          show_location(found);
+          printf("---------------------------------------\n");
+        }
+      }
 
-		// just print the raw disassembly line
-		if (cnt != 1 && idx == 0)
-			printf("%s%s%s\n", KINV, str, KNRM);
-		else
-			printf("%s\n", str);
+      // just print the raw disassembly line
+      print_dis_line(&lines[k], (cnt != 1 || before > 0) && idx == 0);
+    }
 
 		if (ctrlcflag)
 			break;
 
-    addr += last_bytecount;
-		idx++;
+    addr = lines[n-1].addr + lines[n-1].len;
 	} // end while
 }
 
@@ -915,15 +1803,35 @@ void cmdStep(void)
 {
   traceframe = 0;
 
-  // just send an enter command
-  serialWrite("\n");
-  serialRead(inbuf, BUFSIZE);
+  char* token = strtok(NULL, " ");
+  int count = 1;
+  if (token != NULL)
+    count = get_sym_value(token);
+
+  if (count > 1)
+  {
+    reg_data reg = get_regs();
+    predicted_run(&reg, count, -1, -1);
+  }
+  else if (journal_enabled)
+  {
+    reg_data reg = get_regs();
+    journal_instruction(&reg);
+    step_target(&reg);
+  }
+  else
+  {
+    // just send an enter command
+    serialWrite("\n");
+    serialRead(inbuf, BUFSIZE);
+    strcpy(stopinfo, inbuf);
+  }
 
   if (outputFlag)
 	{
 		if (autocls)
 			cmdClearScreen();
-		printf("%s", inbuf);
+		printf("%s", stopinfo);
 		cmdDisassemble();
 	}
 }
@@ -935,43 +1843,29 @@ void cmdNext(void)
 	if (autocls)
 		cmdClearScreen();
 
-  // check if this is a JSR command
+  // check if this is a JSR/BSR command
   reg_data reg = get_regs();
 	mem_data mem = get_mem(reg.pc);
 		
 	// if not, then just do a normal step
-	if (strcmp(instruction_lut[mem.b[0]], "JSR") != 0)
+	if (!(opcode_desc[mem.b[0]].flags & OPF_CALL))
 	{
 		cmdStep();
 	}
 	else
 	{
-		// if it is JSR, then keep doing step into until it returns to the next command after the JSR
-
-		type_opcode_mode mode = opcode_mode[mode_lut[mem.b[0]]];
-		int last_bytecount = mode.val + 1;
-		int next_addr = reg.pc + last_bytecount;
-
-		while (reg.pc != next_addr)
-		{
-			// just send an enter command
-			serialWrite("\n");
-			serialRead(inbuf, BUFSIZE);
+		// if it is JSR/BSR, then keep doing step into until it returns to the next command after the JSR
 
-			reg = get_regs();
+		int next_addr = reg.pc + opcode_desc[mem.b[0]].len;
 
-			if (ctrlcflag)
-				break;
-		}
+		predicted_run(&reg, 0, next_addr, reg.sp);
 
     // show disassembly of current position
-		serialWrite("r\n");
-		serialRead(inbuf, BUFSIZE);
 		if (outputFlag)
 		{
 			if (autocls)
 				cmdClearScreen();
-			printf("%s", inbuf);
+			printf("%s", stopinfo);
 			cmdDisassemble();
 		}
 	}
@@ -984,28 +1878,16 @@ void cmdFinish(void)
 
   reg_data reg = get_regs();
 
-  int cur_sp = reg.sp;
-	bool function_returning = false;
-
-  //outputFlag = false;
-  while (!function_returning)
-	{
-	  reg = get_regs();
-		mem_data mem = get_mem(reg.pc);
-
-		if ((strcmp(instruction_lut[mem.b[0]], "RTS") == 0 ||
-                     strcmp(instruction_lut[mem.b[0]], "RTI") == 0)
-				&& reg.sp == cur_sp)
-			function_returning = true;
-
-    cmdClearScreen();
-		cmdNext();
+  // run until an RTS/RTI returns from the current stack level
+  predicted_run(&reg, 0, -1, reg.sp);
 
-		if (ctrlcflag)
-			break;
-	}
-	//outputFlag = true;
-	cmdDisassemble();
+  if (outputFlag)
+  {
+    if (autocls)
+      cmdClearScreen();
+    printf("%s", stopinfo);
+    cmdDisassemble();
+  }
 }
 
 // check symbol-map for value. If not found there, just return
@@ -1140,177 +2022,1398 @@ void cmdAutoClearScreen(void)
 	printf(" - autocls is turned %s.\n", autocls ? "on" : "off");
 }
 
-void cmdSetBreakpoint(void)
+bool lookup_symbol(char* sym, int* val)
 {
-  char* token = strtok(NULL, " ");
-  char str[100];
-  
-  if (token != NULL)
+  type_symmap_entry* sme = find_in_symmap(sym);
+  if (sme == NULL)
+    return false;
+
+  *val = sme->addr;
+  return true;
+}
+
+// reads a byte of target memory for expression evaluation, re-using the last
+// 16-byte line fetched (conditions often test neighbouring bytes)
+mem_data peek_cache;
+bool peek_cache_valid = false;
+
+int peek_byte(int addr)
+{
+  if (!peek_cache_valid || addr < peek_cache.addr || addr >= peek_cache.addr + 16)
   {
-		int addr = get_sym_value(token);
-		printf("- Setting hardware breakpoint to $%04X\n", addr);
+    peek_cache = get_mem(addr);
+    peek_cache.addr = addr;
+    peek_cache_valid = true;
+  }
 
-    sprintf(str, "b%04X\n", addr);
-    serialWrite(str);
-    serialRead(inbuf, BUFSIZE);
-	}
+  return peek_cache.b[addr - peek_cache.addr];
 }
 
-void cmd_watch(type_watch type)
+void cmdSetBreakpoint(void)
 {
   char* token = strtok(NULL, " ");
+  char str[100];
   
-  if (token != NULL)
+  if (token == NULL)
   {
-	  if (find_in_watchlist(token))
-		{
-		  printf("watch already exists!\n");
-			return;
-		}
+    if (!brkpt.active)
+      printf("- No breakpoint set\n");
+    else
+    {
+      printf("- Breakpoint at $%04X, hits=%d", brkpt.addr, brkpt.hits);
+      if (brkpt.count)
+        printf(", count=%d", brkpt.count);
+      if (brkpt.has_cond)
+        printf(", if %s", brkpt.cond_text);
+      printf("\n");
+    }
+    return;
+  }
 
-	  type_watch_entry we;
-		we.type = type;
-		we.name = token;
-		add_to_watchlist(we);
+  char* addr_text = token;
+  int addr = get_sym_value(token);
+  int count = 0;
+  char* cond = NULL;
+  type_expr expr;
 
-		printf("watch added!\n");
-	}
-}
+  while ((token = strtok(NULL, " ")) != NULL)
+  {
+    if (strcmp(token, "count") == 0)
+    {
+      token = strtok(NULL, " ");
+      if (token == NULL || sscanf(token, "%d", &count) != 1)
+      {
+        printf("Missing <N> parameter for 'count'!\n");
+        return;
+      }
+    }
+    else if (strcmp(token, "if") == 0)
+    {
+      cond = strtok(NULL, "");
+      if (cond == NULL)
+      {
+        printf("Missing <expr> parameter for 'if'!\n");
+        return;
+      }
+      break;
+    }
+    else
+    {
+      printf("Unknown breakpoint option \"%s\"!\n", token);
+      return;
+    }
+  }
 
-void cmdWatchByte(void)
-{
-  cmd_watch(TYPE_BYTE);
-}
+  if (cond != NULL && !expr_compile(&expr, cond, lookup_symbol))
+    return;
 
-void cmdWatchWord(void)
-{
-  cmd_watch(TYPE_WORD);
+  free(brkpt.cond_text);
+  free(brkpt.addr_text);
+  brkpt.active = true;
+  brkpt.addr = addr;
+  brkpt.addr_text = strdup(addr_text);
+  brkpt.count = count;
+  brkpt.hits = 0;
+  brkpt.has_cond = (cond != NULL);
+  brkpt.cond_text = cond ? strdup(cond) : NULL;
+  if (cond != NULL)
+    brkpt.cond = expr;
+
+  printf("- Setting hardware breakpoint to $%04X\n", addr);
+
+  sprintf(str, "b%04X\n", addr);
+  serialWrite(str);
+  serialRead(inbuf, BUFSIZE);
 }
 
-void cmdWatchDWord(void)
+// halts the running target (puts the cpu back into trace mode)
+void halt_target(void)
 {
-  cmd_watch(TYPE_DWORD);
+  serialWrite("t1\n");
+  serialRead(inbuf, BUFSIZE);
 }
 
-void cmdWatchString(void)
-{
-  cmd_watch(TYPE_STRING);
-}
+bool journal_covered = false; // set while the target runs through already journaled instructions
 
-void cmdWatches(void)
+// lets the target run freely. If it may be sitting on the breakpoint
+// address, step over it first so that it doesn't re-trigger immediately.
+void resume_target(bool check_bp)
 {
-  type_watch_entry* iter = lstWatches;
-	int cnt = 0;
-
-  printf("---------------------------------------\n");
-	
-	while (iter != NULL)
-	{
-	  cnt++;
-
-		printf("#%d: %s ", cnt, type_names[iter->type]);
+  // the journal can't follow a freely running target
+  if (!journal_covered)
+    journal_clear();
 
-		switch (iter->type)
-		{
-		  case TYPE_BYTE:   print_byte(iter->name);   break;
-		  case TYPE_WORD:   print_word(iter->name);   break;
-		  case TYPE_DWORD:  print_dword(iter->name);  break;
-		  case TYPE_STRING: print_string(iter->name); break;
-		}
+  if (check_bp && brkpt.active)
+  {
+    reg_data reg = get_regs();
 
-		iter = iter->next;
-	}
+    if (reg.pc == brkpt.addr)
+    {
+      serialWrite("\n");
+      serialRead(inbuf, BUFSIZE);
+    }
+  }
 
-	if (cnt == 0)
-	  printf("no watches in list\n");
-  printf("---------------------------------------\n");
+  serialWrite("t0\n");
+  serialRead(inbuf, BUFSIZE);
 }
 
-void cmdDeleteWatch(void)
+typedef enum { STOP_HIT, STOP_TIMEOUT, STOP_INTERRUPTED } type_stop;
+
+/**
+ * waits (while the target is running) for the register display that the
+ * monitor prints when the breakpoint or watchpoint triggers.
+ *
+ * timeout_ms = how long to wait for (0 = forever)
+ *
+ * returns:
+ *   STOP_HIT = target stopped, 'reg' holds the registers and stopinfo the display
+ *   STOP_TIMEOUT = the target is still running
+ *   STOP_INTERRUPTED = interrupted by ctrl-c (the target gets halted)
+ */
+type_stop wait_for_stop(reg_data* reg, int timeout_ms)
 {
-  char* token = strtok(NULL, " ");
-  
-  if (token != NULL)
+  static char stopbuf[BUFSIZE];
+  int len = 0;
+  int waited = 0;
+
+  while (!ctrlcflag)
   {
-	  // user wants to delete all watches?
-	  if (strcmp(token, "all") == 0)
-		{
-		  // TODO: add a confirm yes/no prompt...
-			outputFlag = false;
-			while (delete_from_watchlist(1))
-			  ;
-			outputFlag = true;
-			printf("deleted all watches!\n");
-		}
-		else
-		{
-		  int wnum;
-		  int n = sscanf(token, "%d", &wnum);
+    if (timeout_ms != 0 && waited >= timeout_ms)
+      return STOP_TIMEOUT;
+
+    int slice = timeout_ms != 0 && timeout_ms - waited < 100 ? timeout_ms - waited : 100;
+    int n = serialReadChunk(stopbuf + len, BUFSIZE - 1 - len, slice);
+    if (n < 0)
+      break;
+    if (n == 0)
+      waited += slice;
+    len += n;
+    stopbuf[len] = '\0';
+
+    char* banner = strstr(stopbuf, "PC   A");
+    if (banner != NULL && strchr(banner, '\n') != NULL &&
+        strchr(strchr(banner, '\n') + 1, '\n') != NULL)
+    {
+      strcpy(stopinfo, banner);
+      *(strchr(strchr(stopinfo, '\n') + 1, '\n') + 1) = '\0';
+      parse_regs(stopinfo, reg);
+      return STOP_HIT;
+    }
 
-			if (n == 1)
-			{
-			  delete_from_watchlist(wnum);
-			}
-		}
-	}
-}
+    // keep the tail of the buffer in case the banner is split across reads
+    if (len > BUFSIZE / 2)
+    {
+      memmove(stopbuf, stopbuf + len - 64, 64);
+      len = 64;
+    }
+  }
 
+  halt_target();
+  strcpy(stopinfo, inbuf);
+  return STOP_INTERRUPTED;
+}
 
-void cmdAutoWatch(void)
+// decides whether a hit of the breakpoint should stop, or be auto-continued
+bool breakpoint_should_stop(reg_data* reg)
 {
-  char* token = strtok(NULL, " ");
+  if (brkpt.has_cond)
+  {
+    int regs[R_COUNT];
+    regs_to_array(reg, regs);
 
-  // if no parameter, then just toggle it
-	if (token == NULL)
-		autowatch = !autowatch;
-	else if (strcmp(token, "1") == 0)
-		autowatch = true;
-	else if (strcmp(token, "0") == 0)
-		autowatch = false;
-	
-	printf(" - autowatch is turned %s.\n", autowatch ? "on" : "off");
+    peek_cache_valid = false;
+    if (!expr_eval(&brkpt.cond, regs, peek_byte))
+      return false;
+  }
+
+  // (with a count of N, it stops on every N'th hit)
+  brkpt.hits++;
+  return brkpt.count == 0 || brkpt.hits % brkpt.count == 0;
 }
 
-void cmdSymbolValue(void)
+// data watchpoints ('watch write ...')
+// ==================================
+// The monitor only offers a single 'w<addr>' hardware watchpoint, so it gets
+// used for the first single-byte watchpoint. Any other ranges are checked by
+// letting the target run in short slices and comparing the 512-byte blocks
+// covering them (one 'D' read per block, blocks shared between ranges).
+
+#define WATCH_POLL_MS 50
+#define MAX_WATCH_BLOCKS 128
+
+typedef struct twp
 {
-  char* token = strtok(NULL, " ");
-  
-  if (token != NULL)
+  int start;
+  int end;     // inclusive
+  char* text;  // as typed by the user
+  struct twp* next;
+} type_watchpoint;
+
+type_watchpoint* lstWatchpoints = NULL;
+
+unsigned char watch_shadow[0x10000]; // last known contents of watched memory
+int watch_blocks[MAX_WATCH_BLOCKS];
+int watch_block_count = 0;
+int hwwatch_addr = -1;               // address of the 'w' hardware watchpoint
+
+// works out the fewest 512-byte reads that cover all watched ranges
+// (returns false if MAX_WATCH_BLOCKS reads aren't enough to cover them)
+bool watch_plan_blocks(void)
+{
+  static char covered[0x10000];
+  memset(covered, 0, sizeof(covered));
+  watch_block_count = 0;
+
+  for (int addr = 0; addr < 0x10000; addr++)
   {
-    type_symmap_entry* sme = find_in_symmap(token);
+    bool watched = false;
+    for (type_watchpoint* iter = lstWatchpoints; iter != NULL; iter = iter->next)
+      if (addr >= iter->start && addr <= iter->end)
+        watched = true;
+
+    if (!watched || covered[addr])
+      continue;
+    if (watch_block_count == MAX_WATCH_BLOCKS)
+      return false;
+
+    int block = addr & ~0xf;
+    watch_blocks[watch_block_count++] = block;
+    for (int k = block; k < block + 512 && k < 0x10000; k++)
+      covered[k] = 1;
+  }
 
-		if (sme != NULL)
-		  printf("%s : %s\n", sme->sval, sme->symbol);
-	}
+  return true;
 }
 
-void cmdSave(void)
+// programs the hardware watchpoint and takes the initial snapshot.
+// returns true if some ranges need to be polled in software.
+bool watch_prepare(void)
 {
-  char* strBinFile = strtok(NULL, " ");
+  char str[100];
+  int hw = -1;
+  bool polling = false;
 
-  if (!strBinFile)
+  for (type_watchpoint* iter = lstWatchpoints; iter != NULL; iter = iter->next)
   {
-    printf("Missing <binfile> parameter!\n");
-    return;
+    if (hw == -1 && iter->start == iter->end)
+      hw = iter->start;
+    else
+      polling = true;
   }
 
-	char* strAddr = strtok(NULL, " ");
-	if (!strAddr)
-	{
-	  printf("Missing <addr> parameter!\n");
-		return;
-	}
+  if (hw != hwwatch_addr)
+  {
+    if (hw == -1)
+      sprintf(str, "w\n");
+    else
+      sprintf(str, "w%04X\n", hw);
+    serialWrite(str);
+    serialRead(inbuf, BUFSIZE);
+    hwwatch_addr = hw;
+  }
 
-  char* strCount = strtok(NULL, " ");
-  if (!strCount)
+  if (!watch_plan_blocks())
+    printf("- Warning: the watched ranges need more than %d reads, the rest of them won't be checked!\n", MAX_WATCH_BLOCKS);
+
+  // (a block near the top of memory reads past $FFFF, so only the part below it is kept)
+  static unsigned char block[512];
+  for (int k = 0; k < watch_block_count; k++)
   {
-    printf("Missing <count> parameter!\n");
-    return;
+    int base = watch_blocks[k];
+    get_mem_block(base, block);
+    memcpy(&watch_shadow[base], block, base + 512 > 0x10000 ? 0x10000 - base : 512);
   }
 
-	int addr = get_sym_value(strAddr);
-  int count;
-  sscanf(strCount, "%X", &count);
+  return polling;
+}
+
+// re-reads the watched blocks, reporting any changed bytes as old -> new.
+// If pc is -1 (target halted by polling), the registers are only fetched
+// once a change has been found. Returns true if anything changed.
+bool watch_check(int pc)
+{
+  static unsigned char block[512];
+  bool changed = false;
+
+  for (int k = 0; k < watch_block_count; k++)
+  {
+    int base = watch_blocks[k];
+    int len = base + 512 > 0x10000 ? 0x10000 - base : 512;
+    get_mem_block(base, block);
+
+    int wnum = 0;
+    for (type_watchpoint* iter = lstWatchpoints; iter != NULL; iter = iter->next)
+    {
+      wnum++;
+      for (int addr = iter->start; addr <= iter->end; addr++)
+      {
+        if (addr < base || addr >= base + len)
+          continue;
+        if (block[addr - base] != watch_shadow[addr])
+        {
+          if (pc == -1)
+          {
+            reg_data reg = get_regs();
+            strcpy(stopinfo, inbuf);
+            pc = reg.pc;
+          }
+          printf("- watchpoint#%d (%s): $%04X changed $%02X -> $%02X (PC=$%04X)\n",
+            wnum, iter->text, addr, watch_shadow[addr], block[addr - base], pc);
+          changed = true;
+        }
+      }
+    }
+
+    memcpy(&watch_shadow[base], block, len);
+  }
+
+  return changed;
+}
+
+void cmdContinue(void)
+{
+  reg_data reg;
+  int skipped = 0;
+  bool polling = watch_prepare();
+  bool check_bp = true;
+
+  traceframe = 0;
+
+  while (1)
+  {
+    resume_target(check_bp);
+    check_bp = true;
+
+    type_stop ret = wait_for_stop(&reg, polling ? WATCH_POLL_MS : 0);
+
+    if (ret == STOP_INTERRUPTED)
+    {
+      printf("- Interrupted (auto-continued %d times)\n", skipped);
+      break;
+    }
+
+    if (ret == STOP_TIMEOUT)
+    {
+      // time to poll the watched memory
+      halt_target();
+      if (!watch_check(-1))
+      {
+        check_bp = false;
+        continue;
+      }
+      printf("- (changes detected by polling, PC is where the target was halted)\n");
+      break;
+    }
+
+    if (lstWatchpoints != NULL && watch_check(reg.pc))
+      break;
+
+    if (brkpt.active && reg.pc == brkpt.addr)
+    {
+      if (!breakpoint_should_stop(&reg))
+      {
+        skipped++;
+        continue;
+      }
+    }
+    else if (hwwatch_addr != -1)
+      printf("- watchpoint: $%04X written (value unchanged, PC=$%04X)\n", hwwatch_addr, reg.pc);
+
+    if (skipped)
+      printf("- Breakpoint auto-continued %d times\n", skipped);
+    break;
+  }
+
+  if (outputFlag)
+  {
+    if (autocls)
+      cmdClearScreen();
+    printf("%s", stopinfo);
+    cmdDisassemble();
+  }
+}
+
+// reports a breakpoint/watchpoint stop that happened while no command was
+// running (e.g., after a raw 'g' or 't0')
+void show_async_stop(char* info)
+{
+  char str[DIS_LINE_SIZE] = { 0 };
+  reg_data reg;
+
+  printf("\n*** Target stopped ***\n%s", info);
+
+  if (parse_regs(info, &reg))
+  {
+    traceframe = 0;
+    type_fileloc* found = find_in_list(reg.pc);
+    if (found)
+      printf("> %s:%d\n", found->file, found->lineno);
+
+    disassemble_addr_into_string(str, reg.pc);
+    printf("%s%s%s\n", KINV, str, KNRM);
+  }
+}
+
+// resolves a watchpoint's "<addr>[-<endaddr>]" (returns false if it's not a valid range)
+bool watch_range(char* text, int* start, int* end)
+{
+  char str[256];
+
+  snprintf(str, sizeof(str), "%s", text);
+  char* dash = strchr(str, '-');
+  if (dash != NULL)
+  {
+    *dash = '\0';
+    *end = get_sym_value(dash + 1);
+  }
+  *start = get_sym_value(str);
+  if (dash == NULL)
+    *end = *start;
+
+  return *end >= *start && *end <= 0xffff;
+}
+
+void cmdWatchpoint(void)
+{
+  char* token = strtok(NULL, " ");
+
+  if (token == NULL || strcmp(token, "list") == 0)
+  {
+    int cnt = 0;
+    for (type_watchpoint* iter = lstWatchpoints; iter != NULL; iter = iter->next)
+    {
+      cnt++;
+      printf("#%d: write $%04X-$%04X (%s)%s\n", cnt, iter->start, iter->end, iter->text,
+        iter->start == hwwatch_addr && iter->start == iter->end ? " [hardware]" : "");
+    }
+    if (cnt == 0)
+      printf("no watchpoints set\n");
+    return;
+  }
+
+  if (strcmp(token, "del") == 0)
+  {
+    token = strtok(NULL, " ");
+    if (token == NULL)
+    {
+      printf("Missing <watchpoint#>/all parameter!\n");
+      return;
+    }
+
+    int wnum = -1;
+    if (strcmp(token, "all") != 0 && (sscanf(token, "%d", &wnum) != 1 || wnum < 1))
+    {
+      printf("Invalid watchpoint number '%s'!\n", token);
+      return;
+    }
+
+    int cnt = 0;
+    type_watchpoint** pp = &lstWatchpoints;
+    while (*pp != NULL)
+    {
+      cnt++;
+      if (wnum == -1 || cnt == wnum)
+      {
+        type_watchpoint* wp = *pp;
+        *pp = wp->next;
+        free(wp->text);
+        free(wp);
+        if (wnum != -1)
+          break;
+      }
+      else
+        pp = &(*pp)->next;
+    }
+    if (wnum > cnt)
+    {
+      printf("No watchpoint #%d!\n", wnum);
+      return;
+    }
+    watch_prepare();
+    printf("watchpoint(s) deleted!\n");
+    return;
+  }
+
+  if (strcmp(token, "write") != 0)
+  {
+    printf("Usage: watch write <addr>[-<endaddr>] / watch list / watch del <watchpoint#>/all\n");
+    return;
+  }
+
+  token = strtok(NULL, " ");
+  if (token == NULL)
+  {
+    printf("Missing <addr> parameter!\n");
+    return;
+  }
+
+  type_watchpoint* wp = malloc(sizeof(type_watchpoint));
+  wp->text = strdup(token);
+  if (!watch_range(token, &wp->start, &wp->end))
+  {
+    printf("Invalid range!\n");
+    free(wp->text);
+    free(wp);
+    return;
+  }
+
+  // add to end of list
+  type_watchpoint** pp = &lstWatchpoints;
+  while (*pp != NULL)
+    pp = &(*pp)->next;
+  wp->next = NULL;
+  *pp = wp;
+
+  if (!watch_plan_blocks())
+  {
+    printf("Too many watched ranges (they'd need more than %d reads)!\n", MAX_WATCH_BLOCKS);
+    *pp = NULL;
+    free(wp->text);
+    free(wp);
+    watch_plan_blocks();
+    return;
+  }
+
+  printf("watchpoint added! (checked during 'cont')\n");
+}
+
+// looks an address (as typed) up again after the symbols got reloaded, keeping the old one
+// if it was a symbol that's gone now (a plain number doesn't change anyway)
+int resolve_again(char* text, int old)
+{
+  int addr;
+  char extra;
+
+  type_symmap_entry* sme = find_in_symmap(text);
+  if (sme != NULL)
+    return sme->addr;
+
+  if (sscanf(text, "%X%c", &addr, &extra) != 1)
+    printf("- Symbol '%s' is gone, keeping $%04X\n", text, old);
+  return old;
+}
+
+// resolves the breakpoint (and its condition) and the watchpoints again, once the symbols have been reloaded
+void resolve_breakpoints(void)
+{
+  char str[100];
+
+  if (brkpt.active && brkpt.addr_text != NULL && resolve_again(brkpt.addr_text, brkpt.addr) != brkpt.addr)
+  {
+    brkpt.addr = resolve_again(brkpt.addr_text, brkpt.addr);
+    printf("- Moving hardware breakpoint (%s) to $%04X\n", brkpt.addr_text, brkpt.addr);
+
+    sprintf(str, "b%04X\n", brkpt.addr);
+    serialWrite(str);
+    serialRead(inbuf, BUFSIZE);
+  }
+
+  type_expr expr;
+  if (brkpt.active && brkpt.has_cond)
+  {
+    if (expr_compile(&expr, brkpt.cond_text, lookup_symbol))
+      brkpt.cond = expr;
+    else
+      printf("- Keeping the breakpoint condition as it was\n");
+  }
+
+  bool changed = false;
+  for (type_watchpoint* iter = lstWatchpoints; iter != NULL; iter = iter->next)
+  {
+    char text[256];
+    snprintf(text, sizeof(text), "%s", iter->text);
+    char* dash = strchr(text, '-');
+    if (dash != NULL)
+      *dash = '\0';
+    int start = resolve_again(text, iter->start);
+    int end = dash != NULL ? resolve_again(dash + 1, iter->end) : start;
+
+    if (end >= start && end <= 0xffff && (start != iter->start || end != iter->end))
+    {
+      iter->start = start;
+      iter->end = end;
+      printf("- Watchpoint (%s) is now $%04X-$%04X\n", iter->text, start, end);
+      changed = true;
+    }
+  }
+  if (changed)
+    watch_prepare();
+}
+
+// source-line stepping ('sstep'/'snext')
+// ======================================
+// The instructions of the current source line are decoded from one bulk read
+// and every way out of the line is collected (fall-through into the next
+// listed line, branch/jump targets outside it, and subroutine entries for
+// 'sstep'). If there is a single known exit, the hardware breakpoint is
+// borrowed to run straight there. Otherwise we fall back to stepping
+// instruction by instruction until the source line changes.
+
+#define MAX_LINE_EXITS 8
+
+bool same_line(type_fileloc* a, type_fileloc* b)
+{
+  if (a == NULL || b == NULL)
+    return a == b;
+
+  return a->lineno == b->lineno && strcmp(a->file, b->file) == 0;
+}
+
+// returns the address where the source line containing 'addr' ends
+int line_end_addr(int addr)
+{
+  type_fileloc* cur = find_fileloc_floor(addr);
+
+  if (cur == NULL)
+    return -1;
+
+  for (type_fileloc* iter = cur; iter < lstFileLoc + lstFileLocCount; iter++)
+    if (iter->addr > addr && !same_line(iter, cur))
+      return iter->addr;
+
+  return -1;
+}
+
+/**
+ * collects the addresses execution can leave the line [pc, end) through
+ *
+ * returns:
+ *   the number of exits, or -1 if an exit can't be predicted (indirect
+ *   jumps, returns, etc.)
+ */
+int find_line_exits(int pc, int end, bool into_subs, int* exits)
+{
+  unsigned char mem[512 + 16];
+  int count = 0;
+  int addr = pc;
+
+  if (end - pc > 512)
+    return -1;
+
+  get_mem_block(pc, mem);
+  memset(mem + 512, 0, 16);
+
+  while (addr < end)
+  {
+    unsigned char* b = &mem[addr - pc];
+    const type_opcode_desc* d = decode_opcode(b);
+    int op = b[d->prefix];
+    int len = d->len;
+    int target = -1;
+    bool falls_through = true;
+
+    switch (opcode_desc[op].mode)
+    {
+      case M_rr:   target = (addr + 2 + (signed char)b[1]) & 0xffff; break;
+      case M_rrrr: target = (addr + 2 + (b[2] << 8) + b[1]) & 0xffff; break;
+      case M_nnrr: target = (addr + 3 + (signed char)b[2]) & 0xffff; break;
+      default: break;
+    }
+
+    switch (op)
+    {
+      case 0x4C: // JMP $nnnn
+        target = b[1] + (b[2] << 8);
+        falls_through = false;
+        break;
+      case 0x20: // JSR $nnnn
+        if (into_subs)
+        {
+          // anything after the JSR is only reached after stepping into it
+          target = b[1] + (b[2] << 8);
+          falls_through = false;
+        }
+        break;
+      case 0x22: case 0x23: case 0x63: // JSR (ind), BSR
+        if (into_subs)
+          return -1;
+        target = -1;  // (stepped over, so it comes back to the next instruction)
+        break;
+      case 0x00: case 0x40: case 0x60: case 0x62: // BRK, RTI, RTS
+      case 0x6C: case 0x7C:                       // JMP (ind)
+        return -1;
+    }
+
+    if (target != -1 && (target < pc || target >= end))
+    {
+      bool dup = false;
+      for (int k = 0; k < count; k++)
+        dup |= (exits[k] == target);
+      if (!dup)
+      {
+        if (count == MAX_LINE_EXITS)
+          return -1;
+        exits[count++] = target;
+      }
+    }
+
+    if (!falls_through)
+      return count;
+
+    addr += len;
+  }
+
+  if (count == MAX_LINE_EXITS)
+    return -1;
+  exits[count++] = addr;
+  return count;
+}
+
+// runs the target until it reaches 'addr', by borrowing the hardware breakpoint
+type_stop run_to(int addr, reg_data* reg)
+{
+  char str[100];
+
+  sprintf(str, "b%04X\n", addr);
+  serialWrite(str);
+  serialRead(inbuf, BUFSIZE);
+
+  resume_target(false);
+  type_stop ret = wait_for_stop(reg, 0);
+
+  // restore the user's breakpoint
+  if (brkpt.active)
+    sprintf(str, "b%04X\n", brkpt.addr);
+  else
+    sprintf(str, "b\n");
+  serialWrite(str);
+  serialRead(inbuf, BUFSIZE);
+
+  return ret;
+}
+
+void source_step(bool into_subs)
+{
+  int exits[MAX_LINE_EXITS];
+  reg_data reg = get_regs();
+  type_fileloc* start = find_fileloc_floor(reg.pc);
+
+  traceframe = 0;
+
+  if (start == NULL)
+  {
+    printf("- No source line information for $%04X (are any .list files loaded?)\n", reg.pc);
+    return;
+  }
+
+  int end = line_end_addr(reg.pc);
+  int count = end == -1 ? -1 : find_line_exits(reg.pc, end, into_subs, exits);
+
+  if (count == 1)
+  {
+    if (run_to(exits[0], &reg) == STOP_INTERRUPTED)
+      printf("- Interrupted\n");
+  }
+  else
+  {
+    // step until we land on a different source line
+    while (same_line(find_fileloc_floor(reg.pc), start))
+    {
+      mem_data mem = get_mem(reg.pc);
+
+      // (steps over JSR/BSR calls, like 'next' does)
+      if (!into_subs && (opcode_desc[mem.b[0]].flags & OPF_CALL))
+      {
+        if (run_to(reg.pc + opcode_desc[mem.b[0]].len, &reg) == STOP_INTERRUPTED)
+          break;
+      }
+      else
+      {
+        journal_instruction(&reg);
+        step_target(&reg);
+      }
+
+      if (ctrlcflag)
+        break;
+    }
+  }
+
+  if (outputFlag)
+  {
+    if (autocls)
+      cmdClearScreen();
+    printf("%s", stopinfo);
+    cmdDisassemble();
+  }
+}
+
+void cmdSourceStep(void)
+{
+  source_step(true);
+}
+
+void cmdSourceNext(void)
+{
+  source_step(false);
+}
+
+#define PREDICT_MAX_INSTR 1000000
+
+// pc visit counts of the last prediction (to know which hit of the stop address is the one)
+unsigned int predict_visits[0x10000];
+
+// sets up the host-side interpreter (on first use)
+void prepare_emu(void)
+{
+  static bool emu_ready = false;
+
+  if (!emu_ready)
+  {
+    emu_init(get_mem_block);
+    emu_ready = true;
+  }
+}
+
+// records the instruction at the pc (before it gets stepped) into the journal
+void journal_instruction(reg_data* reg)
+{
+  if (!journal_enabled)
+    return;
+
+  type_cpu_state cpu = { reg->pc, reg->a, reg->x, reg->y, reg->z, reg->b, reg->sp, reg->p & 0xff };
+  type_cpu_state before = cpu;
+
+  // decoding it on the host tells which bytes it will overwrite (even when
+  // the instruction as a whole can't be predicted, e.g. as it reads I/O)
+  prepare_emu();
+  emu_invalidate();
+  emu_step(&cpu);
+  journal_push(&before, emu_writes, emu_nwrites, emu_writes_known);
+}
+
+// steps the real target by a single instruction
+void step_target(reg_data* reg)
+{
+  serialWrite("\n");
+  serialRead(inbuf, BUFSIZE);
+  strcpy(stopinfo, inbuf);
+  parse_regs(stopinfo, reg);
+}
+
+/**
+ * runs the target until its pc has reached 'addr' for the n'th time
+ * (counting only arrivals, not the address it may presently be sitting on)
+ *
+ * returns:
+ *   true = target got there
+ *   false = interrupted
+ */
+bool run_to_nth(int addr, int n, reg_data* reg)
+{
+  char str[100];
+  int hits = 0;
+  bool ok = true;
+
+  sprintf(str, "b%04X\n", addr);
+  serialWrite(str);
+  serialRead(inbuf, BUFSIZE);
+
+  while (hits < n && ok)
+  {
+    if (reg->pc == addr)
+    {
+      // the breakpoint would re-trigger straight away, so step off it first
+      step_target(reg);
+      if (reg->pc == addr)
+        hits++;
+    }
+    else
+    {
+      resume_target(false);
+      ok = wait_for_stop(reg, 0) == STOP_HIT;
+      hits++;
+    }
+    if (ctrlcflag)
+      ok = false;
+  }
+
+  // restore the user's breakpoint
+  if (brkpt.active)
+    sprintf(str, "b%04X\n", brkpt.addr);
+  else
+    sprintf(str, "b\n");
+  serialWrite(str);
+  serialRead(inbuf, BUFSIZE);
+
+  return ok;
+}
+
+bool is_return_opcode(int op)
+{
+  return (opcode_desc[op].flags & OPF_RETURN) != 0;
+}
+
+/**
+ * runs the target for a number of instructions, or until it returns.
+ * The instructions are first predicted on the host (see emu.c), so that the
+ * target can get there in one go via a temporary breakpoint, after which the
+ * registers get compared against the prediction. Whatever can't be predicted
+ * (I/O accesses, etc.) gets stepped on the real target.
+ *
+ * steps = number of instructions to run (if > 0)
+ * ret_pc = else, run until pc = ret_pc with sp = ret_sp
+ * ret_sp = else (ret_pc = -1), run until an RTS/RTI executes with sp = ret_sp
+ */
+void predicted_run(reg_data* reg, int steps, int ret_pc, int ret_sp)
+{
+  bool done = false;
+  bool told = false;
+
+  prepare_emu();
+  strcpy(stopinfo, inbuf);
+
+  while (!done && !ctrlcflag)
+  {
+    type_cpu_state cpu = { reg->pc, reg->a, reg->x, reg->y, reg->z, reg->b, reg->sp, reg->p };
+    bool returning = false;
+    int n = 0;
+
+    emu_invalidate();
+    memset(predict_visits, 0, sizeof(predict_visits));
+
+    // predict as far as possible
+    if (reg->p != -1)
+    {
+      while (n < PREDICT_MAX_INSTR)
+      {
+        type_cpu_state before = cpu;
+        returning = steps == 0 && ret_pc == -1 && cpu.sp == ret_sp && is_return_opcode(emu_peek(cpu.pc));
+        if (!emu_step(&cpu))
+          break;
+        n++;
+        if (journal_enabled)
+          journal_push(&before, emu_writes, emu_nwrites, emu_writes_known);
+        predict_visits[cpu.pc]++;
+
+        if ((steps > 0 && n == steps) ||
+            (ret_pc != -1 && cpu.pc == ret_pc && cpu.sp == ret_sp) ||
+            returning)
+        {
+          done = true;
+          break;
+        }
+      }
+    }
+
+    // nothing predictable here? then step it on the real target
+    if (n == 0)
+    {
+      returning = steps == 0 && ret_pc == -1 && reg->sp == ret_sp && is_return_opcode(get_mem(reg->pc).b[0]);
+      journal_instruction(reg);
+      step_target(reg);
+      if ((steps > 0 && --steps == 0) ||
+          (ret_pc != -1 && reg->pc == ret_pc && reg->sp == ret_sp) ||
+          returning)
+        done = true;
+      continue;
+    }
+
+    // running to an address that gets visited very often costs more than stepping
+    int visits = predict_visits[cpu.pc];
+    bool ok = true;
+    journal_covered = true;
+    if (visits * 2 >= n)
+    {
+      for (int k = 0; k < n && !ctrlcflag; k++)
+        step_target(reg);
+    }
+    else
+      ok = run_to_nth(cpu.pc, visits, reg);
+    journal_covered = false;
+
+    if (!ok)
+    {
+      printf("- Interrupted\n");
+      journal_clear();
+      return;
+    }
+
+    if (steps > 0)
+      steps -= n;
+
+    if (reg->pc != cpu.pc || reg->a != cpu.a || reg->x != cpu.x || reg->y != cpu.y ||
+        reg->z != cpu.z || reg->b != cpu.b || reg->sp != cpu.sp ||
+        (reg->p != -1 && (reg->p & ~F_B) != (cpu.p & ~F_B)))
+    {
+      printf("- Target diverged from the prediction (interrupt?), stopped early\n");
+      journal_clear();
+      return;
+    }
+
+    if (!done && outputFlag && !told)
+    {
+      printf("- Stepping on the target at $%04X: %s\n", reg->pc, emu_diverge_reason);
+      told = true;
+    }
+  }
+}
+
+void cmdJournal(void)
+{
+  char* token = strtok(NULL, " ");
+
+  if (token == NULL)
+  {
+    if (!journal_enabled)
+      printf("- The journal is off\n");
+    else
+      printf("- The journal holds %d instructions (%d of %d bytes)\n",
+        journal_count(), journal_bytes(), journal_capacity());
+  }
+  else if (strcmp(token, "on") == 0)
+  {
+    int kb = JOURNAL_DEFAULT_KB;
+    token = strtok(NULL, " ");
+    if (token != NULL)
+      kb = atoi(token);
+    if (kb <= 0)
+    {
+      printf("- Invalid size\n");
+      return;
+    }
+
+    journal_start(kb * 1024);
+    printf("- Journalling stepped instructions (up to %dKB)\n", kb);
+  }
+  else if (strcmp(token, "off") == 0)
+    journal_stop();
+  else if (strcmp(token, "clear") == 0)
+    journal_clear();
+  else
+    printf("- Unknown option '%s'\n", token);
+}
+
+// sends a batch of monitor commands in one go, then collects their replies
+void send_batch(char* batch, int lines)
+{
+  if (lines == 0)
+    return;
+
+  serialWrite(batch);
+
+  // count the '.' prompts, as serialRead() would drop any replies after the first
+  int prompts = 0;
+  char last = '\0';
+  while (prompts < lines)
+  {
+    int n = serialReadChunk(inbuf, BUFSIZE - 1, 1000);
+    if (n <= 0)
+      break;
+    for (int k = 0; k < n; k++)
+    {
+      if (inbuf[k] == '.' && last == '\n')
+        prompts++;
+      last = inbuf[k];
+    }
+  }
+
+  batch[0] = '\0';
+}
+
+// undoes the newest 'count' journaled instructions (with 'over', a subroutine that
+// got returned from counts as a single instruction: its call)
+void reverse_step(int count, bool over)
+{
+  static int restore[0x10000];
+  static char batch[BUFSIZE];
+  type_journal_entry e, last;
+  int popped = 0;
+  int sp = -1;          // the stack pointer after the instruction being undone
+  int caller_sp = -1;   // (while undoing a subroutine: the stack pointer of the call)
+  bool blocked = false;
+
+  traceframe = 0;
+
+  if (!journal_enabled)
+  {
+    printf("- The journal is off (see 'journal on')\n");
+    return;
+  }
+
+  if (over)
+  {
+    reg_data reg = get_regs();
+    sp = reg.sp;
+    prepare_emu();
+    emu_invalidate();
+  }
+
+  // undo the newest instructions first, so that the oldest value of each byte wins
+  memset(restore, -1, sizeof(restore));
+  while ((popped < count || caller_sp != -1) && journal_pop(&e))
+  {
+    if (!e.undoable)
+    {
+      blocked = true;
+      break;
+    }
+
+    for (int k = 0; k < e.nwrites; k++)
+      restore[e.writes[k].addr] = e.writes[k].old;
+    last = e;
+
+    if (over && caller_sp == -1 && is_return_opcode(emu_peek(e.regs.pc)))
+      caller_sp = sp;
+    else if (caller_sp != -1 && e.regs.sp >= caller_sp)
+      caller_sp = -1;
+    if (caller_sp == -1)
+      popped++;
+    sp = e.regs.sp;
+  }
+
+  // (the instructions before one that can't be undone can't be either)
+  if (blocked)
+  {
+    printf("- Can't step back past $%04X: it may have written memory that isn't known (e.g., I/O), so the journal got cleared\n", e.regs.pc);
+    journal_clear();
+  }
+
+  if (popped == 0 && caller_sp == -1)
+  {
+    if (!blocked)
+      printf("- Nothing (more) in the journal to undo\n");
+    return;
+  }
+  e = last;
+
+  // write the old values back (one 'S' per run of consecutive bytes, as the
+  // journal's addresses are in the cpu's context), and move the pc back
+  int lines = 0;
+  batch[0] = '\0';
+  for (int addr = 0; addr < 0x10000; addr++)
+  {
+    if (restore[addr] == -1)
+      continue;
+
+    if (strlen(batch) > BUFSIZE - 128)
+    {
+      send_batch(batch, lines);
+      lines = 0;
+    }
+
+    char* line = batch + strlen(batch);
+    line += sprintf(line, "S%04X", addr);
+    for (int k = 0; k < 16 && addr < 0x10000 && restore[addr] != -1; k++, addr++)
+      line += sprintf(line, " %02X", restore[addr]);
+    strcpy(line, "\n");
+    addr--;
+    lines++;
+  }
+  sprintf(batch + strlen(batch), "g%04X\n", e.regs.pc);
+  send_batch(batch, lines + 1);
+
+  emu_invalidate();
+  peek_cache_valid = false;
+
+  // the monitor has no way to set the other registers, so just point out any differences
+  reg_data reg = get_regs();
+  strcpy(stopinfo, inbuf);
+  int now[] = { reg.a, reg.x, reg.y, reg.z, reg.b, reg.sp, reg.p };
+  int was[] = { e.regs.a, e.regs.x, e.regs.y, e.regs.z, e.regs.b, e.regs.sp, e.regs.p };
+  char* names[] = { "A", "X", "Y", "Z", "B", "SP", "P" };
+  for (int k = 0; k < 7; k++)
+  {
+    if (now[k] != -1 && now[k] != was[k])
+      printf("- Could not restore %s: it was $%0*X (now $%0*X)\n", names[k], k == 5 ? 4 : 2, was[k], k == 5 ? 4 : 2, now[k]);
+  }
+
+  if (outputFlag)
+  {
+    if (autocls)
+      cmdClearScreen();
+    printf("%s", stopinfo);
+    cmdDisassemble();
+  }
+}
+
+void cmdReverseStep(void)
+{
+  char* token = strtok(NULL, " ");
+
+  reverse_step(token != NULL ? get_sym_value(token) : 1, false);
+}
+
+void cmdReverseNext(void)
+{
+  char* token = strtok(NULL, " ");
+
+  reverse_step(token != NULL ? get_sym_value(token) : 1, true);
+}
+
+void cmd_watch(type_watch type)
+{
+  char* token = strtok(NULL, " ");
+  
+  if (token != NULL)
+  {
+	  if (find_in_watchlist(token))
+		{
+		  printf("watch already exists!\n");
+			return;
+		}
+
+	  type_watch_entry we;
+		we.type = type;
+		we.name = token;
+		add_to_watchlist(we);
+
+		printf("watch added!\n");
+	}
+}
+
+void cmdWatchByte(void)
+{
+  cmd_watch(TYPE_BYTE);
+}
+
+void cmdWatchWord(void)
+{
+  cmd_watch(TYPE_WORD);
+}
+
+void cmdWatchDWord(void)
+{
+  cmd_watch(TYPE_DWORD);
+}
+
+void cmdWatchString(void)
+{
+  cmd_watch(TYPE_STRING);
+}
+
+void cmdWatches(void)
+{
+  type_watch_entry* iter = lstWatches;
+	int cnt = 0;
+
+  printf("---------------------------------------\n");
+	
+	while (iter != NULL)
+	{
+	  cnt++;
+
+		printf("#%d: %s ", cnt, type_names[iter->type]);
+
+		switch (iter->type)
+		{
+		  case TYPE_BYTE:   print_byte(iter->name);   break;
+		  case TYPE_WORD:   print_word(iter->name);   break;
+		  case TYPE_DWORD:  print_dword(iter->name);  break;
+		  case TYPE_STRING: print_string(iter->name); break;
+		}
+
+		iter = iter->next;
+	}
+
+	if (cnt == 0)
+	  printf("no watches in list\n");
+  printf("---------------------------------------\n");
+}
+
+void cmdDeleteWatch(void)
+{
+  char* token = strtok(NULL, " ");
+  
+  if (token != NULL)
+  {
+	  // user wants to delete all watches?
+	  if (strcmp(token, "all") == 0)
+		{
+		  // TODO: add a confirm yes/no prompt...
+			outputFlag = false;
+			while (delete_from_watchlist(1))
+			  ;
+			outputFlag = true;
+			printf("deleted all watches!\n");
+		}
+		else
+		{
+		  int wnum;
+		  int n = sscanf(token, "%d", &wnum);
+
+			if (n == 1)
+			{
+			  delete_from_watchlist(wnum);
+			}
+		}
+	}
+}
+
+
+void cmdContext(void)
+{
+  char* token = strtok(NULL, " ");
+  int lines;
+
+  if (token != NULL)
+  {
+    if (sscanf(token, "%d", &lines) != 1 || lines < 0)
+    {
+      printf("Invalid <lines> parameter!\n");
+      return;
+    }
+    srcContext = lines;
+  }
+
+  printf(" - showing %d source line(s) either side of the current one.\n", srcContext);
+}
+
+void cmdAutoWatch(void)
+{
+  char* token = strtok(NULL, " ");
+
+  // if no parameter, then just toggle it
+	if (token == NULL)
+		autowatch = !autowatch;
+	else if (strcmp(token, "1") == 0)
+		autowatch = true;
+	else if (strcmp(token, "0") == 0)
+		autowatch = false;
+	
+	printf(" - autowatch is turned %s.\n", autowatch ? "on" : "off");
+}
+
+void cmdSymbolValue(void)
+{
+  char* token = strtok(NULL, " ");
+  
+  if (token != NULL)
+  {
+    type_symmap_entry* sme = find_in_symmap(token);
+
+		if (sme != NULL)
+		  printf("%s : %s\n", sme->sval, sme->symbol);
+	}
+}
+
+void cmdSave(void)
+{
+  char* strBinFile = strtok(NULL, " ");
+
+  if (!strBinFile)
+  {
+    printf("Missing <binfile> parameter!\n");
+    return;
+  }
+
+	char* strAddr = strtok(NULL, " ");
+	if (!strAddr)
+	{
+	  printf("Missing <addr> parameter!\n");
+		return;
+	}
+
+  char* strCount = strtok(NULL, " ");
+  if (!strCount)
+  {
+    printf("Missing <count> parameter!\n");
+    return;
+  }
+
+	int addr = get_sym_value(strAddr);
+  int count;
+  sscanf(strCount, "%X", &count);
 
   int cnt = 0;
   FILE* fsave = fopen(strBinFile, "wb");
@@ -1333,83 +3436,578 @@ void cmdSave(void)
           break;
       }
 
-      printf("0x%X bytes saved...\r", cnt);
-      if (cnt >= count)
-        break;
+      printf("0x%X bytes saved...\r", cnt);
+      if (cnt >= count)
+        break;
+    }
+
+		if (ctrlcflag)
+			break;
+	}
+
+  printf("\n0x%X bytes saved to \"%s\"\n", cnt, strBinFile);
+  fclose(fsave);
+}
+
+void cmdLoad(void)
+{
+	char* strBinFile = strtok(NULL, " ");
+
+	if (!strBinFile)
+	{
+		printf("Missing <binfile> parameter!\n");
+		return;
+	}
+
+	char* strAddr = strtok(NULL, " ");
+	if (!strAddr)
+	{
+		printf("Missing <addr> parameter!\n");
+		return;
+	}
+
+	int addr = get_sym_value(strAddr);
+
+  	FILE* fload = fopen(strBinFile, "rb");
+	if(fload)
+	{
+		fseek(fload, 0, SEEK_END);
+		int fsize = ftell(fload);	
+		rewind(fload);      		
+		char* buffer = (char *)malloc(fsize*sizeof(char));
+		if(buffer) 
+		{
+			fread(buffer, fsize, 1, fload);
+		
+			int i = 0;
+			while(i < fsize)
+			{
+				int outSize = fsize - i;
+				if(outSize > 16) {
+					outSize = 16;
+				}
+
+				put_mem28array(addr + i, (unsigned char*) (buffer + i), outSize);
+				i += outSize;
+			}	
+
+			free(buffer);
+		}
+  		fclose(fload);
+	}
+	else 
+	{
+		printf("Error opening the file '%s'!\n", strBinFile);
+	}
+}
+
+// -- static disassembly of whole images ('disfile') --
+
+#define DF_CODE_START 0x01    // an instruction starts here
+#define DF_CODE       0x02    // part of an instruction
+#define DF_REF        0x04    // referenced by code (gets a label when it starts a line)
+#define DF_LINE       0x08    // an output line starts here
+#define DF_BYTES_PER_LINE 8   // data bytes per '.byte' line
+#define DF_CHUNK 0x4000       // image bytes formatted per work item
+
+typedef struct
+{
+  int start;      // image offsets of the chunk (start is a line start)
+  int end;
+  char* text;     // the formatted source
+  int used;
+  int size;
+} type_df_chunk;
+
+unsigned char* df_mem = NULL;    // the image (padded by DIS_MAX_LEN)
+unsigned char* df_flags = NULL;  // DF_* per byte
+int df_base;
+int df_len;
+type_df_chunk* df_chunks = NULL;
+int df_chunk_count;
+int df_next_chunk;               // next chunk for a worker to take
+pthread_mutex_t df_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// the map symbol (if any) for an image offset (symbols are cpu addresses, so only the first bank gets them)
+type_symmap_entry* df_map_symbol(int off)
+{
+  int addr = df_base + off;
+
+  if ((addr >> 16) != (df_base >> 16))
+    return NULL;
+
+  type_symmap_entry* sme = find_symmap_floor(addr & 0xffff);
+  return (sme != NULL && sme->addr == (addr & 0xffff)) ? sme : NULL;
+}
+
+void df_label(char* str, int size, int off)
+{
+  type_symmap_entry* sme = df_map_symbol(off);
+
+  if (sme != NULL)
+    snprintf(str, size, "%s", sme->symbol);
+  else if ((df_base >> 16) == ((df_base + df_len - 1) >> 16))
+    snprintf(str, size, "L_%04X", (df_base + off) & 0xffff);
+  else
+    snprintf(str, size, "L_%07X", df_base + off);
+}
+
+// the offset of the instruction each formatting thread is working on
+__thread int df_current;
+
+/**
+ * (see dis_symbol_func) names addresses within the image by the label of
+ * their line. Zero-page operands only get a label that's already defined
+ * by the time it's used (and absolute ones below $100 never get one), or
+ * the assembler would pick a different addressing mode than the image's.
+ */
+bool df_symbol(int addr, bool exact, char* str, int size)
+{
+  int off = addr - df_base;
+
+  if (off < 0 || off >= df_len)
+    return false;
+
+  int line = off;
+  while (!(df_flags[line] & DF_LINE))
+    line--;
+  if (!(df_flags[line] & DF_REF))
+    return false;
+  if (exact && line != off)
+    return false;
+  if ((addr & 0xffff) < 0x100 && (!exact || line > df_current))
+    return false;
+
+  df_label(str, size, line);
+  if (line != off)
+    snprintf(str + strlen(str), size - strlen(str), "+%d", off - line);
+  return true;
+}
+
+void df_push(int** work, int* count, int* size, int off)
+{
+  if (*count == *size)
+  {
+    *size = *size ? *size * 2 : 256;
+    *work = realloc(*work, *size * sizeof(int));
+  }
+  (*work)[(*count)++] = off;
+}
+
+// follows the code from each offset in the worklist, marking instructions and the addresses they refer to
+void df_trace(int* work, int count, int size)
+{
+  while (count > 0 && !ctrlcflag)
+  {
+    int off = work[--count];
+
+    while (off >= 0 && off < df_len && !(df_flags[off] & (DF_CODE_START | DF_CODE)))
+    {
+      int addr = df_base + off;
+      unsigned char* b = &df_mem[off];
+      const type_opcode_desc* d = decode_opcode(b);
+
+      // instructions can't overlap others, run off the image or wrap around the bank
+      bool fits = off + d->len <= df_len && (addr & 0xffff) + d->len <= 0x10000;
+      for (int k = 1; fits && k < d->len; k++)
+        if (df_flags[off + k] & (DF_CODE_START | DF_CODE))
+          fits = false;
+      if (!fits)
+        break;
+
+      df_flags[off] |= DF_CODE_START;
+      for (int k = 1; k < d->len; k++)
+        df_flags[off + k] |= DF_CODE;
+
+      int target = operand_address(addr, b);
+      if (target != -1)
+      {
+        target = (addr & ~0xffff) + target - df_base;
+        if (target >= 0 && target < df_len)
+        {
+          df_flags[target] |= DF_REF;
+
+          // direct jumps/calls and branches lead to more code (indirect ones only to their pointers)
+          bool direct = d->mode == M_nnnn || (d->flags & OPF_BRANCH);
+          if (direct && (d->flags & (OPF_BRANCH | OPF_JUMP | OPF_CALL)))
+            df_push(&work, &count, &size, target);
+        }
+      }
+
+      if ((d->flags & (OPF_JUMP | OPF_RETURN)) || b[d->prefix] == 0x00 || strcmp(d->name, "BRA") == 0)
+        break;
+      off += d->len;
+    }
+  }
+
+  free(work);
+}
+
+// decides where output lines start, and moves the labels of references into instructions to their line
+void df_plan_lines(void)
+{
+  int run = 0;  // data bytes on the current line
+
+  for (int off = 0; off < df_len; off++)
+  {
+    if (df_flags[off] & DF_CODE_START)
+    {
+      df_flags[off] |= DF_LINE;
+      run = 0;
+    }
+    else if (!(df_flags[off] & DF_CODE))
+    {
+      if (run == 0 || run == DF_BYTES_PER_LINE || (df_flags[off] & DF_REF) ||
+          ((df_base + off) & 0xffff) == 0)
+      {
+        df_flags[off] |= DF_LINE;
+        run = 0;
+      }
+      run++;
+    }
+    else
+      run = 0;
+  }
+
+  for (int off = 0; off < df_len; off++)
+  {
+    if (!(df_flags[off] & DF_REF) || (df_flags[off] & DF_LINE))
+      continue;
+    int line = off;
+    while (!(df_flags[line] & DF_LINE))
+      line--;
+    df_flags[line] |= DF_REF;
+  }
+}
+
+void df_printf(type_df_chunk* c, const char* fmt, ...)
+{
+  va_list args;
+
+  for (;;)
+  {
+    va_start(args, fmt);
+    int n = vsnprintf(c->text + c->used, c->size - c->used, fmt, args);
+    va_end(args);
+
+    if (n < c->size - c->used)
+    {
+      c->used += n;
+      return;
+    }
+    c->size = c->size * 2 + n;
+    c->text = realloc(c->text, c->size);
+  }
+}
+
+void df_format_chunk(type_df_chunk* c)
+{
+  char str[DIS_LINE_SIZE];
+  char label[DIS_SYM_SIZE];
+
+  c->size = (c->end - c->start) * 24 + 256;
+  c->text = malloc(c->size);
+  c->used = 0;
+
+  for (int off = c->start; off < c->end; )
+  {
+    int addr = df_base + off;
+
+    if (off == 0 || (addr & 0xffff) == 0)
+      df_printf(c, "\n* = $%04X\t\t\t\t; $%07X\n\n", addr & 0xffff, addr);
+
+    if ((df_flags[off] & DF_REF) || df_map_symbol(off) != NULL)
+    {
+      df_label(label, sizeof(label), off);
+      df_printf(c, "%s:\n", label);
+    }
+
+    if (df_flags[off] & DF_CODE_START)
+    {
+      df_current = off;
+      int len = disassemble_source(str, sizeof(str), addr, &df_mem[off], df_symbol);
+      df_printf(c, "        %-32s; $%04X\n", str, addr & 0xffff);
+      off += len;
+    }
+    else
+    {
+      df_printf(c, "        .byte $%02X", df_mem[off]);
+      for (off++; off < df_len && !(df_flags[off] & DF_LINE); off++)
+        df_printf(c, ",$%02X", df_mem[off]);
+      df_printf(c, "\n");
+    }
+  }
+}
+
+void* df_worker(void* arg)
+{
+  for (;;)
+  {
+    pthread_mutex_lock(&df_lock);
+    int k = df_next_chunk++;
+    pthread_mutex_unlock(&df_lock);
+
+    if (k >= df_chunk_count)
+      return NULL;
+    df_format_chunk(&df_chunks[k]);
+  }
+}
+
+// formats the image in chunks, on as many threads as there are cores
+void df_format(void)
+{
+  df_chunks = malloc((df_len / DF_CHUNK + 1) * sizeof(type_df_chunk));
+  df_chunk_count = 0;
+  for (int off = 0; off < df_len; )
+  {
+    int end = off + DF_CHUNK;
+    while (end < df_len && !(df_flags[end] & DF_LINE))
+      end++;
+    if (end > df_len)
+      end = df_len;
+
+    df_chunks[df_chunk_count].start = off;
+    df_chunks[df_chunk_count].end = end;
+    df_chunk_count++;
+    off = end;
+  }
+
+  int threads = sysconf(_SC_NPROCESSORS_ONLN);
+  if (threads > df_chunk_count)
+    threads = df_chunk_count;
+  if (threads < 1)
+    threads = 1;
+
+  pthread_t* tids = malloc(threads * sizeof(pthread_t));
+  df_next_chunk = 0;
+  for (int k = 0; k < threads; k++)
+    pthread_create(&tids[k], NULL, df_worker, NULL);
+  for (int k = 0; k < threads; k++)
+    pthread_join(tids[k], NULL);
+  free(tids);
+}
+
+// pulls a region of memory into the host, separates its code from its data by
+// following the code from its entry points, and writes it out as assembler source
+void cmdDisfile(void)
+{
+  char* strAddr = strtok(NULL, " ");
+  char* strLen = strtok(NULL, " ");
+  char* strFile = strtok(NULL, " ");
+
+  if (strAddr == NULL || strLen == NULL || strFile == NULL)
+  {
+    printf("Syntax: disfile <addr28> <len> <out.s>\n");
+    return;
+  }
+
+  df_base = get_sym_value(strAddr);
+  sscanf(strLen, "%X", &df_len);
+  if (df_len <= 0 || df_base + df_len > 0x10000000)
+  {
+    printf("Invalid region!\n");
+    return;
+  }
+
+  FILE* f = fopen(strFile, "w");
+  if (f == NULL)
+  {
+    printf("Error opening the file '%s'!\n", strFile);
+    return;
+  }
+
+  df_mem = calloc(df_len + DIS_MAX_LEN, 1);
+  df_flags = calloc(df_len, 1);
+
+  if (read_mem28_block(df_base, df_len, df_mem))
+  {
+    int* work = NULL;
+    int count = 0, size = 0;
+
+    // entry points: the vectors at the top of each bank...
+    for (int bank = df_base & ~0xffff; bank < df_base + df_len; bank += 0x10000)
+      for (int vec = 0xfffa; vec < 0x10000; vec += 2)
+      {
+        int off = bank + vec - df_base;
+        if (off < 0 || off + 1 >= df_len)
+          continue;
+        int target = bank + (df_mem[off] | (df_mem[off + 1] << 8)) - df_base;
+        if (target >= 0 && target < df_len)
+        {
+          df_flags[target] |= DF_REF;
+          df_push(&work, &count, &size, target);
+        }
+      }
+
+    // ...and the symbols (or else, the start of the region)
+    for (int k = 0; k < symIndexCount; k++)
+    {
+      int off = (df_base & ~0xffff) + symIndex[k]->addr - df_base;
+      if (off >= 0 && off < df_len)
+        df_push(&work, &count, &size, off);
+    }
+    if (count == 0)
+      df_push(&work, &count, &size, 0);
+
+    df_trace(work, count, size);
+    df_plan_lines();
+    df_format();
+
+    int code = 0;
+    for (int off = 0; off < df_len; off++)
+      if (df_flags[off] & (DF_CODE_START | DF_CODE))
+        code++;
+
+    fprintf(f, "; disassembly of $%07X-$%07X ($%X bytes of code, $%X bytes of data)\n",
+      df_base, df_base + df_len - 1, code, df_len - code);
+    for (int k = 0; k < df_chunk_count; k++)
+    {
+      fwrite(df_chunks[k].text, 1, df_chunks[k].used, f);
+      free(df_chunks[k].text);
+    }
+    free(df_chunks);
+
+    printf("Disassembled $%X bytes ($%X bytes of code) to \"%s\"\n", df_len, code, strFile);
+  }
+  else
+    printf("\nAborted\n");
+
+  fclose(f);
+  free(df_mem);
+  free(df_flags);
+}
+
+// rebuilds the cross-reference index from an image, and keeps it next to the .list file
+void xref_rebuild(unsigned char* image, int addr, int len)
+{
+  xref_build(image, addr, len);
+  printf("Indexed %d references in $%X bytes from $%07X\n", xref_count(), len, addr);
+
+  if (xrefFile != NULL && !xref_save(xrefFile))
+    printf("Error writing the index to '%s'!\n", xrefFile);
+}
+
+void cmdXref(void)
+{
+  char* token = strtok(NULL, " ");
+
+  if (token == NULL)
+  {
+    printf("Syntax: xref <addr> / build <addr28> <len> / file <binfile> <addr28>\n");
+    return;
+  }
+
+  if (strcmp(token, "build") == 0)
+  {
+    char* strAddr = strtok(NULL, " ");
+    char* strLen = strtok(NULL, " ");
+    int len = 0;
+
+    if (strAddr == NULL || strLen == NULL)
+    {
+      printf("Missing <addr28> <len> parameters!\n");
+      return;
+    }
+    int addr = get_sym_value(strAddr);
+    sscanf(strLen, "%X", &len);
+    if (len <= 0)
+    {
+      printf("Invalid length!\n");
+      return;
+    }
+
+    unsigned char* image = calloc(len + DIS_MAX_LEN, 1);
+    if (read_mem28_block(addr, len, image))
+      xref_rebuild(image, addr, len);
+    else
+      printf("\nAborted\n");
+    free(image);
+  }
+  else if (strcmp(token, "file") == 0)
+  {
+    char* strBinFile = strtok(NULL, " ");
+    char* strAddr = strtok(NULL, " ");
+
+    if (strBinFile == NULL || strAddr == NULL)
+    {
+      printf("Missing <binfile> <addr28> parameters!\n");
+      return;
+    }
+
+    FILE* f = fopen(strBinFile, "rb");
+    if (f == NULL)
+    {
+      printf("Error opening the file '%s'!\n", strBinFile);
+      return;
+    }
+    fseek(f, 0, SEEK_END);
+    int len = ftell(f);
+    rewind(f);
+    unsigned char* image = calloc(len + DIS_MAX_LEN, 1);
+    len = fread(image, 1, len, f);
+    fclose(f);
+
+    if (len > 0)
+      xref_rebuild(image, get_sym_value(strAddr), len);
+    free(image);
+  }
+  else
+  {
+    if (xref_count() == 0)
+    {
+      printf("No cross-references yet (see 'xref build' and 'xref file')\n");
+      return;
     }
 
-		if (ctrlcflag)
-			break;
-	}
+    int addr = get_sym_value(token);
+    type_xref* refs;
+    int n = xref_find(addr, &refs);
 
-  printf("\n0x%X bytes saved to \"%s\"\n", cnt, strBinFile);
-  fclose(fsave);
+    printf("%d reference%s to $%04X %s\n", n, n == 1 ? "" : "s", addr, addr_header(addr));
+    for (int k = 0; k < n; k++)
+    {
+      int from = XREF_FROM(&refs[k]);
+      printf("  %-6s from $%04X %s\n", xref_kind_names[XREF_KIND(&refs[k])], from, addr_header(from));
+    }
+  }
 }
 
-void cmdLoad(void)
+void cmdReload(void)
 {
-	char* strBinFile = strtok(NULL, " ");
-
-	if (!strBinFile)
-	{
-		printf("Missing <binfile> parameter!\n");
-		return;
-	}
-
-	char* strAddr = strtok(NULL, " ");
-	if (!strAddr)
-	{
-		printf("Missing <addr> parameter!\n");
-		return;
-	}
+  unload_list();
+  listSearch();
+  printf("Loaded %d source lines and %d symbols\n", lstFileLocCount, symIndexCount);
 
-	int addr = get_sym_value(strAddr);
+  // (the same as when rebuilt files get picked up by themselves)
+  resolve_breakpoints();
+}
 
-  	FILE* fload = fopen(strBinFile, "rb");
-	if(fload)
-	{
-		fseek(fload, 0, SEEK_END);
-		int fsize = ftell(fload);	
-		rewind(fload);      		
-		char* buffer = (char *)malloc(fsize*sizeof(char));
-		if(buffer) 
-		{
-			fread(buffer, fsize, 1, fload);
-		
-			int i = 0;
-			while(i < fsize)
-			{
-				int outSize = fsize - i;
-				if(outSize > 16) {
-					outSize = 16;
-				}
+// the "<symbol+$offset> " that heads a line about 'addr' (or "" if there's no symbol)
+char* addr_header(int addr)
+{
+  static char str[DIS_SYM_SIZE + 4];
+  char sym[DIS_SYM_SIZE];
 
-				put_mem28array(addr + i, (unsigned char*) (buffer + i), outSize);
-				i += outSize;
-			}	
+  if (addr_to_symbol(addr, false, sym, DIS_SYM_SIZE))
+    sprintf(str, "<%s> ", sym);
+  else
+    str[0] = '\0';
 
-			free(buffer);
-		}
-  		fclose(fload);
-	}
-	else 
-	{
-		printf("Error opening the file '%s'!\n", strBinFile);
-	}
+  return str;
 }
 
 void cmdBackTrace(void)
 {
-  char str[128] = { 0 };
+  char str[DIS_LINE_SIZE] = { 0 };
 
 	// get current register values
 	reg_data reg = get_regs();
 
 	disassemble_addr_into_string(str, reg.pc);
 	if (traceframe == 0)
-		printf(KINV "#0: %s\n" KNRM, str);
+		printf(KINV "#0: %s%s\n" KNRM, addr_header(reg.pc), str);
 	else
-		printf("#0: %s\n", str);
+		printf("#0: %s%s\n", addr_header(reg.pc), str);
 
 	// get memory at current pc
 	int* addresses = get_backtrace_addresses();
@@ -1418,9 +4016,9 @@ void cmdBackTrace(void)
 	{
 	  disassemble_addr_into_string(str, addresses[k]);
 		if (traceframe-1 == k)
-		  printf(KINV "#%d: %s\n" KNRM, k+1, str);
+		  printf(KINV "#%d: %s%s\n" KNRM, k+1, addr_header(addresses[k]), str);
 		else
-			printf("#%d: %s\n", k+1, str);
+			printf("#%d: %s%s\n", k+1, addr_header(addresses[k]), str);
 	}
 }
 
@@ -1453,3 +4051,516 @@ void cmdDownFrame(void)
 		cmdClearScreen();
 	cmdDisassemble();
 }
+
+// sampling profiler
+// =================
+
+typedef struct
+{
+  char* name;
+  int count;
+} type_profile_entry;
+
+typedef struct
+{
+  type_profile_entry* entries;
+  int n;
+  int* hash;      // open-addressed indexes into 'entries' (-1 = free), a power of two in size
+  int hashsize;
+} type_profile;
+
+// adds to the count of a name (a symbol, source line or call stack), found through the hash
+void add_profile_count(type_profile* p, char* name, int count)
+{
+  if ((p->n + 1) * 2 > p->hashsize)
+  {
+    free(p->hash);
+    p->hashsize = p->hashsize ? p->hashsize * 2 : 256;
+    p->hash = malloc(p->hashsize * sizeof(int));
+    memset(p->hash, -1, p->hashsize * sizeof(int));
+    for (int k = 0; k < p->n; k++)
+    {
+      unsigned int h = hash_string(p->entries[k].name) & (p->hashsize - 1);
+      while (p->hash[h] != -1)
+        h = (h + 1) & (p->hashsize - 1);
+      p->hash[h] = k;
+    }
+  }
+
+  unsigned int h = hash_string(name) & (p->hashsize - 1);
+  for (; p->hash[h] != -1; h = (h + 1) & (p->hashsize - 1))
+  {
+    if (strcmp(p->entries[p->hash[h]].name, name) == 0)
+    {
+      p->entries[p->hash[h]].count += count;
+      return;
+    }
+  }
+
+  if ((p->n % 256) == 0)
+    p->entries = realloc(p->entries, (p->n + 256) * sizeof(type_profile_entry));
+
+  p->entries[p->n].name = strdup(name);
+  p->entries[p->n].count = count;
+  p->hash[h] = p->n++;
+}
+
+void free_profile(type_profile* p)
+{
+  for (int k = 0; k < p->n; k++)
+    free(p->entries[k].name);
+  free(p->entries);
+  free(p->hash);
+  memset(p, 0, sizeof(type_profile));
+}
+
+int cmp_profile_entry(const void* a, const void* b)
+{
+  return ((type_profile_entry*)b)->count - ((type_profile_entry*)a)->count;
+}
+
+// (sorts the entries, so the profile's hash is of no use afterwards)
+void print_profile(char* title, type_profile* p, int total, int max)
+{
+  type_profile_entry* arr = p->entries;
+
+  qsort(arr, p->n, sizeof(type_profile_entry), cmp_profile_entry);
+
+  printf("%s\n", title);
+  printf("  %%time  samples  location\n");
+  for (int k = 0; k < p->n && k < max; k++)
+    printf("  %5.1f  %7d  %s\n", 100.0 * arr[k].count / total, arr[k].count, arr[k].name);
+}
+
+// describes an address as 'symbol' (or '$XXXX' if no symbol is known)
+void profile_addr_name(char* str, int size, int addr)
+{
+  type_symmap_entry* sme = find_symmap_floor(addr);
+
+  if (sme != NULL)
+    snprintf(str, size, "%s", sme->symbol);
+  else
+    snprintf(str, size, "$%04X", addr);
+}
+
+void cmdProfile(void)
+{
+  char* token = strtok(NULL, " ");
+  if (token == NULL)
+  {
+    printf("Missing <seconds> parameter!\n");
+    return;
+  }
+
+  double seconds = atof(token);
+  char* strCollapsed = strtok(NULL, " ");
+  static int hist[0x10000];
+  type_profile stacks = { 0 };
+  int total = 0;
+  struct timeval start, now;
+
+  memset(hist, 0, sizeof(hist));
+
+  traceframe = 0;
+  resume_target(true);
+  printf("- Profiling for %.1f seconds (ctrl-c to stop early)...\n", seconds);
+
+  // sample as fast as the link allows: each 'r' waits for its reply, so the
+  // round trip time paces the sampling
+  gettimeofday(&start, NULL);
+  while (!ctrlcflag)
+  {
+    gettimeofday(&now, NULL);
+    if ((now.tv_sec - start.tv_sec) + (now.tv_usec - start.tv_usec) / 1e6 >= seconds)
+      break;
+
+    reg_data reg = get_regs();
+    hist[reg.pc & 0xffff]++;
+    total++;
+    if (coverage_enabled)
+      coverage_mark(reg.pc);
+
+    if (strCollapsed != NULL)
+    {
+      // rough call stack from the return addresses on the stack page
+      char stack[1024];
+      char name[256];
+      int depth = ((reg.sp | 0xff) - reg.sp) / 2;
+      if (depth > 8)
+        depth = 8;
+
+      mem_data mem = get_mem(reg.sp + 1);
+      int len = 0;
+      for (int k = depth - 1; k >= 0; k--)
+      {
+        profile_addr_name(name, sizeof(name), (mem.b[k*2] + (mem.b[k*2+1] << 8)) - 2);
+        len += snprintf(stack + len, sizeof(stack) - len, "%s;", name);
+        if (len >= (int)sizeof(stack))
+          len = sizeof(stack) - 1;
+      }
+      profile_addr_name(name, sizeof(name), reg.pc);
+      snprintf(stack + len, sizeof(stack) - len, "%s", name);
+      add_profile_count(&stacks, stack, 1);
+    }
+  }
+
+  halt_target();
+
+  gettimeofday(&now, NULL);
+  double elapsed = (now.tv_sec - start.tv_sec) + (now.tv_usec - start.tv_usec) / 1e6;
+  printf("- %d samples in %.2f seconds (%.0f samples/sec), target halted\n",
+    total, elapsed, total / elapsed);
+  if (total == 0)
+    return;
+
+  // aggregate the per-address histogram by symbol and by source line
+  type_profile syms = { 0 };
+  type_profile lines = { 0 };
+
+  for (int addr = 0; addr < 0x10000; addr++)
+  {
+    if (hist[addr] == 0)
+      continue;
+
+    char name[256];
+    profile_addr_name(name, sizeof(name), addr);
+    add_profile_count(&syms, name, hist[addr]);
+
+    type_fileloc* fl = find_fileloc_floor(addr);
+    if (fl != NULL)
+      snprintf(name, sizeof(name), "%s:%d", fl->file, fl->lineno);
+    else
+      sprintf(name, "$%04X", addr);
+    add_profile_count(&lines, name, hist[addr]);
+  }
+
+  print_profile("Flat profile (by symbol):", &syms, total, syms.n);
+  print_profile("Flat profile (by source line, top 20):", &lines, total, 20);
+
+  if (strCollapsed != NULL)
+  {
+    FILE* f = fopen(strCollapsed, "wt");
+    if (f == NULL)
+      printf("Error opening the file '%s'!\n", strCollapsed);
+    else
+    {
+      for (int k = 0; k < stacks.n; k++)
+        fprintf(f, "%s %d\n", stacks.entries[k].name, stacks.entries[k].count);
+      fclose(f);
+      printf("- Collapsed stacks written to \"%s\"\n", strCollapsed);
+    }
+  }
+
+  free_profile(&syms);
+  free_profile(&lines);
+  free_profile(&stacks);
+}
+
+// execution-trace recording ('trace record/show/find')
+// ===================================================
+
+// parses a register line of the 'tc' output, returns false for anything else
+bool parse_trace_line(char* line, type_trace_state* st)
+{
+  int mapl, maph;
+
+  return sscanf(line, "%04X %02X %02X %02X %02X %02X %04X %04X %04X %02X",
+    &st->pc, &st->a, &st->x, &st->y, &st->z, &st->b, &st->sp, &mapl, &maph, &st->opcode) == 10;
+}
+
+void trace_record(char* fname, unsigned int limit)
+{
+  static char chunk[BUFSIZE];
+  char line[256];
+  int linelen = 0;
+  type_trace_writer w;
+  type_trace_state st;
+  struct timeval start, now;
+  int last_report = 0;
+
+  if (!trace_open_write(&w, fname))
+  {
+    printf("Error opening the file '%s'!\n", fname);
+    return;
+  }
+
+  printf("- Recording trace to \"%s\" (ctrl-c to stop)...\n", fname);
+  gettimeofday(&start, NULL);
+  journal_clear();
+  serialWrite("tc\n");
+
+  // parse the stream incrementally, as it arrives
+  while (!ctrlcflag && (limit == 0 || w.count < limit))
+  {
+    int n = serialReadChunk(chunk, BUFSIZE, 100);
+
+    for (int k = 0; k < n; k++)
+    {
+      char c = chunk[k];
+      if (c == '\n' || c == '\r')
+      {
+        line[linelen] = '\0';
+        if (linelen != 0 && parse_trace_line(line, &st))
+        {
+          trace_write(&w, &st);
+          if (coverage_enabled)
+            coverage_mark(st.pc);
+        }
+        linelen = 0;
+      }
+      else if (linelen < (int)sizeof(line) - 1)
+        line[linelen++] = c;
+    }
+
+    gettimeofday(&now, NULL);
+    if (now.tv_sec != last_report)
+    {
+      printf("%u instructions...\r", w.count);
+      fflush(stdout);
+      last_report = now.tv_sec;
+    }
+  }
+
+  // any key stops the traced execution
+  serialWrite("\n");
+  serialRead(inbuf, BUFSIZE);
+
+  gettimeofday(&now, NULL);
+  double elapsed = (now.tv_sec - start.tv_sec) + (now.tv_usec - start.tv_usec) / 1e6;
+  unsigned int instrs = w.count;
+  trace_close_write(&w);
+
+  printf("\n- %u instructions recorded in %.2f seconds, %u bytes (%.1f bytes/instruction)\n",
+    instrs, elapsed, w.offset, instrs ? (double)w.offset / instrs : 0.0);
+}
+
+void print_trace_state(unsigned int instr, type_trace_state* st)
+{
+  printf("#%-9u PC=$%04X A=%02X X=%02X Y=%02X Z=%02X B=%02X SP=%04X  last-op: %02X %s\n",
+    instr, st->pc, st->a, st->x, st->y, st->z, st->b, st->sp, st->opcode, opcode_desc[st->opcode].name);
+}
+
+void cmdTrace(void)
+{
+  char* strCmd = strtok(NULL, " ");
+  char* strFile = strtok(NULL, " ");
+  type_trace_reader r;
+  type_trace_state st;
+
+  if (strCmd == NULL || strFile == NULL)
+  {
+    printf("Usage: trace record <file> [<count>] / trace show <file> [<from#> [<count>]] / trace find <file> <addr>\n");
+    return;
+  }
+
+  if (strcmp(strCmd, "record") == 0)
+  {
+    char* strCount = strtok(NULL, " ");
+    trace_record(strFile, strCount ? strtoul(strCount, NULL, 10) : 0);
+    return;
+  }
+
+  if (!trace_open_read(&r, strFile))
+  {
+    printf("Error opening the trace file '%s'!\n", strFile);
+    return;
+  }
+
+  if (strcmp(strCmd, "show") == 0)
+  {
+    char* strFrom = strtok(NULL, " ");
+    char* strCount = strtok(NULL, " ");
+    unsigned int from = strFrom ? strtoul(strFrom, NULL, 10) : 0;
+    unsigned int count = strCount ? strtoul(strCount, NULL, 10) : 20;
+
+    printf("- %u instructions in trace\n", r.count);
+    if (trace_seek(&r, from))
+    {
+      for (unsigned int k = 0; k < count && !ctrlcflag; k++)
+      {
+        unsigned int instr = r.instr;
+        if (!trace_next(&r, &st))
+          break;
+        print_trace_state(instr, &st);
+      }
+    }
+  }
+  else if (strcmp(strCmd, "find") == 0)
+  {
+    char* strAddr = strtok(NULL, " ");
+    if (strAddr == NULL)
+      printf("Missing <addr> parameter!\n");
+    else
+    {
+      int addr = get_sym_value(strAddr);
+      int found = 0;
+      unsigned int instr = 0;
+
+      while (trace_next(&r, &st))
+      {
+        if (st.pc == addr && found++ < 50)
+          print_trace_state(instr, &st);
+        instr++;
+      }
+      printf("- $%04X reached %d times (of %u instructions)\n", addr, found, r.count);
+    }
+  }
+  else
+    printf("Unknown trace command \"%s\"!\n", strCmd);
+
+  trace_close_read(&r);
+}
+
+// code coverage ('coverage')
+// ==========================
+
+typedef struct
+{
+  char* file;
+  unsigned char* lines;  // per line: 0 = no code, 1 = not executed, 2 = executed
+  int maxline;
+} type_file_coverage;
+
+// joins the coverage bitmap against the .list line information
+type_file_coverage* collect_coverage(int* nfiles)
+{
+  type_file_coverage* files = NULL;
+  *nfiles = 0;
+
+  for (type_fileloc* iter = lstFileLoc; iter < lstFileLoc + lstFileLocCount; iter++)
+  {
+    type_file_coverage* fc = NULL;
+    for (int k = 0; k < *nfiles; k++)
+      if (strcmp(files[k].file, iter->file) == 0)
+        fc = &files[k];
+
+    if (fc == NULL)
+    {
+      files = realloc(files, (*nfiles + 1) * sizeof(type_file_coverage));
+      fc = &files[(*nfiles)++];
+      fc->file = iter->file;
+      fc->lines = NULL;
+      fc->maxline = 0;
+    }
+
+    if (iter->lineno >= fc->maxline)
+    {
+      int newmax = iter->lineno + 256;
+      fc->lines = realloc(fc->lines, newmax);
+      memset(fc->lines + fc->maxline, 0, newmax - fc->maxline);
+      fc->maxline = newmax;
+    }
+
+    int state = coverage_hit(iter->addr) ? 2 : 1;
+    if (state > fc->lines[iter->lineno])
+      fc->lines[iter->lineno] = state;
+  }
+
+  return files;
+}
+
+void coverage_report(char* fname)
+{
+  int nfiles;
+  int total_found = 0, total_hit = 0;
+  FILE* f = NULL;
+
+  if (fname != NULL && (f = fopen(fname, "wt")) == NULL)
+  {
+    printf("Error opening the file '%s'!\n", fname);
+    return;
+  }
+
+  type_file_coverage* files = collect_coverage(&nfiles);
+
+  printf("- %d instruction addresses executed\n", coverage_count());
+  for (int k = 0; k < nfiles; k++)
+  {
+    int found = 0, hit = 0;
+
+    if (f != NULL)
+      fprintf(f, "TN:\nSF:%s\n", files[k].file);
+
+    for (int line = 0; line < files[k].maxline; line++)
+    {
+      if (files[k].lines[line] == 0)
+        continue;
+      found++;
+      if (files[k].lines[line] == 2)
+        hit++;
+      if (f != NULL)
+        fprintf(f, "DA:%d,%d\n", line, files[k].lines[line] == 2 ? 1 : 0);
+    }
+
+    if (f != NULL)
+      fprintf(f, "LF:%d\nLH:%d\nend_of_record\n", found, hit);
+
+    printf("  %6.1f%%  %5d/%-5d  %s\n", found ? 100.0 * hit / found : 0.0, hit, found, files[k].file);
+    total_found += found;
+    total_hit += hit;
+    free(files[k].lines);
+  }
+  free(files);
+
+  printf("  %6.1f%%  %5d/%-5d  total\n", total_found ? 100.0 * total_hit / total_found : 0.0, total_hit, total_found);
+
+  if (f != NULL)
+  {
+    fclose(f);
+    printf("- lcov report written to \"%s\"\n", fname);
+  }
+}
+
+void cmdCoverage(void)
+{
+  char* token = strtok(NULL, " ");
+
+  if (token == NULL)
+  {
+    printf(" - coverage collection is %s.\n", coverage_enabled ? "on" : "off");
+    coverage_report(NULL);
+  }
+  else if (strcmp(token, "on") == 0 || strcmp(token, "1") == 0)
+  {
+    coverage_enabled = true;
+    printf(" - coverage collection is turned on.\n");
+  }
+  else if (strcmp(token, "off") == 0 || strcmp(token, "0") == 0)
+  {
+    coverage_enabled = false;
+    printf(" - coverage collection is turned off.\n");
+  }
+  else if (strcmp(token, "clear") == 0)
+  {
+    coverage_clear();
+    printf(" - coverage cleared.\n");
+  }
+  else if (strcmp(token, "trace") == 0)
+  {
+    char* strFile = strtok(NULL, " ");
+    type_trace_reader r;
+    type_trace_state st;
+
+    if (strFile == NULL)
+      printf("Missing <file> parameter!\n");
+    else if (!trace_open_read(&r, strFile))
+      printf("Error opening the trace file '%s'!\n", strFile);
+    else
+    {
+      while (trace_next(&r, &st))
+        coverage_mark(st.pc);
+      printf(" - %u traced instructions added to coverage.\n", r.count);
+      trace_close_read(&r);
+    }
+  }
+  else if (strcmp(token, "report") == 0)
+  {
+    char* strFile = strtok(NULL, " ");
+    if (strFile == NULL)
+      printf("Missing <lcovfile> parameter!\n");
+    else
+      coverage_report(strFile);
+  }
+  else
+    printf("Unknown coverage command \"%s\"!\n", token);
+}
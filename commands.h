@@ -1,6 +1,9 @@
 #include <stdbool.h>
 
 void listSearch(void);
+int listRefreshFd(void);
+void listRefresh(void);
+void show_async_stop(char* info);
 void cmdRawHelp(void);
 void cmdHelp(void);
 void cmdDump(void);
@@ -9,6 +12,11 @@ void cmdDisassemble(void);
 void cmdStep(void);
 void cmdNext(void);
 void cmdFinish(void);
+void cmdJournal(void);
+void cmdReverseStep(void);
+void cmdReverseNext(void);
+void cmdSourceStep(void);
+void cmdSourceNext(void);
 void cmdPrintByte(void);
 void cmdPrintWord(void);
 void cmdPrintDWord(void);
@@ -16,6 +24,8 @@ void cmdPrintString(void);
 void cmdClearScreen(void);
 void cmdAutoClearScreen(void);
 void cmdSetBreakpoint(void);
+void cmdContinue(void);
+void cmdWatchpoint(void);
 void cmdWatchByte(void);
 void cmdWatchByte(void);
 void cmdWatchWord(void);
@@ -24,9 +34,16 @@ void cmdWatchString(void);
 void cmdWatches(void);
 void cmdDeleteWatch(void);
 void cmdAutoWatch(void);
+void cmdContext(void);
 void cmdSymbolValue(void);
+void cmdReload(void);
 void cmdSave(void);
 void cmdLoad(void);
+void cmdDisfile(void);
+void cmdXref(void);
+void cmdProfile(void);
+void cmdTrace(void);
+void cmdCoverage(void);
 void cmdBackTrace(void);
 void cmdUpFrame(void);
 void cmdDownFrame(void);
@@ -34,6 +51,7 @@ void cmdDownFrame(void);
 #define BUFSIZE 4096
 
 extern char outbuf[];
+extern char* projectDir;
 extern char inbuf[];
 extern bool ctrlcflag;
 
@@ -50,6 +68,7 @@ typedef struct tse
   char* symbol;
   int addr;   // integer value of symbol
   char* sval; // string value of symbol
+  int list;   // the .list file whose .map file it came from
   struct tse* next;
 } type_symmap_entry;
 
@@ -66,3 +85,5 @@ typedef struct we
 extern type_command_details command_details[];
 extern type_symmap_entry* lstSymMap;
 extern type_watch_entry* lstWatches;
+
+int find_symbols_by_prefix(const char* prefix, type_symmap_entry*** first);
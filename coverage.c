@@ -0,0 +1,54 @@
+/**
+ * coverage.c - keeps one bit per address of the 28-bit address space (32MB,
+ * allocated lazily and only touched where code actually runs), marking the
+ * instruction starts that have been seen executing.
+ **/
+
+#include <stdlib.h>
+#include <string.h>
+#include "coverage.h"
+
+#define COVERAGE_BYTES (1 << (COVERAGE_ADDR_BITS - 3))
+
+bool coverage_enabled = false;
+
+static unsigned char* bitmap = NULL;
+static int marked = 0;
+
+void coverage_mark(int addr)
+{
+  if (bitmap == NULL)
+    bitmap = calloc(COVERAGE_BYTES, 1);
+
+  addr &= (1 << COVERAGE_ADDR_BITS) - 1;
+  unsigned char bit = 1 << (addr & 7);
+  unsigned char* p = &bitmap[addr >> 3];
+
+  if (!(*p & bit))
+  {
+    *p |= bit;
+    marked++;
+  }
+}
+
+bool coverage_hit(int addr)
+{
+  if (bitmap == NULL)
+    return false;
+
+  addr &= (1 << COVERAGE_ADDR_BITS) - 1;
+  return (bitmap[addr >> 3] & (1 << (addr & 7))) != 0;
+}
+
+void coverage_clear(void)
+{
+  free(bitmap);
+  bitmap = NULL;
+  marked = 0;
+}
+
+// returns the number of distinct addresses marked so far
+int coverage_count(void)
+{
+  return marked;
+}
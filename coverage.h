@@ -0,0 +1,14 @@
+/**
+ * coverage.h - bitmap of executed instruction addresses
+ */
+
+#include <stdbool.h>
+
+#define COVERAGE_ADDR_BITS 28
+
+extern bool coverage_enabled;
+
+void coverage_mark(int addr);
+bool coverage_hit(int addr);
+void coverage_clear(void);
+int coverage_count(void);
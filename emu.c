@@ -0,0 +1,532 @@
+/**
+ * emu.c - a host-side 45GS02 interpreter.
+ *
+ * It decodes through the same opcode_desc table as the disassembler, and
+ * runs against a mirror of the target's memory (cpu context) that is
+ * filled lazily, 512 bytes per round trip. Anything whose
+ * outcome can't be known on the host (I/O accesses, MAP, BRK, ...) makes
+ * emu_step() fail, so the caller can fall back to stepping the real target.
+ **/
+
+#define _BSD_SOURCE _BSD_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include "commands.h"
+#include "gs4510.h"
+#include "emu.h"
+
+char emu_diverge_reason[128] = { 0 };
+type_emu_write emu_writes[EMU_MAX_WRITES];
+bool emu_writes_known = true;
+int emu_nwrites = 0;
+
+static emu_fill_func fill_mem = NULL;
+static unsigned char mirror[0x10000];
+static bool mirror_valid[0x10000 / 512];
+static bool diverged;
+
+typedef enum {
+  K_ADC, K_AND, K_ASL, K_ASR, K_ASW, K_BBR, K_BBS, K_BCC, K_BCS, K_BEQ, K_BIT,
+  K_BMI, K_BNE, K_BPL, K_BRA, K_BRK, K_BSR, K_BVC, K_BVS, K_CLC, K_CLD, K_CLE,
+  K_CLI, K_CLV, K_CMP, K_CPX, K_CPY, K_CPZ, K_DEC, K_DEW, K_DEX, K_DEY, K_DEZ,
+  K_EOM, K_EOR, K_INC, K_INW, K_INX, K_INY, K_INZ, K_JMP, K_JSR, K_LDA, K_LDX,
+  K_LDY, K_LDZ, K_LSR, K_MAP, K_NEG, K_ORA, K_PHA, K_PHP, K_PHW, K_PHX, K_PHY,
+  K_PHZ, K_PLA, K_PLP, K_PLX, K_PLY, K_PLZ, K_RMB, K_ROL, K_ROR, K_ROW, K_RTI,
+  K_RTS, K_SBC, K_SEC, K_SED, K_SEE, K_SEI, K_SMB, K_STA, K_STX, K_STY, K_STZ,
+  K_TAB, K_TAX, K_TAY, K_TAZ, K_TBA, K_TRB, K_TSB, K_TSX, K_TSY, K_TXA, K_TXS,
+  K_TYA, K_TYS, K_TZA, K_UNKNOWN
+} type_kind;
+
+static char* kind_names[] = {
+  "ADC", "AND", "ASL", "ASR", "ASW", "BBR", "BBS", "BCC", "BCS", "BEQ", "BIT",
+  "BMI", "BNE", "BPL", "BRA", "BRK", "BSR", "BVC", "BVS", "CLC", "CLD", "CLE",
+  "CLI", "CLV", "CMP", "CPX", "CPY", "CPZ", "DEC", "DEW", "DEX", "DEY", "DEZ",
+  "EOM", "EOR", "INC", "INW", "INX", "INY", "INZ", "JMP", "JSR", "LDA", "LDX",
+  "LDY", "LDZ", "LSR", "MAP", "NEG", "ORA", "PHA", "PHP", "PHW", "PHX", "PHY",
+  "PHZ", "PLA", "PLP", "PLX", "PLY", "PLZ", "RMB", "ROL", "ROR", "ROW", "RTI",
+  "RTS", "SBC", "SEC", "SED", "SEE", "SEI", "SMB", "STA", "STX", "STY", "STZ",
+  "TAB", "TAX", "TAY", "TAZ", "TBA", "TRB", "TSB", "TSX", "TSY", "TXA", "TXS",
+  "TYA", "TYS", "TZA"
+};
+
+static unsigned char op_kind[256];
+
+void emu_init(emu_fill_func fill)
+{
+  fill_mem = fill;
+
+  for (int op = 0; op < 256; op++)
+  {
+    op_kind[op] = K_UNKNOWN;
+    for (int k = 0; k < K_UNKNOWN; k++)
+      if (strncmp(opcode_desc[op].name, kind_names[k], 3) == 0)
+        op_kind[op] = k;
+  }
+
+  emu_invalidate();
+}
+
+// forgets the mirrored memory (e.g., after the real target has run)
+void emu_invalidate(void)
+{
+  memset(mirror_valid, 0, sizeof(mirror_valid));
+}
+
+static void diverge(char* reason, int addr)
+{
+  if (!diverged)
+    sprintf(emu_diverge_reason, reason, addr);
+  diverged = true;
+}
+
+int emu_peek(int addr)
+{
+  addr &= 0xffff;
+  if (!mirror_valid[addr / 512])
+  {
+    fill_mem(addr & ~511, &mirror[addr & ~511]);
+    mirror_valid[addr / 512] = true;
+  }
+
+  return mirror[addr];
+}
+
+static bool is_io(int addr)
+{
+  return (addr >= 0xd000 && addr <= 0xdfff) || addr <= 0x0001;
+}
+
+static int rd(int addr)
+{
+  addr &= 0xffff;
+  if (is_io(addr))
+    diverge("reads I/O/cpu-port at $%04X", addr);
+  return emu_peek(addr);
+}
+
+static void wr(int addr, int val)
+{
+  // (once something was unpredictable, the address written to may be wrong too)
+  if (diverged)
+    emu_writes_known = false;
+
+  addr &= 0xffff;
+  if (is_io(addr))
+  {
+    emu_writes_known = false;
+    diverge("writes I/O/cpu-port at $%04X", addr);
+    return;
+  }
+
+  emu_peek(addr); // make sure the block is mirrored
+  if (emu_nwrites < EMU_MAX_WRITES)
+  {
+    emu_writes[emu_nwrites].addr = addr;
+    emu_writes[emu_nwrites].old = mirror[addr];
+    emu_nwrites++;
+  }
+  else
+    emu_writes_known = false;
+  mirror[addr] = val & 0xff;
+}
+
+static int rd16(int addr)
+{
+  return rd(addr) | (rd(addr + 1) << 8);
+}
+
+// reads a word from the base-page, wrapping within the page
+static int rd16_bp(type_cpu_state* c, int zp)
+{
+  return rd((c->b << 8) | (zp & 0xff)) | (rd((c->b << 8) | ((zp + 1) & 0xff)) << 8);
+}
+
+static void push(type_cpu_state* c, int val)
+{
+  wr(c->sp, val);
+  if (c->p & F_E)
+    c->sp = (c->sp & 0xff00) | ((c->sp - 1) & 0xff);
+  else
+    c->sp = (c->sp - 1) & 0xffff;
+}
+
+static int pull(type_cpu_state* c)
+{
+  if (c->p & F_E)
+    c->sp = (c->sp & 0xff00) | ((c->sp + 1) & 0xff);
+  else
+    c->sp = (c->sp + 1) & 0xffff;
+  return rd(c->sp);
+}
+
+static int set_nz(type_cpu_state* c, int val)
+{
+  val &= 0xff;
+  c->p &= ~(F_N | F_Z);
+  if (val & 0x80)
+    c->p |= F_N;
+  if (val == 0)
+    c->p |= F_Z;
+  return val;
+}
+
+static int set_nz16(type_cpu_state* c, int val)
+{
+  val &= 0xffff;
+  c->p &= ~(F_N | F_Z);
+  if (val & 0x8000)
+    c->p |= F_N;
+  if (val == 0)
+    c->p |= F_Z;
+  return val;
+}
+
+static void set_flag(type_cpu_state* c, int flag, bool on)
+{
+  if (on)
+    c->p |= flag;
+  else
+    c->p &= ~flag;
+}
+
+static void compare(type_cpu_state* c, int reg, int val)
+{
+  set_flag(c, F_C, reg >= val);
+  set_nz(c, reg - val);
+}
+
+static void adc(type_cpu_state* c, int m)
+{
+  int carry = c->p & F_C;
+  int sum = c->a + m + carry;
+
+  set_flag(c, F_V, (~(c->a ^ m) & (c->a ^ sum) & 0x80) != 0);
+
+  if (c->p & F_D)
+  {
+    int lo = (c->a & 0x0f) + (m & 0x0f) + carry;
+    if (lo > 9)
+      lo += 6;
+    int hi = (c->a >> 4) + (m >> 4) + (lo > 0x0f);
+    if (hi > 9)
+      hi += 6;
+    set_flag(c, F_C, hi > 0x0f);
+    c->a = set_nz(c, (hi << 4) | (lo & 0x0f));
+  }
+  else
+  {
+    set_flag(c, F_C, sum > 0xff);
+    c->a = set_nz(c, sum);
+  }
+}
+
+static void sbc(type_cpu_state* c, int m)
+{
+  int borrow = (c->p & F_C) ? 0 : 1;
+  int diff = c->a - m - borrow;
+
+  set_flag(c, F_V, ((c->a ^ m) & (c->a ^ diff) & 0x80) != 0);
+
+  if (c->p & F_D)
+  {
+    int lo = (c->a & 0x0f) - (m & 0x0f) - borrow;
+    int hi = (c->a >> 4) - (m >> 4);
+    if (lo < 0)
+    {
+      lo -= 6;
+      hi--;
+    }
+    if (hi < 0)
+      hi -= 6;
+    set_flag(c, F_C, diff >= 0);
+    c->a = set_nz(c, (hi << 4) | (lo & 0x0f));
+  }
+  else
+  {
+    set_flag(c, F_C, diff >= 0);
+    c->a = set_nz(c, diff);
+  }
+}
+
+/**
+ * executes one instruction on the host
+ *
+ * returns:
+ *   true = 'cpu' holds the state after the instruction
+ *   false = the outcome can't be predicted (see emu_diverge_reason)
+ */
+bool emu_step(type_cpu_state* cpu)
+{
+  type_cpu_state c = *cpu;
+
+  diverged = false;
+  emu_nwrites = 0;
+  emu_writes_known = true;
+
+  unsigned char look[DIS_MAX_LEN];
+  for (int k = 0; k < DIS_MAX_LEN; k++)
+    look[k] = emu_peek(c.pc + k);
+  if (decode_opcode(look)->prefix != 0)
+  {
+    diverge("32-bit/quad instruction at $%04X", c.pc);
+    emu_writes_known = false;
+    return false;
+  }
+
+  int op = rd(c.pc);
+  int mode = opcode_desc[op].mode;
+  int len = opcode_desc[op].len;
+  int b1 = rd(c.pc + 1);
+  int b2 = rd(c.pc + 2);
+  int abs = b1 | (b2 << 8);
+  int ea = -1;       // effective address (-1 = register/immediate operand)
+  int val = 0;       // operand value
+  int next = (c.pc + len) & 0xffff;
+  int bp = c.b << 8;
+
+  switch (mode)
+  {
+    case M_nn:      ea = bp | b1; break;
+    case M_nnX:     ea = bp | ((b1 + c.x) & 0xff); break;
+    case M_nnY:     ea = bp | ((b1 + c.y) & 0xff); break;
+    case M_nnnn:    ea = abs; break;
+    case M_nnnnX:   ea = (abs + c.x) & 0xffff; break;
+    case M_nnnnY:   ea = (abs + c.y) & 0xffff; break;
+    case M_InnX:    ea = rd16_bp(&c, b1 + c.x); break;
+    case M_InnY:    ea = (rd16_bp(&c, b1) + c.y) & 0xffff; break;
+    case M_InnZ:    ea = (rd16_bp(&c, b1) + c.z) & 0xffff; break;
+    case M_InnSPY:  ea = (rd16(c.sp + b1) + c.y) & 0xffff; break;
+    case M_Innnn:   ea = rd16(abs); break;
+    case M_InnnnX:  ea = rd16((abs + c.x) & 0xffff); break;
+    case M_immnn:   val = b1; break;
+    case M_immnnnn: val = abs; break;
+    case M_nnrr:    ea = bp | b1; break;
+    default: break;
+  }
+
+  // operand fetch for instructions that read memory
+  int kind = op_kind[op];
+  bool reads = ea != -1 && kind != K_STA && kind != K_STX && kind != K_STY &&
+    kind != K_STZ && kind != K_JMP && kind != K_JSR && kind != K_BSR &&
+    kind != K_PHW && kind != K_ASW && kind != K_ROW && kind != K_INW && kind != K_DEW;
+  if (reads)
+    val = rd(ea);
+
+  // for read-modify-write instructions: is the accumulator the target?
+  bool acc = (ea == -1);
+
+  c.pc = next;
+
+  switch (kind)
+  {
+    case K_ADC: adc(&c, val); break;
+    case K_SBC: sbc(&c, val); break;
+    case K_AND: c.a = set_nz(&c, c.a & val); break;
+    case K_ORA: c.a = set_nz(&c, c.a | val); break;
+    case K_EOR: c.a = set_nz(&c, c.a ^ val); break;
+    case K_CMP: compare(&c, c.a, val); break;
+    case K_CPX: compare(&c, c.x, val); break;
+    case K_CPY: compare(&c, c.y, val); break;
+    case K_CPZ: compare(&c, c.z, val); break;
+    case K_LDA: c.a = set_nz(&c, val); break;
+    case K_LDX: c.x = set_nz(&c, val); break;
+    case K_LDY: c.y = set_nz(&c, val); break;
+    case K_LDZ: c.z = set_nz(&c, val); break;
+    case K_STA: wr(ea, c.a); break;
+    case K_STX: wr(ea, c.x); break;
+    case K_STY: wr(ea, c.y); break;
+    case K_STZ: wr(ea, c.z); break; // the 4502's STZ stores the Z register
+
+    case K_BIT:
+      set_flag(&c, F_Z, (c.a & val) == 0);
+      if (mode != M_immnn)
+      {
+        set_flag(&c, F_N, val & 0x80);
+        set_flag(&c, F_V, val & 0x40);
+      }
+      break;
+
+    case K_ASL: case K_LSR: case K_ROL: case K_ROR: case K_ASR:
+    case K_INC: case K_DEC: case K_TSB: case K_TRB:
+    {
+      int v = acc ? c.a : val;
+      int carry = c.p & F_C;
+      switch (kind)
+      {
+        case K_ASL: set_flag(&c, F_C, v & 0x80); v = set_nz(&c, v << 1); break;
+        case K_LSR: set_flag(&c, F_C, v & 0x01); v = set_nz(&c, v >> 1); break;
+        case K_ROL: set_flag(&c, F_C, v & 0x80); v = set_nz(&c, (v << 1) | carry); break;
+        case K_ROR: set_flag(&c, F_C, v & 0x01); v = set_nz(&c, (v >> 1) | (carry << 7)); break;
+        case K_ASR: set_flag(&c, F_C, v & 0x01); v = set_nz(&c, (v >> 1) | (v & 0x80)); break;
+        case K_INC: v = set_nz(&c, v + 1); break;
+        case K_DEC: v = set_nz(&c, v - 1); break;
+        case K_TSB: set_flag(&c, F_Z, (c.a & v) == 0); v |= c.a; break;
+        case K_TRB: set_flag(&c, F_Z, (c.a & v) == 0); v &= ~c.a; break;
+      }
+      if (acc)
+        c.a = v & 0xff;
+      else
+        wr(ea, v);
+      break;
+    }
+
+    case K_NEG: c.a = set_nz(&c, -c.a); break;
+
+    case K_INW: case K_DEW:
+    {
+      int w = rd16_bp(&c, b1);
+      w = set_nz16(&c, kind == K_INW ? w + 1 : w - 1);
+      wr(bp | b1, w);
+      wr(bp | ((b1 + 1) & 0xff), w >> 8);
+      break;
+    }
+
+    case K_ASW: case K_ROW:
+    {
+      int w = rd16(ea);
+      int carry = c.p & F_C;
+      set_flag(&c, F_C, w & 0x8000);
+      w = set_nz16(&c, (w << 1) | (kind == K_ROW ? carry : 0));
+      wr(ea, w);
+      wr(ea + 1, w >> 8);
+      break;
+    }
+
+    case K_RMB: wr(ea, val & ~(1 << ((op >> 4) & 7))); break;
+    case K_SMB: wr(ea, val | (1 << ((op >> 4) & 7))); break;
+
+    case K_BBR: case K_BBS:
+    {
+      bool set = (val >> ((op >> 4) & 7)) & 1;
+      if (set == (kind == K_BBS))
+        c.pc = (next + (signed char)b2) & 0xffff;
+      break;
+    }
+
+    case K_BPL: case K_BMI: case K_BVC: case K_BVS:
+    case K_BCC: case K_BCS: case K_BNE: case K_BEQ: case K_BRA:
+    {
+      bool take = false;
+      switch (kind)
+      {
+        case K_BPL: take = !(c.p & F_N); break;
+        case K_BMI: take = (c.p & F_N); break;
+        case K_BVC: take = !(c.p & F_V); break;
+        case K_BVS: take = (c.p & F_V); break;
+        case K_BCC: take = !(c.p & F_C); break;
+        case K_BCS: take = (c.p & F_C); break;
+        case K_BNE: take = !(c.p & F_Z); break;
+        case K_BEQ: take = (c.p & F_Z); break;
+        default:    take = true; break;
+      }
+      if (take)
+      {
+        // 16-bit branches are relative to the address after the opcode + 1,
+        // like the disassembler shows them
+        if (mode == M_rrrr)
+          c.pc = (cpu->pc + 2 + abs) & 0xffff;
+        else
+          c.pc = (next + (signed char)b1) & 0xffff;
+      }
+      break;
+    }
+
+    case K_JMP: c.pc = ea; break;
+
+    case K_JSR:
+      push(&c, (cpu->pc + len - 1) >> 8);
+      push(&c, (cpu->pc + len - 1));
+      c.pc = ea;
+      break;
+
+    case K_BSR:
+      push(&c, (cpu->pc + len - 1) >> 8);
+      push(&c, (cpu->pc + len - 1));
+      c.pc = (cpu->pc + 2 + abs) & 0xffff;
+      break;
+
+    case K_RTS:
+    {
+      int lo = pull(&c);
+      int hi = pull(&c);
+      c.pc = (((hi << 8) | lo) + 1) & 0xffff;
+      if (mode == M_immnn) // RTS #n also drops n bytes from the stack
+      {
+        for (int k = 0; k < b1; k++)
+          pull(&c);
+      }
+      break;
+    }
+
+    case K_RTI:
+    {
+      int p = pull(&c);
+      c.p = (p & ~(F_B | F_E)) | (c.p & (F_B | F_E));
+      int lo = pull(&c);
+      int hi = pull(&c);
+      c.pc = (hi << 8) | lo;
+      break;
+    }
+
+    case K_PHA: push(&c, c.a); break;
+    case K_PHX: push(&c, c.x); break;
+    case K_PHY: push(&c, c.y); break;
+    case K_PHZ: push(&c, c.z); break;
+    case K_PHP: push(&c, c.p | F_B); break;
+    case K_PLA: c.a = set_nz(&c, pull(&c)); break;
+    case K_PLX: c.x = set_nz(&c, pull(&c)); break;
+    case K_PLY: c.y = set_nz(&c, pull(&c)); break;
+    case K_PLZ: c.z = set_nz(&c, pull(&c)); break;
+    case K_PLP: c.p = (pull(&c) & ~(F_B | F_E)) | (c.p & (F_B | F_E)); break;
+
+    case K_PHW:
+    {
+      int w = (mode == M_immnnnn) ? val : rd16(ea);
+      push(&c, w >> 8);
+      push(&c, w);
+      break;
+    }
+
+    case K_CLC: c.p &= ~F_C; break;
+    case K_SEC: c.p |= F_C; break;
+    case K_CLD: c.p &= ~F_D; break;
+    case K_SED: c.p |= F_D; break;
+    case K_CLI: c.p &= ~F_I; break;
+    case K_SEI: c.p |= F_I; break;
+    case K_CLV: c.p &= ~F_V; break;
+    case K_CLE: c.p &= ~F_E; break;
+    case K_SEE: c.p |= F_E; break;
+
+    case K_INX: c.x = set_nz(&c, c.x + 1); break;
+    case K_INY: c.y = set_nz(&c, c.y + 1); break;
+    case K_INZ: c.z = set_nz(&c, c.z + 1); break;
+    case K_DEX: c.x = set_nz(&c, c.x - 1); break;
+    case K_DEY: c.y = set_nz(&c, c.y - 1); break;
+    case K_DEZ: c.z = set_nz(&c, c.z - 1); break;
+
+    case K_TAX: c.x = set_nz(&c, c.a); break;
+    case K_TAY: c.y = set_nz(&c, c.a); break;
+    case K_TAZ: c.z = set_nz(&c, c.a); break;
+    case K_TXA: c.a = set_nz(&c, c.x); break;
+    case K_TYA: c.a = set_nz(&c, c.y); break;
+    case K_TZA: c.a = set_nz(&c, c.z); break;
+    case K_TAB: c.b = c.a; break;
+    case K_TBA: c.a = set_nz(&c, c.b); break;
+    case K_TSX: c.x = set_nz(&c, c.sp); break;
+    case K_TXS: c.sp = (c.sp & 0xff00) | c.x; break;
+    case K_TSY: c.y = set_nz(&c, c.sp >> 8); break;
+    case K_TYS: c.sp = (c.y << 8) | (c.sp & 0xff); break;
+
+    case K_EOM: break;
+
+    case K_BRK: diverge("BRK at $%04X", cpu->pc); emu_writes_known = false; break;
+    case K_MAP: diverge("MAP at $%04X changes the memory mapping", cpu->pc); break;
+    default:    diverge("unsupported opcode at $%04X", cpu->pc); emu_writes_known = false; break;
+  }
+
+  if (diverged)
+    return false;
+
+  *cpu = c;
+  return true;
+}
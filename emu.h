@@ -0,0 +1,47 @@
+/**
+ * emu.h - host-side 45GS02 interpreter, used to predict where stepping ends up
+ */
+
+#include <stdbool.h>
+
+#define F_N 0x80
+#define F_V 0x40
+#define F_E 0x20
+#define F_B 0x10
+#define F_D 0x08
+#define F_I 0x04
+#define F_Z 0x02
+#define F_C 0x01
+
+#define EMU_MAX_WRITES 8
+
+typedef struct
+{
+  int pc;
+  int a;
+  int x;
+  int y;
+  int z;
+  int b;
+  int sp;
+  int p;
+} type_cpu_state;
+
+typedef struct
+{
+  int addr;
+  unsigned char old;
+} type_emu_write;
+
+// fills 'dest' with the 512 bytes of target memory (cpu context) from 'addr'
+typedef void (*emu_fill_func)(int addr, unsigned char* dest);
+
+extern char emu_diverge_reason[];
+extern type_emu_write emu_writes[];
+extern int emu_nwrites;
+extern bool emu_writes_known;  // (false if the last step may have written more than emu_writes says)
+
+void emu_init(emu_fill_func fill);
+void emu_invalidate(void);
+int emu_peek(int addr);
+bool emu_step(type_cpu_state* cpu);
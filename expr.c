@@ -0,0 +1,373 @@
+/**
+ * expr.c - compiles condition expressions (e.g. "A==$20 && [buf+3]!=0") into
+ * a small stack-machine bytecode, so that they can be evaluated cheaply on
+ * every breakpoint hit.
+ *
+ * Operands:
+ *   A X Y Z B SP PC  = cpu registers
+ *   $1F / 1F         = hex values (bare values are hex, like elsewhere in m65dbg,
+ *                      but a bare A or B is the register: write $A / $B for the values)
+ *   #31              = decimal value
+ *   symbol           = value from the .map file
+ *   [expr]           = byte of memory at address 'expr' (cpu context)
+ *
+ * Operators (lowest to highest precedence):
+ *   ||  &&  |  ^  &  == !=  < <= > >=  << >>  + -  *  unary(! - ~)
+ **/
+
+#define _BSD_SOURCE _BSD_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include "expr.h"
+
+static char* reg_names[] = { "PC", "A", "X", "Y", "Z", "B", "SP" };
+
+static char* src;
+static type_expr* cur;
+static expr_lookup_func cur_lookup;
+static bool failed;
+
+static void error(char* msg)
+{
+  if (!failed)
+    printf("Expression error: %s (near \"%s\")\n", msg, src);
+  failed = true;
+}
+
+static int emit(expr_opcode op, int arg)
+{
+  if (cur->len >= EXPR_MAX_CODE)
+  {
+    error("expression too long");
+    return 0;
+  }
+  cur->code[cur->len].op = op;
+  cur->code[cur->len].arg = arg;
+  return cur->len++;
+}
+
+static void skip_spaces(void)
+{
+  while (isspace((unsigned char)*src))
+    src++;
+}
+
+// returns true (and consumes it) if the next token is 'tok'
+static bool accept(char* tok)
+{
+  skip_spaces();
+  int len = strlen(tok);
+  if (strncmp(src, tok, len) != 0)
+    return false;
+
+  // don't mistake '<<' for '<', '&&' for '&', etc.
+  if (len == 1 && ((strchr("&|<>", tok[0]) && src[1] == tok[0]) ||
+                   (strchr("<>!", tok[0]) && src[1] == '=')))
+    return false;
+
+  src += len;
+  return true;
+}
+
+static bool is_ident_char(char c)
+{
+  return isalnum((unsigned char)c) || c == '_' || c == '.';
+}
+
+static void parse_or(void);
+
+static void parse_primary(void)
+{
+  skip_spaces();
+
+  if (accept("("))
+  {
+    parse_or();
+    if (!accept(")"))
+      error("missing ')'");
+    return;
+  }
+
+  if (accept("["))
+  {
+    parse_or();
+    if (!accept("]"))
+      error("missing ']'");
+    emit(OP_MEM, 0);
+    return;
+  }
+
+  if (*src == '$' || *src == '#')
+  {
+    char* end;
+    int val = strtol(src+1, &end, *src == '$' ? 16 : 10);
+    if (end == src+1)
+      error("bad number");
+    src = end;
+    emit(OP_CONST, val);
+    return;
+  }
+
+  if (is_ident_char(*src))
+  {
+    char ident[256];
+    int len = 0;
+    while (is_ident_char(*src) && len < 255)
+      ident[len++] = *src++;
+    ident[len] = '\0';
+
+    for (int k = 0; k < R_COUNT; k++)
+    {
+      if (strcmp(ident, reg_names[k]) == 0)
+      {
+        emit(OP_REG, k);
+        return;
+      }
+    }
+
+    int val;
+    if (cur_lookup != NULL && cur_lookup(ident, &val))
+    {
+      emit(OP_CONST, val);
+      return;
+    }
+
+    char* end;
+    val = strtol(ident, &end, 16);
+    if (*end != '\0')
+    {
+      error("unknown symbol");
+      return;
+    }
+    emit(OP_CONST, val);
+    return;
+  }
+
+  error("unexpected character");
+}
+
+static void parse_unary(void)
+{
+  if (accept("!"))
+  {
+    parse_unary();
+    emit(OP_NOT, 0);
+  }
+  else if (accept("-"))
+  {
+    parse_unary();
+    emit(OP_NEG, 0);
+  }
+  else if (accept("~"))
+  {
+    parse_unary();
+    emit(OP_CPL, 0);
+  }
+  else
+    parse_primary();
+}
+
+static void parse_mul(void)
+{
+  parse_unary();
+  while (!failed && accept("*"))
+  {
+    parse_unary();
+    emit(OP_MUL, 0);
+  }
+}
+
+static void parse_add(void)
+{
+  parse_mul();
+  while (!failed)
+  {
+    if (accept("+"))      { parse_mul(); emit(OP_ADD, 0); }
+    else if (accept("-")) { parse_mul(); emit(OP_SUB, 0); }
+    else break;
+  }
+}
+
+static void parse_shift(void)
+{
+  parse_add();
+  while (!failed)
+  {
+    if (accept("<<"))      { parse_add(); emit(OP_SHL, 0); }
+    else if (accept(">>")) { parse_add(); emit(OP_SHR, 0); }
+    else break;
+  }
+}
+
+static void parse_rel(void)
+{
+  parse_shift();
+  while (!failed)
+  {
+    if (accept("<="))      { parse_shift(); emit(OP_LE, 0); }
+    else if (accept(">=")) { parse_shift(); emit(OP_GE, 0); }
+    else if (accept("<"))  { parse_shift(); emit(OP_LT, 0); }
+    else if (accept(">"))  { parse_shift(); emit(OP_GT, 0); }
+    else break;
+  }
+}
+
+static void parse_eq(void)
+{
+  parse_rel();
+  while (!failed)
+  {
+    if (accept("=="))      { parse_rel(); emit(OP_EQ, 0); }
+    else if (accept("!=")) { parse_rel(); emit(OP_NE, 0); }
+    else break;
+  }
+}
+
+static void parse_band(void)
+{
+  parse_eq();
+  while (!failed && accept("&"))
+  {
+    parse_eq();
+    emit(OP_AND, 0);
+  }
+}
+
+static void parse_bxor(void)
+{
+  parse_band();
+  while (!failed && accept("^"))
+  {
+    parse_band();
+    emit(OP_XOR, 0);
+  }
+}
+
+static void parse_bor(void)
+{
+  parse_bxor();
+  while (!failed && accept("|"))
+  {
+    parse_bxor();
+    emit(OP_OR, 0);
+  }
+}
+
+// '&&' and '||' short-circuit, so memory operands on the right-hand side are
+// only fetched from the target when they are actually needed
+static void parse_land(void)
+{
+  parse_bor();
+  while (!failed && accept("&&"))
+  {
+    emit(OP_BOOL, 0);
+    int jmp = emit(OP_JZ, 0);
+    parse_bor();
+    emit(OP_BOOL, 0);
+    cur->code[jmp].arg = cur->len;
+  }
+}
+
+static void parse_or(void)
+{
+  parse_land();
+  while (!failed && accept("||"))
+  {
+    emit(OP_BOOL, 0);
+    int jmp = emit(OP_JNZ, 0);
+    parse_land();
+    emit(OP_BOOL, 0);
+    cur->code[jmp].arg = cur->len;
+  }
+}
+
+/**
+ * compiles the given expression text into bytecode
+ *
+ * e      = the compiled expression
+ * text   = the expression source
+ * lookup = resolves symbol names (may be NULL)
+ *
+ * returns false (after printing an error) if the expression is invalid
+ */
+bool expr_compile(type_expr* e, char* text, expr_lookup_func lookup)
+{
+  src = text;
+  cur = e;
+  cur_lookup = lookup;
+  failed = false;
+  e->len = 0;
+
+  parse_or();
+  skip_spaces();
+  if (!failed && *src != '\0')
+    error("trailing characters");
+
+  return !failed;
+}
+
+/**
+ * evaluates a compiled expression
+ *
+ * regs = register values, indexed by expr_reg
+ * peek = reads a byte of target memory
+ */
+int expr_eval(type_expr* e, int* regs, expr_peek_func peek)
+{
+  int stack[EXPR_MAX_CODE];
+  int sp = 0;
+  int pc = 0;
+
+  while (pc < e->len)
+  {
+    type_expr_insn* in = &e->code[pc++];
+    int b;
+
+    switch (in->op)
+    {
+      case OP_CONST: stack[sp++] = in->arg; break;
+      case OP_REG:   stack[sp++] = regs[in->arg]; break;
+      case OP_MEM:   stack[sp-1] = peek(stack[sp-1]); break;
+      case OP_NOT:   stack[sp-1] = !stack[sp-1]; break;
+      case OP_NEG:   stack[sp-1] = -stack[sp-1]; break;
+      case OP_CPL:   stack[sp-1] = ~stack[sp-1]; break;
+      case OP_BOOL:  stack[sp-1] = stack[sp-1] != 0; break;
+      case OP_JZ:
+        if (stack[sp-1] == 0)
+          pc = in->arg;
+        else
+          sp--;
+        break;
+      case OP_JNZ:
+        if (stack[sp-1] != 0)
+          pc = in->arg;
+        else
+          sp--;
+        break;
+      default:
+        b = stack[--sp];
+        switch (in->op)
+        {
+          case OP_MUL: stack[sp-1] *= b; break;
+          case OP_ADD: stack[sp-1] += b; break;
+          case OP_SUB: stack[sp-1] -= b; break;
+          case OP_SHL: stack[sp-1] <<= b; break;
+          case OP_SHR: stack[sp-1] >>= b; break;
+          case OP_LT:  stack[sp-1] = stack[sp-1] < b; break;
+          case OP_LE:  stack[sp-1] = stack[sp-1] <= b; break;
+          case OP_GT:  stack[sp-1] = stack[sp-1] > b; break;
+          case OP_GE:  stack[sp-1] = stack[sp-1] >= b; break;
+          case OP_EQ:  stack[sp-1] = stack[sp-1] == b; break;
+          case OP_NE:  stack[sp-1] = stack[sp-1] != b; break;
+          case OP_AND: stack[sp-1] &= b; break;
+          case OP_XOR: stack[sp-1] ^= b; break;
+          case OP_OR:  stack[sp-1] |= b; break;
+        }
+        break;
+    }
+  }
+
+  return sp > 0 ? stack[sp-1] : 0;
+}
@@ -0,0 +1,58 @@
+/**
+ * expr.h - tiny expression compiler/evaluator used by conditional breakpoints
+ */
+
+#include <stdbool.h>
+
+#define EXPR_MAX_CODE 64
+
+// registers an expression can refer to (index into the 'regs' array passed
+// to expr_eval())
+typedef enum { R_PC, R_A, R_X, R_Y, R_Z, R_B, R_SP, R_COUNT } expr_reg;
+
+typedef enum {
+  OP_CONST,  // push arg
+  OP_REG,    // push regs[arg]
+  OP_MEM,    // pop address, push byte at that address
+  OP_NOT,
+  OP_NEG,
+  OP_CPL,
+  OP_BOOL,   // normalise top of stack to 0/1
+  OP_MUL,
+  OP_ADD,
+  OP_SUB,
+  OP_SHL,
+  OP_SHR,
+  OP_LT,
+  OP_LE,
+  OP_GT,
+  OP_GE,
+  OP_EQ,
+  OP_NE,
+  OP_AND,
+  OP_XOR,
+  OP_OR,
+  OP_JZ,     // if top == 0, jump to arg (keeping top), else pop
+  OP_JNZ     // if top != 0, jump to arg (keeping top), else pop
+} expr_opcode;
+
+typedef struct
+{
+  unsigned char op;
+  int arg;
+} type_expr_insn;
+
+typedef struct
+{
+  type_expr_insn code[EXPR_MAX_CODE];
+  int len;
+} type_expr;
+
+// resolves a symbol name into a value, returns false if unknown
+typedef bool (*expr_lookup_func)(char* sym, int* val);
+
+// reads a byte of target memory (cpu context)
+typedef int (*expr_peek_func)(int addr);
+
+bool expr_compile(type_expr* e, char* text, expr_lookup_func lookup);
+int expr_eval(type_expr* e, int* regs, expr_peek_func peek);
@@ -0,0 +1,256 @@
+/**
+ * gen_optables - generates the disassembler's per-opcode decode tables
+ * (optables.c) from the opcode listings of each cpu personality:
+ *
+ *   gen_optables op4502.txt op6502.txt > optables.c
+ *
+ * Each listing line reads "  <opcode>: <mnemonic> - <mode> [- <cycles>]",
+ * where a '*' ahead of the mnemonic marks an undocumented opcode, and
+ * alternative names can follow after a ';' (the last one is used).
+ *
+ * The listings get checked along the way (every opcode listed once and in
+ * order, every mode known, and the documented 6502 opcodes decoding the
+ * same on the 4502), and any mismatch fails the build.
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "gs4510.h"
+
+typedef struct
+{
+  char name[8];
+  int mode;
+  int cycles;
+  int flags;
+} type_gen_entry;
+
+typedef struct
+{
+  char* text;
+  int mode;
+} type_mode_name;
+
+type_mode_name mode_names[] =
+{
+  { "Implied", M_impl },
+  { "Immediate", M_immnn },
+  { "Immediate.W", M_immnnnn },
+  { "Zero Page", M_nn },
+  { "Zero Page, X", M_nnX },
+  { "Zero Page, Y", M_nnY },
+  { "Absolute", M_nnnn },
+  { "Absolute, X", M_nnnnX },
+  { "Absolute, Y", M_nnnnY },
+  { "(Zero Page, X)", M_InnX },
+  { "(Zero Page), Y", M_InnY },
+  { "(Zero Page), Z", M_InnZ },
+  { "(Zero Page, SP), Y", M_InnSPY },
+  { "(Absolute)", M_Innnn },
+  { "(Absolute, X)", M_InnnnX },
+  { "Relative", M_rr },
+  { "RelativeLong", M_rrrr },
+  { "Zero Page, Relative", M_nnrr },
+  { NULL, 0 }
+};
+
+char* mode_enum_names[] =
+{
+  "M_impl", "M_InnX", "M_nn", "M_immnn", "M_A", "M_nnnn", "M_nnrr", "M_rr",
+  "M_InnY", "M_InnZ", "M_rrrr", "M_nnX", "M_nnnnY", "M_nnnnX", "M_Innnn",
+  "M_InnnnX", "M_InnSPY", "M_nnY", "M_immnnnn", "M_Inn", "M_Inn32", "M_InnZ32"
+};
+
+int mode_len[] = { 1, 2, 2, 2, 1, 3, 3, 2, 2, 2, 3, 2, 3, 3, 3, 3, 2, 2, 3, 2, 2, 2 };
+
+int errors = 0;
+
+void error(char* fname, int lineno, char* msg, char* detail)
+{
+  fprintf(stderr, "%s:%d: %s '%s'\n", fname, lineno, msg, detail);
+  errors++;
+}
+
+char* trim(char* str)
+{
+  while (*str == ' ')
+    str++;
+
+  char* end = str + strlen(str);
+  while (end > str && (end[-1] == ' ' || end[-1] == '\n' || end[-1] == '\r'))
+    *--end = '\0';
+
+  return str;
+}
+
+int lookup_mode(char* text)
+{
+  for (int k = 0; mode_names[k].text != NULL; k++)
+    if (strcmp(mode_names[k].text, text) == 0)
+      return mode_names[k].mode;
+
+  return -1;
+}
+
+int derive_flags(char* name, int mode, bool undoc)
+{
+  int flags = undoc ? OPF_UNDOC : 0;
+
+  if (mode == M_rr || mode == M_rrrr || mode == M_nnrr)
+    flags |= OPF_BRANCH;
+  if (strcmp(name, "BSR") == 0 || strcmp(name, "JSR") == 0)
+    flags = (flags & ~OPF_BRANCH) | OPF_CALL;
+  if (strcmp(name, "JMP") == 0)
+    flags |= OPF_JUMP;
+  if (strcmp(name, "RTS") == 0 || strcmp(name, "RTI") == 0)
+    flags |= OPF_RETURN;
+
+  return flags;
+}
+
+void load_listing(char* fname, type_gen_entry* table)
+{
+  char line[256];
+  int lineno = 0;
+  int expected = 0;
+
+  FILE* f = fopen(fname, "rt");
+  if (f == NULL)
+  {
+    fprintf(stderr, "%s: can't open\n", fname);
+    exit(1);
+  }
+
+  while (fgets(line, sizeof(line), f) != NULL)
+  {
+    lineno++;
+    char* str = trim(line);
+    if (*str == '\0')
+      continue;
+
+    int op;
+    char* colon = strchr(str, ':');
+    if (colon == NULL || sscanf(str, "%X", &op) != 1 || op != expected)
+    {
+      error(fname, lineno, "expected opcode", expected < 256 ? "in sequence" : "end of list");
+      continue;
+    }
+    expected++;
+
+    // use the last of any alternative names
+    char* alt = strrchr(colon + 1, ';');
+    char* def = trim(alt != NULL ? alt + 1 : colon + 1);
+
+    char* sep = strstr(def, " - ");
+    if (sep == NULL)
+    {
+      error(fname, lineno, "missing ' - ' in", def);
+      continue;
+    }
+    *sep = '\0';
+    char* name = trim(def);
+    char* mode = sep + 3;
+    int cycles = 0;
+    char* sep2 = strstr(mode, " - ");
+    if (sep2 != NULL)
+    {
+      *sep2 = '\0';
+      cycles = atoi(sep2 + 3);
+    }
+    mode = trim(mode);
+
+    bool undoc = (*name == '*');
+    if (undoc)
+      name++;
+
+    type_gen_entry* e = &table[op];
+    if (strlen(name) == 0 || strlen(name) > 4)
+      error(fname, lineno, "bad mnemonic", name);
+    strncpy(e->name, name, sizeof(e->name) - 1);
+
+    e->mode = lookup_mode(mode);
+    if (e->mode == -1)
+      error(fname, lineno, "unknown mode", mode);
+
+    // the shifts/rotates on the accumulator are listed as implied
+    if (e->mode == M_impl && (strcmp(name, "ASL") == 0 || strcmp(name, "ROL") == 0 ||
+                              strcmp(name, "LSR") == 0 || strcmp(name, "ROR") == 0))
+      e->mode = M_A;
+
+    e->cycles = cycles;
+    e->flags = derive_flags(name, e->mode, undoc);
+  }
+
+  if (expected != 256)
+    error(fname, lineno, "expected 256 opcodes, listing ends at", "EOF");
+
+  fclose(f);
+}
+
+// the documented 6502 opcodes all carry on unchanged in the 4502
+void check_personalities(type_gen_entry* t4502, type_gen_entry* t6502)
+{
+  char str[64];
+
+  for (int op = 0; op < 256; op++)
+  {
+    if (t6502[op].flags & OPF_UNDOC)
+      continue;
+
+    // the 6502's NOP is the 4502's EOM
+    if (strcmp(t6502[op].name, t4502[op].name) != 0 && !(op == 0xEA && strcmp(t4502[op].name, "EOM") == 0))
+    {
+      sprintf(str, "$%02X: %s vs %s", op, t6502[op].name, t4502[op].name);
+      error("op6502.txt", op + 1, "documented opcode differs from the 4502", str);
+    }
+    else if (t6502[op].mode != t4502[op].mode)
+    {
+      sprintf(str, "$%02X: %s %s vs %s", op, t6502[op].name,
+        mode_enum_names[t6502[op].mode], mode_enum_names[t4502[op].mode]);
+      error("op6502.txt", op + 1, "documented opcode's mode differs from the 4502", str);
+    }
+  }
+}
+
+void emit_table(char* name, type_gen_entry* table)
+{
+  printf("const type_opcode_desc %s[256] __attribute__((aligned(64))) =\n{\n", name);
+  for (int op = 0; op < 256; op++)
+  {
+    type_gen_entry* e = &table[op];
+    printf("  { \"%s\", %s, %d, 0, %d, 0x%02X },%s/* $%02X */\n", e->name, mode_enum_names[e->mode],
+      mode_len[e->mode], e->cycles, e->flags, strlen(e->name) == 3 ? "  " : " ", op);
+  }
+  printf("};\n\n");
+}
+
+int main(int argc, char** argv)
+{
+  static type_gen_entry t4502[256];
+  static type_gen_entry t6502[256];
+
+  if (argc != 3)
+  {
+    fprintf(stderr, "usage: gen_optables <op4502.txt> <op6502.txt>\n");
+    return 1;
+  }
+
+  load_listing(argv[1], t4502);
+  load_listing(argv[2], t6502);
+  check_personalities(t4502, t6502);
+
+  if (errors != 0)
+  {
+    fprintf(stderr, "gen_optables: %d error(s)\n", errors);
+    return 1;
+  }
+
+  printf("// generated by gen_optables from %s and %s - do not edit\n\n", argv[1], argv[2]);
+  printf("#include \"gs4510.h\"\n\n");
+  emit_table("opcode_desc", t4502);
+  emit_table("opcode_desc_6502", t6502);
+
+  return 0;
+}
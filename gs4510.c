@@ -1,45 +1,8 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
 #include "gs4510.h"
 
-char* instruction_lut[] = 
-{
-  // 4502 personality
-    "BRK","ORA","CLE","SEE","TSB","ORA","ASL","RMB","PHP","ORA","ASL","TSY","TSB","ORA","ASL","BBR",
-    "BPL","ORA","ORA","BPL","TRB","ORA","ASL","RMB","CLC","ORA","INC","INZ","TRB","ORA","ASL","BBR",
-    "JSR","AND","JSR","JSR","BIT","AND","ROL","RMB","PLP","AND","ROL","TYS","BIT","AND","ROL","BBR",
-    "BMI","AND","AND","BMI","BIT","AND","ROL","RMB","SEC","AND","DEC","DEZ","BIT","AND","ROL","BBR",
-    "RTI","EOR","NEG","ASR","ASR","EOR","LSR","RMB","PHA","EOR","LSR","TAZ","JMP","EOR","LSR","BBR",
-    "BVC","EOR","EOR","BVC","ASR","EOR","LSR","RMB","CLI","EOR","PHY","TAB","MAP","EOR","LSR","BBR",
-    "RTS","ADC","RTS","BSR","STZ","ADC","ROR","RMB","PLA","ADC","ROR","TZA","JMP","ADC","ROR","BBR",
-    "BVS","ADC","ADC","BVS","STZ","ADC","ROR","RMB","SEI","ADC","PLY","TBA","JMP","ADC","ROR","BBR",
-    "BRA","STA","STA","BRA","STY","STA","STX","SMB","DEY","BIT","TXA","STY","STY","STA","STX","BBS",
-    "BCC","STA","STA","BCC","STY","STA","STX","SMB","TYA","STA","TXS","STX","STZ","STA","STZ","BBS",
-    "LDY","LDA","LDX","LDZ","LDY","LDA","LDX","SMB","TAY","LDA","TAX","LDZ","LDY","LDA","LDX","BBS",
-    "BCS","LDA","LDA","BCS","LDY","LDA","LDX","SMB","CLV","LDA","TSX","LDZ","LDY","LDA","LDX","BBS",
-    "CPY","CMP","CPZ","DEW","CPY","CMP","DEC","SMB","INY","CMP","DEX","ASW","CPY","CMP","DEC","BBS",
-    "BNE","CMP","CMP","BNE","CPZ","CMP","DEC","SMB","CLD","CMP","PHX","PHZ","CPZ","CMP","DEC","BBS",
-    "CPX","SBC","LDA","INW","CPX","SBC","INC","SMB","INX","SBC","EOM","ROW","CPX","SBC","INC","BBS",
-    "BEQ","SBC","SBC","BEQ","PHW","SBC","INC","SMB","SED","SBC","PLX","PLZ","PHW","SBC","INC","BBS",
-
-    // 6502 personality
-    // XXX Currently just a copy of 4502 personality
-    "BRK","ORA","KIL","SLO","NOP","ORA","ASL","SLO","PHP","ORA","ASL","ANC","NOP","ORA","ASL","SLO",
-    "BPL","ORA","KIL","SLO","NOP","ORA","ASL","SLO","CLC","ORA","NOP","SLO","NOP","ORA","ASL","SLO",
-    "JSR","AND","KIL","RLA","BIT","AND","ROL","RLA","PLP","AND","ROL","ANC","BIT","AND","ROL","RLA",
-    "BMI","AND","KIL","RLA","NOP","AND","ROL","RLA","SEC","AND","NOP","RLA","NOP","AND","ROL","RLA",
-    "RTI","EOR","KIL","SRE","NOP","EOR","LSR","SRE","PHA","EOR","LSR","ALR","JMP","EOR","LSR","SRE",
-    "BVC","EOR","KIL","SRE","NOP","EOR","LSR","SRE","CLI","EOR","NOP","SRE","NOP","EOR","LSR","SRE",
-    "RTS","ADC","KIL","RRA","NOP","ADC","ROR","RRA","PLA","ADC","ROR","ARR","JMP","ADC","ROR","RRA",
-    "BVS","ADC","KIL","RRA","NOP","ADC","ROR","RRA","SEI","ADC","NOP","RRA","NOP","ADC","ROR","RRA",
-    "NOP","STA","NOP","SAX","STY","STA","STX","SAX","DEY","NOP","TXA","XAA","STY","STA","STX","SAX",
-    "BCC","STA","KIL","AHX","STY","STA","STX","SAX","TYA","STA","TXS","TAS","SHY","STA","SHX","AHX",
-    "LDY","LDA","LDX","LAX","LDY","LDA","LDX","LAX","TAY","LDA","TAX","LAX","LDY","LDA","LDX","LAX",
-    "BCS","LDA","KIL","LAX","LDY","LDA","LDX","LAX","CLV","LDA","TSX","LAS","LDY","LDA","LDX","LAX",
-    "CPY","CMP","NOP","DCP","CPY","CMP","DEC","DCP","INY","CMP","DEX","AXS","CPY","CMP","DEC","DCP",
-    "BNE","CMP","KIL","DCP","NOP","CMP","DEC","DCP","CLD","CMP","NOP","DCP","NOP","CMP","DEC","DCP",
-    "CPX","SBC","NOP","ISC","CPX","SBC","INC","ISC","INX","SBC","NOP","SBC","CPX","SBC","INC","ISC",
-    "BEQ","SBC","KIL","ISC","NOP","SBC","INC","ISC","SED","SBC","NOP","ISC","NOP","SBC","INC","ISC"
-    };
-
 type_opcode_mode opcode_mode[] =
 {
   { "M_impl", 0 },
@@ -60,79 +23,245 @@ type_opcode_mode opcode_mode[] =
   { "M_InnnnX", 2 },
   { "M_InnSPY", 1 },
   { "M_nnY", 1 },
-  { "M_immnnnn", 2 }
+  { "M_immnnnn", 2 },
+  { "M_Inn", 1 },
+  { "M_Inn32", 1 },
+  { "M_InnZ32", 1 }
 };
 
-mode_list mode_lut[] = 
+// how each addressing mode's operand gets printed
+type_mode_format mode_format[] =
 {
-  // 4502 personality first
-    M_impl,  M_InnX,  M_impl,  M_impl,  M_nn,    M_nn,    M_nn,    M_nn,    
-    M_impl,  M_immnn, M_A,     M_impl,  M_nnnn,  M_nnnn,  M_nnnn,  M_nnrr,  
-    M_rr,    M_InnY,  M_InnZ,  M_rrrr,  M_nn,    M_nnX,   M_nnX,   M_nn,    
-    M_impl,  M_nnnnY, M_impl,  M_impl,  M_nnnn,  M_nnnnX, M_nnnnX, M_nnrr,  
-    M_nnnn,  M_InnX,  M_Innnn, M_InnnnX,M_nn,    M_nn,    M_nn,    M_nn,    
-    M_impl,  M_immnn, M_A,     M_impl,  M_nnnn,  M_nnnn,  M_nnnn,  M_nnrr,  
-    M_rr,    M_InnY,  M_InnZ,  M_rrrr,  M_nnX,   M_nnX,   M_nnX,   M_nn,    
-    M_impl,  M_nnnnY, M_impl,  M_impl,  M_nnnnX, M_nnnnX, M_nnnnX, M_nnrr,  
-    M_impl,  M_InnX,  M_impl,  M_impl,  M_nn,    M_nn,    M_nn,    M_nn,    
-    M_impl,  M_immnn, M_A,     M_impl,  M_nnnn,  M_nnnn,  M_nnnn,  M_nnrr,  
-    M_rr,    M_InnY,  M_InnZ,  M_rrrr,  M_nnX,   M_nnX,   M_nnX,   M_nn,    
-    M_impl,  M_nnnnY, M_impl,  M_impl,  M_impl,  M_nnnnX, M_nnnnX, M_nnrr,
-    // $63 BSR $nnnn is 16-bit relative on the 4502.  We treat it as absolute
-    // mode, with microcode being used to select relative addressing.
-    M_impl,  M_InnX,  M_immnn, M_nnnn,  M_nn,    M_nn,    M_nn,    M_nn,    
-    M_impl,  M_immnn, M_A,     M_impl,  M_Innnn, M_nnnn,  M_nnnn,  M_nnrr,  
-    M_rr,    M_InnY,  M_InnZ,  M_rrrr,  M_nnX,   M_nnX,   M_nnX,   M_nn,    
-    M_impl,  M_nnnnY, M_impl,  M_impl,  M_InnnnX,M_nnnnX, M_nnnnX, M_nnrr,  
-    M_rr,    M_InnX,  M_InnSPY,M_rrrr,  M_nn,    M_nn,    M_nn,    M_nn,    
-    M_impl,  M_immnn, M_impl,  M_nnnnX, M_nnnn,  M_nnnn,  M_nnnn,  M_nnrr,  
-    M_rr,    M_InnY,  M_InnZ,  M_rrrr,  M_nnX,   M_nnX,   M_nnY,   M_nn,    
-    M_impl,  M_nnnnY, M_impl,  M_nnnnY, M_nnnn,  M_nnnnX, M_nnnnX, M_nnrr,  
-    M_immnn, M_InnX,  M_immnn, M_immnn, M_nn,    M_nn,    M_nn,    M_nn,    
-    M_impl,  M_immnn, M_impl,  M_nnnn,  M_nnnn,  M_nnnn,  M_nnnn,  M_nnrr,  
-    M_rr,    M_InnY,  M_InnZ,  M_rrrr,  M_nnX,   M_nnX,   M_nnY,   M_nn,
-    M_impl,  M_nnnnY, M_impl,  M_nnnnX, M_nnnnX, M_nnnnX, M_nnnnY, M_nnrr,  
-    M_immnn, M_InnX,  M_immnn, M_nn,    M_nn,    M_nn,    M_nn,    M_nn,    
-    M_impl,  M_immnn, M_impl,  M_nnnn,  M_nnnn,  M_nnnn,  M_nnnn,  M_nnrr,  
-    M_rr,    M_InnY,  M_InnZ,  M_rrrr,  M_nn,    M_nnX,   M_nnX,   M_nn,
-    M_impl,  M_nnnnY, M_impl,  M_impl,  M_nnnn,  M_nnnnX, M_nnnnX, M_nnrr,  
-    M_immnn, M_InnX,  M_InnSPY,M_nn,    M_nn,    M_nn,    M_nn,    M_nn,    
-    M_impl,  M_immnn, M_impl,  M_nnnn,  M_nnnn,  M_nnnn,  M_nnnn,  M_nnrr,  
-    M_rr,    M_InnY,  M_InnZ,  M_rrrr,  M_immnnnn,M_nnX,   M_nnX,   M_nn,    
-    M_impl,  M_nnnnY, M_impl,  M_impl,  M_nnnn,  M_nnnnX, M_nnnnX, M_nnrr,
-
-    // 6502 personality
-    // XXX currently just a copy of 4502 personality
-    M_impl,M_InnX,M_impl,M_InnX,M_nn,M_nn,M_nn,M_nn,
-    M_impl,M_immnn,M_impl,M_immnn,M_nnnn,M_nnnn,M_nnnn,M_nnnn,
-    M_rr,M_InnY,M_impl,M_InnY,M_nnX,M_nnX,M_nnX,M_nnX,
-    M_impl,M_nnnnY,M_impl,M_nnnnY,M_nnnnX,M_nnnnX,M_nnnnX,M_nnnnX,
-    M_nnnn,M_InnX,M_impl,M_InnX,M_nn,M_nn,M_nn,M_nn,
-    M_impl,M_immnn,M_impl,M_immnn,M_nnnn,M_nnnn,M_nnnn,M_nnnn,
-    M_rr,M_InnY,M_impl,M_InnY,M_nnX,M_nnX,M_nnX,M_nnX,
-    M_impl,M_nnnnY,M_impl,M_nnnnY,M_nnnnX,M_nnnnX,M_nnnnX,M_nnnnX,
-    M_impl,M_InnX,M_impl,M_InnX,M_nn,M_nn,M_nn,M_nn,
-    M_impl,M_immnn,M_impl,M_immnn,M_nnnn,M_nnnn,M_nnnn,M_nnnn,
-    M_rr,M_InnY,M_impl,M_InnY,M_nnX,M_nnX,M_nnX,M_nnX,
-    M_impl,M_nnnnY,M_impl,M_nnnnY,M_nnnnX,M_nnnnX,M_nnnnX,M_nnnnX,
-    M_impl,M_InnX,M_impl,M_InnX,M_nn,M_nn,M_nn,M_nn,
-    M_impl,M_immnn,M_impl,M_immnn,M_Innnn,M_nnnn,M_nnnn,M_nnnn,
-    M_rr,M_InnY,M_impl,M_InnY,M_nnX,M_nnX,M_nnX,M_nnX,
-    M_impl,M_nnnnY,M_impl,M_nnnnY,M_nnnnX,M_nnnnX,M_nnnnX,M_nnnnX,
-    M_immnn,M_InnX,M_immnn,M_InnX,M_nn,M_nn,M_nn,M_nn,
-    M_impl,M_immnn,M_impl,M_immnn,M_nnnn,M_nnnn,M_nnnn,M_nnnn,
-    M_rr,M_InnY,M_impl,M_InnY,M_nnX,M_nnX,M_nnY,M_nnY,
-    M_impl,M_nnnnY,M_impl,M_nnnnY,M_nnnnX,M_nnnnX,M_nnnnY,M_nnnnY,
-    M_immnn,M_InnX,M_immnn,M_InnX,M_nn,M_nn,M_nn,M_nn,
-    M_impl,M_immnn,M_impl,M_immnn,M_nnnn,M_nnnn,M_nnnn,M_nnnn,
-    M_rr,M_InnY,M_impl,M_InnY,M_nnX,M_nnX,M_nnY,M_nnY,
-    M_impl,M_nnnnY,M_impl,M_nnnnY,M_nnnnX,M_nnnnX,M_nnnnY,M_nnnnY,
-    M_immnn,M_InnX,M_immnn,M_InnX,M_nn,M_nn,M_nn,M_nn,
-    M_impl,M_immnn,M_impl,M_immnn,M_nnnn,M_nnnn,M_nnnn,M_nnnn,
-    M_rr,M_InnY,M_impl,M_InnY,M_nnX,M_nnX,M_nnX,M_nnX,
-    M_impl,M_nnnnY,M_impl,M_nnnnY,M_nnnnX,M_nnnnX,M_nnnnX,M_nnnnX,
-    M_immnn,M_InnX,M_immnn,M_InnX,M_nn,M_nn,M_nn,M_nn,
-    M_impl,M_immnn,M_impl,M_immnn,M_nnnn,M_nnnn,M_nnnn,M_nnnn,
-    M_rr,M_InnY,M_impl,M_InnY,M_nnX,M_nnX,M_nnX,M_nnX,
-    M_impl,M_nnnnY,M_impl,M_nnnnY,M_nnnnX,M_nnnnX,M_nnnnX,M_nnnnX
+  { "", OPND_NONE },                // M_impl
+  { " (%s,X)", OPND_ZP },           // M_InnX
+  { " %s", OPND_ZP },               // M_nn
+  { " #$%02X", OPND_IMM8 },         // M_immnn
+  { "", OPND_NONE },                // M_A
+  { " %s", OPND_ABS },              // M_nnnn
+  { " %s,%s", OPND_ZP_REL8 },       // M_nnrr
+  { " %s", OPND_REL8 },             // M_rr
+  { " (%s),Y", OPND_ZP },           // M_InnY
+  { " (%s),Z", OPND_ZP },           // M_InnZ
+  { " %s", OPND_REL16 },            // M_rrrr
+  { " %s,X", OPND_ZP },             // M_nnX
+  { " %s,Y", OPND_ABS },            // M_nnnnY
+  { " %s,X", OPND_ABS },            // M_nnnnX
+  { " (%s)", OPND_ABS },            // M_Innnn
+  { " (%s,X)", OPND_ABS },          // M_InnnnX
+  { " ($%02X,SP),Y", OPND_IMM8 },   // M_InnSPY
+  { " %s,Y", OPND_ZP },             // M_nnY
+  { " #$%04X", OPND_IMM16 },        // M_immnnnn
+  { " (%s)", OPND_ZP },             // M_Inn
+  { " [%s]", OPND_ZP },             // M_Inn32
+  { " [%s],Z", OPND_ZP }            // M_InnZ32
 };
+
+// the plain opcodes' descriptors (opcode_desc[]) are generated into
+// optables.c from op4502.txt. The 45GS02's prefixes each get a table of
+// their own, derived from it:
+//   42 42 (NEG NEG)     = 32-bit quad instructions (on Q = A,X,Y,Z)
+//   EA (EOM)            = (zp),Z uses a 32-bit pointer, written [zp],Z
+//   42 42 EA            = both
+type_opcode_desc opcode_desc_quad[256];
+type_opcode_desc opcode_desc_flat[256];
+type_opcode_desc opcode_desc_quadflat[256];
+
+// the instructions that have a quad version, and their quad mnemonics
+static struct
+{
+  char* name;
+  char* qname;
+  bool rmw;     // read-modify-write (also works on Q itself, and indexed by X)
+} quad_names[] =
+{
+  { "ADC", "ADCQ", false }, { "AND", "ANDQ", false }, { "ASL", "ASLQ", true },
+  { "ASR", "ASRQ", true },  { "BIT", "BITQ", false }, { "CMP", "CPQ", false },
+  { "DEC", "DEQ", true },   { "EOR", "EORQ", false }, { "INC", "INQ", true },
+  { "LDA", "LDQ", false },  { "LSR", "LSRQ", true },  { "ORA", "ORQ", false },
+  { "ROL", "ROLQ", true },  { "ROR", "RORQ", true },  { "SBC", "SBCQ", false },
+  { "STA", "STQ", false },
+  { NULL, NULL, false }
+};
+
+// returns the quad mnemonic of the opcode (NULL = it has no quad version)
+static char* quad_name(int op)
+{
+  for (int k = 0; quad_names[k].name != NULL; k++)
+  {
+    if (strcmp(opcode_desc[op].name, quad_names[k].name) != 0)
+      continue;
+
+    switch (opcode_desc[op].mode)
+    {
+      case M_nn: case M_nnnn: case M_InnZ:
+        return quad_names[k].qname;
+      case M_A: case M_impl: case M_nnX: case M_nnnnX:
+        return quad_names[k].rmw ? quad_names[k].qname : NULL;
+      default:
+        return NULL;
+    }
+  }
+
+  return NULL;
+}
+
+static void set_desc(type_opcode_desc* d, const char* name, int mode, int prefix)
+{
+  strcpy(d->name, name);
+  d->mode = mode;
+  d->len = opcode_mode[mode].val + 1 + prefix;
+  d->prefix = prefix;
+  d->cycles = 0;
+  d->flags = 0;
+}
+
+void init_opcode_desc(void)
+{
+  for (int op = 0; op < 256; op++)
+  {
+    int mode = opcode_desc[op].mode;
+
+    opcode_desc_quad[op].name[0] = '\0';
+    opcode_desc_flat[op].name[0] = '\0';
+    opcode_desc_quadflat[op].name[0] = '\0';
+
+    char* qname = quad_name(op);
+    if (qname != NULL)
+    {
+      set_desc(&opcode_desc_quad[op], qname, mode == M_InnZ ? M_Inn : mode, 2);
+      if (mode == M_InnZ)
+        set_desc(&opcode_desc_quadflat[op], qname, M_Inn32, 3);
+    }
+
+    if (mode == M_InnZ)
+      set_desc(&opcode_desc_flat[op], opcode_desc[op].name, M_InnZ32, 1);
+  }
+}
+
+// finds the descriptor of the instruction in 'b' (DIS_MAX_LEN bytes), minding any prefix
+const type_opcode_desc* decode_opcode(unsigned char* b)
+{
+  if (b[0] == 0x42 && b[1] == 0x42)
+  {
+    if (b[2] == 0xEA && opcode_desc_quadflat[b[3]].name[0] != '\0')
+      return &opcode_desc_quadflat[b[3]];
+    if (opcode_desc_quad[b[2]].name[0] != '\0')
+      return &opcode_desc_quad[b[2]];
+  }
+  else if (b[0] == 0xEA && opcode_desc_flat[b[1]].name[0] != '\0')
+    return &opcode_desc_flat[b[1]];
+
+  return &opcode_desc[b[0]];
+}
+
+dis_symbol_func dis_symbolizer = NULL;
+
+// formats an operand's address, symbolically where possible
+static char* addr_text(char* str, int bank, int addr, int digits, bool exact, dis_symbol_func sym)
+{
+  if (sym == NULL || !sym(bank | addr, exact, str, DIS_SYM_SIZE))
+    sprintf(str, digits == 2 ? "$%02X" : "$%04X", addr);
+
+  return str;
+}
+
+/**
+ * works out the address that an instruction's operand refers to (for
+ * absolute addresses and branch targets, ignoring zero-page operands)
+ *
+ * returns:
+ *   the 16-bit address, or -1 if there's none
+ */
+int operand_address(int addr, unsigned char* b)
+{
+  const type_opcode_desc* d = decode_opcode(b);
+  unsigned char* o = b + d->prefix;
+  int word = o[1] | (o[2] << 8);
+  int pc = addr + d->prefix;
+
+  switch (mode_format[d->mode].operand)
+  {
+    case OPND_ABS:     return word;
+    case OPND_REL8:    return (pc + 2 + (signed char)o[1]) & 0xffff;
+    case OPND_REL16:   return (pc + 2 + word) & 0xffff;
+    case OPND_ZP_REL8: return (pc + 3 + (signed char)o[2]) & 0xffff;
+    default:           return -1;
+  }
+}
+
+// formats the mnemonic and operand of the instruction in 'b' (at 'addr') into 'str'
+static const type_opcode_desc* format_instruction(char* str, int addr, unsigned char* b, dis_symbol_func sym)
+{
+  char a1[DIS_SYM_SIZE], a2[DIS_SYM_SIZE];
+
+  const type_opcode_desc* d = decode_opcode(b);
+  type_mode_format* f = &mode_format[d->mode];
+  unsigned char* o = b + d->prefix;   // the opcode and its operands
+  int word = o[1] | (o[2] << 8);
+  int target = operand_address(addr, b);
+  int bank = addr & ~0xffff;
+
+  int n = sprintf(str, "%s", d->name);
+  switch (f->operand)
+  {
+    case OPND_NONE:  break;
+    case OPND_IMM8:  sprintf(str + n, f->fmt, o[1]); break;
+    case OPND_IMM16: sprintf(str + n, f->fmt, word); break;
+    case OPND_ZP:    sprintf(str + n, f->fmt, addr_text(a1, bank, o[1], 2, true, sym)); break;
+    case OPND_ABS:
+    case OPND_REL8:
+    case OPND_REL16: sprintf(str + n, f->fmt, addr_text(a1, bank, target, 4, false, sym)); break;
+    case OPND_ZP_REL8:
+      sprintf(str + n, f->fmt, addr_text(a1, bank, o[1], 2, true, sym),
+        addr_text(a2, bank, target, 4, false, sym));
+      break;
+  }
+
+  return d;
+}
+
+/**
+ * disassembles the instruction in 'b' (which needs to hold DIS_MAX_LEN
+ * bytes) into 'str', as if it were located at 'addr'.
+ *
+ * returns:
+ *   the length of the instruction in bytes
+ */
+int disassemble_bytes(char* str, int size, int addr, unsigned char* b)
+{
+  char bytes[20];
+  char insn[2*DIS_SYM_SIZE + 24];
+
+  const type_opcode_desc* d = format_instruction(insn, addr, b, dis_symbolizer);
+
+  // the bytes after the first, padded to the width of two
+  int n = 0;
+  for (int k = 1; k < d->len; k++)
+    n += sprintf(bytes + n, "%02X ", b[k]);
+  while (n < 6)
+    bytes[n++] = ' ';
+  bytes[n] = '\0';
+
+  snprintf(str, size, "$%04X  %10s:%d %02X %s%s", addr & 0xffff,
+    opcode_mode[d->mode].name, opcode_mode[d->mode].val, b[0], bytes, insn);
+
+  return d->len;
+}
+
+/**
+ * disassembles the instruction in 'b' into assembler source ("LDA label,X"),
+ * resolving addresses through 'sym' (may be NULL). 'addr' may be a 28-bit
+ * address, whose bank then gets passed on to 'sym' along with the operand.
+ *
+ * returns:
+ *   the length of the instruction in bytes
+ */
+int disassemble_source(char* str, int size, int addr, unsigned char* b, dis_symbol_func sym)
+{
+  char insn[2*DIS_SYM_SIZE + 24];
+
+  const type_opcode_desc* d = format_instruction(insn, addr, b, sym);
+  snprintf(str, size, "%s", insn);
+
+  return d->len;
+}
@@ -1,4 +1,4 @@
-extern char* instruction_lut[];
+#include <stdbool.h>
 
 typedef struct
 {
@@ -25,8 +25,76 @@ typedef enum {
   M_InnnnX,
   M_InnSPY,
   M_nnY,
-  M_immnnnn
+  M_immnnnn,
+  M_Inn,       // (zp) of quad instructions (Z is part of Q)
+  M_Inn32,     // [zp] of quad instructions, 32-bit pointer
+  M_InnZ32     // [zp],Z 32-bit pointer
 } mode_list;
 
-extern mode_list mode_lut[];
 extern type_opcode_mode opcode_mode[];
+
+typedef enum {
+  OPND_NONE,
+  OPND_IMM8,     // #$nn (or a stack offset)
+  OPND_IMM16,    // #$nnnn
+  OPND_ZP,       // zero-page address
+  OPND_ABS,      // absolute address
+  OPND_REL8,     // branch target of an 8-bit offset
+  OPND_REL16,    // branch target of a 16-bit offset
+  OPND_ZP_REL8   // zero-page address, branch target (BBR/BBS)
+} type_operand;
+
+typedef struct
+{
+  char* fmt;           // printf-format of the operand(s) (addresses are passed as %s)
+  type_operand operand;
+} type_mode_format;
+
+#define OPF_BRANCH  0x01   // relative branch (incl. BBR/BBS)
+#define OPF_JUMP    0x02   // JMP
+#define OPF_CALL    0x04   // JSR/BSR
+#define OPF_RETURN  0x08   // RTS/RTI
+#define OPF_UNDOC   0x10   // undocumented opcode
+
+// 16 bytes, so that four of them share a cache line
+typedef struct
+{
+  char name[5];          // mnemonic ("" = not valid after this prefix)
+  unsigned char mode;    // mode_list
+  unsigned char len;     // instruction length in bytes (including any prefix)
+  unsigned char prefix;  // number of prefix bytes ahead of the opcode
+  unsigned char cycles;  // base cycle count (0 = not listed)
+  unsigned char flags;   // OPF_*
+  unsigned char reserved[6];
+} type_opcode_desc;
+
+#define DIS_MAX_LEN 5      // longest instruction (42 42 EA op zp), in bytes
+#define DIS_LINE_SIZE 128  // enough for any disassembled line
+#define DIS_SYM_SIZE 48    // longest symbol+offset shown in an operand (longer ones get cut)
+
+typedef struct
+{
+  int addr;
+  int len;
+  char text[DIS_LINE_SIZE];
+} type_dis_line;
+
+// generated into optables.c (see gen_optables.c)
+extern const type_opcode_desc opcode_desc[];
+extern const type_opcode_desc opcode_desc_6502[];
+
+extern type_opcode_desc opcode_desc_quad[];
+extern type_opcode_desc opcode_desc_flat[];
+extern type_opcode_desc opcode_desc_quadflat[];
+extern type_mode_format mode_format[];
+
+// turns an address into "symbol" or "symbol+$offset" (exact = only an exact
+// match will do). Returns false if there's no suitable symbol.
+typedef bool (*dis_symbol_func)(int addr, bool exact, char* str, int size);
+extern dis_symbol_func dis_symbolizer;
+
+void init_opcode_desc(void);
+const type_opcode_desc* decode_opcode(unsigned char* b);
+int operand_address(int addr, unsigned char* b);
+int disassemble_bytes(char* str, int size, int addr, unsigned char* b);
+int disassemble_source(char* str, int size, int addr, unsigned char* b, dis_symbol_func sym);
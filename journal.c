@@ -0,0 +1,150 @@
+/**
+ * journal.c - a byte ring buffer of variable-sized records, one per stepped
+ * instruction:
+ *   <nwrites> <pc lo> <pc hi> <a> <x> <y> <z> <b> <sp lo> <sp hi> <p>
+ *   (<addr lo> <addr hi> <old value>) * nwrites
+ *   <record size>
+ * where bit 7 of <nwrites> is set if the instruction can't be undone (its
+ * writes aren't all known).
+ * The leading count gives a record's size when evicting the oldest one, and
+ * the trailing size byte allows popping the newest one. When the buffer is
+ * full, the oldest records get dropped.
+ **/
+
+#include <stdlib.h>
+#include "emu.h"
+#include "journal.h"
+
+#define NOT_UNDOABLE 0x80
+#define RECORD_SIZE(n) (12 + 3*((n) & ~NOT_UNDOABLE))
+
+bool journal_enabled = false;
+
+static unsigned char* ring = NULL;
+static int capacity = 0;
+static int head = 0;     // offset of the oldest record
+static int used = 0;     // bytes in use
+static int count = 0;    // records in use
+
+static void put(int offs, int val)
+{
+  ring[offs % capacity] = val & 0xff;
+}
+
+static int get(int offs)
+{
+  return ring[offs % capacity];
+}
+
+void journal_start(int cap)
+{
+  free(ring);
+  capacity = cap;
+  ring = malloc(capacity);
+  journal_clear();
+  journal_enabled = true;
+}
+
+void journal_stop(void)
+{
+  free(ring);
+  ring = NULL;
+  capacity = 0;
+  journal_clear();
+  journal_enabled = false;
+}
+
+void journal_clear(void)
+{
+  head = 0;
+  used = 0;
+  count = 0;
+}
+
+void journal_push(type_cpu_state* regs, type_emu_write* writes, int nwrites, bool undoable)
+{
+  int size = RECORD_SIZE(nwrites);
+
+  if (ring == NULL || size > capacity)
+    return;
+
+  // make room, dropping the oldest records
+  while (capacity - used < size)
+  {
+    int oldest = RECORD_SIZE(get(head));
+    head = (head + oldest) % capacity;
+    used -= oldest;
+    count--;
+  }
+
+  int p = head + used;
+  put(p++, nwrites | (undoable ? 0 : NOT_UNDOABLE));
+  put(p++, regs->pc);
+  put(p++, regs->pc >> 8);
+  put(p++, regs->a);
+  put(p++, regs->x);
+  put(p++, regs->y);
+  put(p++, regs->z);
+  put(p++, regs->b);
+  put(p++, regs->sp);
+  put(p++, regs->sp >> 8);
+  put(p++, regs->p);
+  for (int k = 0; k < nwrites; k++)
+  {
+    put(p++, writes[k].addr);
+    put(p++, writes[k].addr >> 8);
+    put(p++, writes[k].old);
+  }
+  put(p++, size);
+
+  used += size;
+  count++;
+}
+
+// removes the newest record
+bool journal_pop(type_journal_entry* e)
+{
+  if (count == 0)
+    return false;
+
+  int size = get(head + used - 1);
+  int p = head + used - size;
+
+  e->nwrites = get(p) & ~NOT_UNDOABLE;
+  e->undoable = !(get(p++) & NOT_UNDOABLE);
+  e->regs.pc = get(p) | (get(p+1) << 8);
+  p += 2;
+  e->regs.a = get(p++);
+  e->regs.x = get(p++);
+  e->regs.y = get(p++);
+  e->regs.z = get(p++);
+  e->regs.b = get(p++);
+  e->regs.sp = get(p) | (get(p+1) << 8);
+  p += 2;
+  e->regs.p = get(p++);
+  for (int k = 0; k < e->nwrites; k++)
+  {
+    e->writes[k].addr = get(p) | (get(p+1) << 8);
+    e->writes[k].old = get(p+2);
+    p += 3;
+  }
+
+  used -= size;
+  count--;
+  return true;
+}
+
+int journal_count(void)
+{
+  return count;
+}
+
+int journal_bytes(void)
+{
+  return used;
+}
+
+int journal_capacity(void)
+{
+  return capacity;
+}
@@ -0,0 +1,27 @@
+/**
+ * journal.h - ring buffer of the cpu state and overwritten memory bytes of
+ * each stepped instruction, for stepping backwards
+ */
+
+#include <stdbool.h>
+
+#define JOURNAL_DEFAULT_KB 1024
+
+typedef struct
+{
+  type_cpu_state regs;   // registers before the instruction executed
+  int nwrites;
+  type_emu_write writes[EMU_MAX_WRITES];  // the bytes it overwrote (old values)
+  bool undoable;         // (false if it may have written other bytes too, e.g. I/O or a quad store)
+} type_journal_entry;
+
+extern bool journal_enabled;
+
+void journal_start(int capacity);
+void journal_stop(void);
+void journal_clear(void);
+void journal_push(type_cpu_state* regs, type_emu_write* writes, int nwrites, bool undoable);
+bool journal_pop(type_journal_entry* e);
+int journal_count(void);
+int journal_bytes(void);
+int journal_capacity(void);
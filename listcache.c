@@ -0,0 +1,164 @@
+/**
+ * listcache.c - writes and maps the binary cache of the parsed .list/.map
+ * data. The cache is only valid for the exact same source files (names,
+ * sizes and modification times), which the caller sums up as a key string.
+ *
+ * File layout (all in host byte order, 4-byte aligned):
+ *   header : "M65C" <version> <key hash> <key length> <lines> <symbols>
+ *            <hash size> <strings size>
+ *   key    : the key string (padded to 4 bytes)
+ *   lines  : <addr> <file string> <lineno> <.list file> per line
+ *   syms   : <addr> <symbol string> <sval string> <.list file> per symbol
+ *   names  : symbol indices in name order
+ *   hash   : the symbol hash table
+ *   strings
+ **/
+
+#define _BSD_SOURCE _BSD_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "arena.h"
+#include "listcache.h"
+
+#define CACHE_VERSION 2
+#define HEADER_WORDS 8
+#define ALIGN4(n) (((n) + 3) & ~3)
+
+// checks that the cache's string offsets and symbol indices all stay within it, and
+// that its lines and symbols come from one of the 'nlists' .list files
+static bool cache_valid(type_list_cache* c, int nlists)
+{
+  if (c->nlines < 0 || c->nsyms < 0 || c->strsize < 0)
+    return false;
+  if (c->strsize > 0 && c->strings[c->strsize - 1] != '\0')
+    return false;
+  // (a power of two, with room to spare, or lookups would never end)
+  if (c->hashsize <= c->nsyms || (c->hashsize & (c->hashsize - 1)) != 0)
+    return false;
+
+  for (int k = 0; k < c->nlines; k++)
+    if (c->lines[k].file >= (unsigned int)c->strsize || c->lines[k].list < 0 || c->lines[k].list >= nlists)
+      return false;
+  for (int k = 0; k < c->nsyms; k++)
+  {
+    if (c->syms[k].symbol >= (unsigned int)c->strsize || c->syms[k].sval >= (unsigned int)c->strsize)
+      return false;
+    if (c->syms[k].list < 0 || c->syms[k].list >= nlists)
+      return false;
+    if (c->names[k] < 0 || c->names[k] >= c->nsyms)
+      return false;
+  }
+  for (int k = 0; k < c->hashsize; k++)
+    if (c->hash[k] < -1 || c->hash[k] >= c->nsyms)
+      return false;
+
+  return true;
+}
+
+/**
+ * maps the cache file, if it was written for the given key and everything
+ * in it points within it or at one of the 'nlists' .list files (the arrays
+ * then point straight into the mapping)
+ *
+ * returns:
+ *   false if there's no (valid) cache for the key
+ */
+bool cache_open(type_list_cache* c, char* fname, char* key, int keylen, int nlists)
+{
+  struct stat st;
+
+  memset(c, 0, sizeof(type_list_cache));
+
+  int fd = open(fname, O_RDONLY);
+  if (fd < 0)
+    return false;
+  if (fstat(fd, &st) != 0 || st.st_size < HEADER_WORDS * 4)
+  {
+    close(fd);
+    return false;
+  }
+
+  char* p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED)
+    return false;
+
+  unsigned int* hdr = (unsigned int*)p;
+  long size = ALIGN4(hdr[3]) + hdr[4] * sizeof(type_cache_line) + hdr[5] * (sizeof(type_cache_sym) + sizeof(int)) +
+              (long)hdr[6] * sizeof(int) + hdr[7];
+  if (memcmp(p, "M65C", 4) != 0 || hdr[1] != CACHE_VERSION || hdr[2] != hash_bytes(key, keylen) ||
+      hdr[3] != (unsigned int)keylen || HEADER_WORDS * 4 + size != st.st_size ||
+      memcmp(p + HEADER_WORDS * 4, key, keylen) != 0)
+  {
+    munmap(p, st.st_size);
+    return false;
+  }
+
+  c->map = p;
+  c->mapsize = st.st_size;
+  c->nlines = hdr[4];
+  c->nsyms = hdr[5];
+  c->hashsize = hdr[6];
+  c->strsize = hdr[7];
+
+  p += HEADER_WORDS * 4 + ALIGN4(keylen);
+  c->lines = (type_cache_line*)p;
+  p += c->nlines * sizeof(type_cache_line);
+  c->syms = (type_cache_sym*)p;
+  p += c->nsyms * sizeof(type_cache_sym);
+  c->names = (int*)p;
+  p += c->nsyms * sizeof(int);
+  c->hash = (int*)p;
+  p += c->hashsize * sizeof(int);
+  c->strings = p;
+
+  if (!cache_valid(c, nlists))
+  {
+    cache_close(c);
+    return false;
+  }
+  return true;
+}
+
+void cache_close(type_list_cache* c)
+{
+  if (c->map != NULL)
+    munmap(c->map, c->mapsize);
+  memset(c, 0, sizeof(type_list_cache));
+}
+
+// writes the cache (via a temporary file, so that readers never see half of one)
+bool cache_write(type_list_cache* c, char* fname, char* key, int keylen)
+{
+  char tmpname[1024];
+  unsigned int hdr[HEADER_WORDS] = { 0, CACHE_VERSION, hash_bytes(key, keylen), keylen,
+    c->nlines, c->nsyms, c->hashsize, c->strsize };
+  static const char pad[4] = { 0 };
+
+  memcpy(hdr, "M65C", 4);
+  snprintf(tmpname, sizeof(tmpname), "%s.tmp", fname);
+  FILE* f = fopen(tmpname, "wb");
+  if (f == NULL)
+    return false;
+
+  fwrite(hdr, sizeof(hdr), 1, f);
+  fwrite(key, 1, keylen, f);
+  fwrite(pad, 1, ALIGN4(keylen) - keylen, f);
+  fwrite(c->lines, sizeof(type_cache_line), c->nlines, f);
+  fwrite(c->syms, sizeof(type_cache_sym), c->nsyms, f);
+  fwrite(c->names, sizeof(int), c->nsyms, f);
+  fwrite(c->hash, sizeof(int), c->hashsize, f);
+  fwrite(c->strings, 1, c->strsize, f);
+
+  if (fclose(f) != 0 || rename(tmpname, fname) != 0)
+  {
+    unlink(tmpname);
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,41 @@
+/**
+ * listcache.h - binary cache of the parsed .list/.map data, mmapped on startup
+ */
+
+#include <stdbool.h>
+
+// (strings are offsets into 'strings')
+typedef struct
+{
+  int addr;
+  unsigned int file;
+  int lineno;
+  int list;       // which .list file it came from
+} type_cache_line;
+
+typedef struct
+{
+  int addr;
+  unsigned int symbol;
+  unsigned int sval;
+  int list;       // which .list file its .map file goes with
+} type_cache_sym;
+
+typedef struct
+{
+  type_cache_line* lines;   // sorted by address
+  int nlines;
+  type_cache_sym* syms;     // sorted by address
+  int nsyms;
+  int* names;               // symbol indices in name order
+  int* hash;                // hash table of symbol indices (-1 = empty)
+  int hashsize;
+  char* strings;
+  int strsize;
+  void* map;                // the mapping (when opened)
+  long mapsize;
+} type_list_cache;
+
+bool cache_open(type_list_cache* c, char* fname, char* key, int keylen, int nlists);
+void cache_close(type_list_cache* c);
+bool cache_write(type_list_cache* c, char* fname, char* key, int keylen);
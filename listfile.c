@@ -0,0 +1,834 @@
+/**
+ * listfile.c - parses the assemblers' debug-info files (and the symbol file
+ * next to each) straight out of their mmapped contents, spreading the files
+ * over a pool of threads. Each format's parser streams through the file
+ * (ca65's twice), and the results stay in per-file arrays (pointing into the
+ * mappings), for the caller to merge into its indexes in a fixed order.
+ *
+ * Ophis .list lines look like:  "0803  20 0A 08  |  jsr sub   | test.a65:5"
+ * Ophis .map lines look like:   "$080A sub"
+ *
+ * ca65 .dbg files (ld65 --dbgfile) have a record per line, e.g.
+ *   file  id=0,name="test.s",size=120,mtime=0x5F000000,mod=0
+ *   line  id=4,file=0,line=5,span=2
+ *   seg   id=0,name="CODE",start=0x000801,size=0x0010,addrsize=absolute,...
+ *   span  id=2,seg=0,start=2,size=3
+ *   sym   id=1,name="sub",addrsize=absolute,scope=0,def=7,val=0x80A,seg=0,type=lab
+ * where a line's address is the start of its spans (the offset into their
+ * segment, plus where the segment starts).
+ *
+ * KickAssembler .dbg files (-debugdump) are XML, with a row of values (in
+ * the order the values="..." attribute gives) per line:
+ *   <Sources values="INDEX,FILE">                 0,/home/me/test.asm
+ *   <Segment values="START,END,FILE_IDX,LINE1,..."> then in each <Block>:
+ *                                                 $0803,$0805,0,5,1,5,8
+ *   <Labels values="SEGMENT,ADDRESS,NAME,...">     Default,$080a,sub,...
+ *
+ * ACME reports (--report) look like:
+ *   "; ******** Source: test.a"
+ *   "     5  0803 200a08              jsr sub"
+ * with the symbols alongside, either ACME's own list (-l) with lines like
+ * "sub = $80a", or VICE labels (ACME's --vicelabels, KickAssembler's .vs)
+ * like "al C:080a .sub".
+ **/
+
+#define _BSD_SOURCE _BSD_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "listfile.h"
+
+static type_list_file* jobs;
+static int job_count;
+static int next_job;
+static pthread_mutex_t job_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t parse_lock = PTHREAD_MUTEX_INITIALIZER;  // (the file watcher parses too)
+
+/**
+ * maps the file, or reads it into a malloc'd buffer if 'read_in' is set.
+ * (A file that gets truncated while it's mapped makes the parse die of
+ * SIGBUS, so files that may still be being written get read in.)
+ *
+ * returns:
+ *   false if the file can't be opened
+ */
+static bool map_file(type_mapped_file* m, char* fname, bool read_in)
+{
+  struct stat st;
+
+  m->data = NULL;
+  m->size = 0;
+  m->heap = read_in;
+
+  int fd = open(fname, O_RDONLY);
+  if (fd < 0)
+    return false;
+
+  if (fstat(fd, &st) == 0 && st.st_size > 0)
+  {
+    if (read_in)
+    {
+      // (takes whatever is there, if the file shrinks meanwhile)
+      m->data = malloc(st.st_size);
+      long n;
+      while (m->data != NULL && m->size < st.st_size &&
+             (n = read(fd, m->data + m->size, st.st_size - m->size)) > 0)
+        m->size += n;
+    }
+    else
+    {
+      m->data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (m->data == MAP_FAILED)
+        m->data = NULL;
+      else
+      {
+        m->size = st.st_size;
+        madvise(m->data, m->size, MADV_SEQUENTIAL);
+      }
+    }
+  }
+  close(fd);
+
+  return true;
+}
+
+static int hex_digit(char c)
+{
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  return -1;
+}
+
+// parses hex digits at *p (advancing it), returning -1 if there are none
+static int scan_hex(const char** p, const char* end)
+{
+  int val = -1;
+
+  for (int d; *p < end && (d = hex_digit(**p)) >= 0; (*p)++)
+    val = (val < 0 ? 0 : val << 4) | d;
+  return val;
+}
+
+static const char* skip_blanks(const char* p, const char* end)
+{
+  while (p < end && (*p == ' ' || *p == '\t'))
+    p++;
+  return p;
+}
+
+// parses decimal digits at *p (advancing it), returning -1 if there are none
+static int scan_dec(const char** p, const char* end)
+{
+  int val = -1;
+
+  for (; *p < end && **p >= '0' && **p <= '9'; (*p)++)
+    val = (val < 0 ? 0 : val * 10) + (**p - '0');
+  return val;
+}
+
+// parses a whole "$hex", "0xhex" or decimal number, returning -1 if it isn't one (or doesn't fit)
+static int parse_number(const char* s, int len)
+{
+  const char* end = s + len;
+  const char* p = s;
+  int val;
+
+  if (p < end && *p == '$')
+    p++;
+  else if (len > 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X'))
+    p += 2;
+  else
+  {
+    val = scan_dec(&p, end);
+    return p == end && len <= 9 ? val : -1;
+  }
+
+  const char* digits = p;
+  val = scan_hex(&p, end);
+  return p == end && p - digits <= 7 ? val : -1;
+}
+
+static bool is(const char* s, int len, const char* word)
+{
+  return len == (int)strlen(word) && memcmp(s, word, len) == 0;
+}
+
+// the end of the line at p (leaving out a '\r'), and where the next one starts
+static const char* line_end(const char* p, const char* end, const char** next)
+{
+  const char* eol = memchr(p, '\n', end - p);
+  if (eol == NULL)
+    eol = end;
+
+  *next = eol + 1;
+  if (eol > p && eol[-1] == '\r')
+    eol--;
+  return eol;
+}
+
+static void add_line(type_list_file* f, int* size, int addr, int lineno, const char* file, int filelen)
+{
+  if (f->nlines == *size)
+  {
+    *size = *size ? *size * 2 : 1024;
+    f->lines = realloc(f->lines, *size * sizeof(type_list_line));
+  }
+
+  type_list_line* l = &f->lines[f->nlines++];
+  l->addr = addr;
+  l->lineno = lineno;
+  l->file = file;
+  l->filelen = filelen;
+}
+
+static void add_sym(type_list_file* f, int* size, int addr, const char* sym, int symlen)
+{
+  if (f->nsyms == *size)
+  {
+    *size = *size ? *size * 2 : 256;
+    f->syms = realloc(f->syms, *size * sizeof(type_map_line));
+  }
+
+  type_map_line* m = &f->syms[f->nsyms++];
+  m->addr = addr;
+  m->sym = sym;
+  m->symlen = symlen;
+  m->sval = NULL;
+  m->svallen = 0;
+}
+
+static void parse_list(type_list_file* f)
+{
+  const char* p = f->list.data;
+  const char* end = p + f->list.size;
+  int size = 0;
+
+  while (p < end)
+  {
+    const char* eol = memchr(p, '\n', end - p);
+    if (eol == NULL)
+      eol = end;
+
+    // the file:line reference follows the line's last '|'
+    const char* bar = eol;
+    while (bar > p && bar[-1] != '|')
+      bar--;
+
+    if (bar > p && eol - bar >= 4)
+    {
+      type_list_line l;
+      const char* q = p;
+
+      q = skip_blanks(q, eol);
+      l.addr = scan_hex(&q, eol);
+
+      l.file = skip_blanks(bar, eol);
+      const char* colon = memchr(l.file, ':', eol - l.file);
+      if (l.addr >= 0 && colon != NULL && colon > l.file && colon + 1 < eol &&
+          colon[1] >= '0' && colon[1] <= '9')
+      {
+        q = colon + 1;
+        add_line(f, &size, l.addr, scan_dec(&q, eol), l.file, colon - l.file);
+      }
+    }
+
+    p = eol + 1;
+  }
+}
+
+static void parse_map(type_list_file* f)
+{
+  const char* p = f->map.data;
+  const char* end = p + f->map.size;
+  int size = 0;
+
+  while (p < end)
+  {
+    const char* eol = memchr(p, '\n', end - p);
+    if (eol == NULL)
+      eol = end;
+
+    const char* q = skip_blanks(p, eol);
+    type_map_line m;
+    m.sval = q;
+    if (q < eol && *q == '$')
+    {
+      q++;
+      m.addr = scan_hex(&q, eol);
+      m.svallen = q - m.sval;
+      m.sym = skip_blanks(q, eol);
+      for (q = m.sym; q < eol && *q != ' ' && *q != '\t' && *q != '\r'; q++)
+        ;
+      m.symlen = q - m.sym;
+
+      if (m.addr >= 0 && m.symlen > 0)
+      {
+        add_sym(f, &size, m.addr, m.sym, m.symlen);
+        f->syms[f->nsyms - 1].sval = m.sval;
+        f->syms[f->nsyms - 1].svallen = m.svallen;
+      }
+    }
+
+    p = eol + 1;
+  }
+}
+
+// an entry of one of a ca65 .dbg file's tables, found by its id
+typedef struct
+{
+  bool set;
+  const char* name;   // (a file's)
+  int namelen;
+  int seg;            // (a span's)
+  int start;          // (a segment's address, or a span's offset into its segment)
+} type_dbg_entry;
+
+typedef struct
+{
+  type_dbg_entry* entries;
+  int size;
+} type_dbg_table;
+
+#define DBG_MAX_ID 0xffffff
+
+// the entry for an id, with the table grown to fit it (NULL if the id's no good)
+static type_dbg_entry* dbg_entry(type_dbg_table* t, int id)
+{
+  if (id < 0 || id > DBG_MAX_ID)
+    return NULL;
+
+  if (id >= t->size)
+  {
+    int size = id + 1 > t->size * 2 ? id + 1 : t->size * 2;
+    t->entries = realloc(t->entries, size * sizeof(type_dbg_entry));
+    memset(t->entries + t->size, 0, (size - t->size) * sizeof(type_dbg_entry));
+    t->size = size;
+  }
+  t->entries[id].set = true;
+  return &t->entries[id];
+}
+
+// the entry for an id (NULL if there's none)
+static type_dbg_entry* dbg_lookup(type_dbg_table* t, int id)
+{
+  return id >= 0 && id < t->size && t->entries[id].set ? &t->entries[id] : NULL;
+}
+
+// the next key=value field of a ca65 .dbg record (a quoted value comes without its quotes)
+static bool next_field(const char** p, const char* eol, const char** key, int* keylen, const char** val, int* vallen)
+{
+  const char* q = *p;
+  if (q >= eol)
+    return false;
+
+  *key = q;
+  while (q < eol && *q != '=' && *q != ',')
+    q++;
+  *keylen = q - *key;
+  if (q < eol && *q == '=')
+    q++;
+
+  if (q < eol && *q == '"')
+  {
+    *val = ++q;
+    while (q < eol && *q != '"')
+      q++;
+    *vallen = q - *val;
+    if (q < eol)
+      q++;
+  }
+  else
+  {
+    *val = q;
+    while (q < eol && *q != ',')
+      q++;
+    *vallen = q - *val;
+  }
+
+  *p = q < eol ? q + 1 : q;
+  return true;
+}
+
+static void parse_ca65(type_list_file* f)
+{
+  const char* end = f->list.data + f->list.size;
+  type_dbg_table files = { 0 }, segs = { 0 }, spans = { 0 };
+  int lsize = 0, ssize = 0;
+
+  // (the lines come before the segments and spans that place them, so they get a pass of their own)
+  for (int pass = 0; pass < 2; pass++)
+  {
+    const char* next;
+    for (const char* p = f->list.data; p < end; p = next)
+    {
+      const char* eol = line_end(p, end, &next);
+      const char* q = p;
+      while (q < eol && *q != ' ' && *q != '\t')
+        q++;
+      const char* rec = p;
+      int reclen = q - p;
+
+      if (pass == 0 ? !is(rec, reclen, "file") && !is(rec, reclen, "seg") &&
+                      !is(rec, reclen, "span") && !is(rec, reclen, "sym")
+                    : !is(rec, reclen, "line"))
+        continue;
+
+      int id = -1, file = -1, seg = -1, start = -1, lineno = -1, val = -1;
+      const char* name = NULL;
+      const char* type = "";
+      const char* spanlist = "";
+      int namelen = 0, typelen = 0, spanlen = 0;
+      const char *key, *v;
+      int keylen, vlen;
+
+      q = skip_blanks(q, eol);
+      while (next_field(&q, eol, &key, &keylen, &v, &vlen))
+      {
+        if (is(key, keylen, "id"))
+          id = parse_number(v, vlen);
+        else if (is(key, keylen, "name"))
+        {
+          name = v;
+          namelen = vlen;
+        }
+        else if (is(key, keylen, "file"))
+          file = parse_number(v, vlen);
+        else if (is(key, keylen, "seg"))
+          seg = parse_number(v, vlen);
+        else if (is(key, keylen, "start"))
+          start = parse_number(v, vlen);
+        else if (is(key, keylen, "line"))
+          lineno = parse_number(v, vlen);
+        else if (is(key, keylen, "val"))
+          val = parse_number(v, vlen);
+        else if (is(key, keylen, "type"))
+        {
+          type = v;
+          typelen = vlen;
+        }
+        else if (is(key, keylen, "span"))
+        {
+          spanlist = v;
+          spanlen = vlen;
+        }
+      }
+
+      type_dbg_entry* e;
+      if (is(rec, reclen, "file") && name != NULL && (e = dbg_entry(&files, id)) != NULL)
+      {
+        e->name = name;
+        e->namelen = namelen;
+      }
+      else if (is(rec, reclen, "seg") && start >= 0 && (e = dbg_entry(&segs, id)) != NULL)
+        e->start = start;
+      else if (is(rec, reclen, "span") && start >= 0 && (e = dbg_entry(&spans, id)) != NULL)
+      {
+        e->seg = seg;
+        e->start = start;
+      }
+      else if (is(rec, reclen, "sym"))
+      {
+        // (an imported symbol has no value here, its export has)
+        if (name != NULL && val >= 0 && !is(type, typelen, "imp"))
+          add_sym(f, &ssize, val, name, namelen);
+      }
+      else if (is(rec, reclen, "line") && !is(type, typelen, "2") &&
+               (e = dbg_lookup(&files, file)) != NULL)
+      {
+        // (a macro's lines (type 2) are left out, for the line it got used on to show up instead)
+        const char* s = spanlist;
+        const char* send = spanlist + spanlen;
+        while (s < send)
+        {
+          const char* plus = memchr(s, '+', send - s);
+          if (plus == NULL)
+            plus = send;
+
+          type_dbg_entry* span = dbg_lookup(&spans, parse_number(s, plus - s));
+          type_dbg_entry* sg = span != NULL ? dbg_lookup(&segs, span->seg) : NULL;
+          if (sg != NULL)
+            add_line(f, &lsize, sg->start + span->start, lineno, e->name, e->namelen);
+          s = plus + 1;
+        }
+      }
+    }
+  }
+
+  free(files.entries);
+  free(segs.entries);
+  free(spans.entries);
+}
+
+#define KICK_MAX_COLUMNS 16
+
+static bool starts_with(const char* p, const char* eol, const char* word)
+{
+  int len = strlen(word);
+  return eol - p >= len && memcmp(p, word, len) == 0;
+}
+
+// where a column comes in a tag's values="..." list (-1 if it isn't there)
+static int column_of(const char* tag, const char* eol, const char* name)
+{
+  const char* p = tag;
+  while (p < eol && !starts_with(p, eol, "values=\""))
+    p++;
+  if (p == eol)
+    return -1;
+
+  p += 8;
+  for (int col = 0; p < eol && *p != '"'; col++)
+  {
+    const char* q = p;
+    while (q < eol && *q != ',' && *q != '"')
+      q++;
+    if (is(p, q - p, name))
+      return col;
+    p = q < eol && *q == ',' ? q + 1 : q;
+  }
+  return -1;
+}
+
+// the number in a column of a row (-1 if it's missing)
+static int column_number(int col, const char** cols, int* lens, int ncols)
+{
+  return col >= 0 && col < ncols ? parse_number(cols[col], lens[col]) : -1;
+}
+
+static void parse_kickass(type_list_file* f)
+{
+  const char* end = f->list.data + f->list.size;
+  type_dbg_table sources = { 0 };
+  int lsize = 0, ssize = 0;
+  enum { OTHER, SOURCES, BLOCK, LABELS } section = OTHER;
+  int index_col = -1, file_col = -1;
+  int start_col = -1, fileidx_col = -1, line_col = -1;
+  int addr_col = -1, name_col = -1;
+
+  const char* next;
+  for (const char* p = f->list.data; p < end; p = next)
+  {
+    const char* eol = line_end(p, end, &next);
+    const char* q = skip_blanks(p, eol);
+    if (q == eol)
+      continue;
+
+    if (*q == '<')
+    {
+      section = OTHER;
+      if (starts_with(q, eol, "<Sources"))
+      {
+        section = SOURCES;
+        index_col = column_of(q, eol, "INDEX");
+        file_col = column_of(q, eol, "FILE");
+      }
+      else if (starts_with(q, eol, "<Segment"))
+      {
+        start_col = column_of(q, eol, "START");
+        fileidx_col = column_of(q, eol, "FILE_IDX");
+        line_col = column_of(q, eol, "LINE1");
+      }
+      else if (starts_with(q, eol, "<Block"))
+        section = BLOCK;
+      else if (starts_with(q, eol, "<Labels"))
+      {
+        section = LABELS;
+        addr_col = column_of(q, eol, "ADDRESS");
+        name_col = column_of(q, eol, "NAME");
+      }
+      continue;
+    }
+
+    const char* cols[KICK_MAX_COLUMNS];
+    int lens[KICK_MAX_COLUMNS];
+    int ncols = 0;
+    while (ncols < KICK_MAX_COLUMNS)
+    {
+      const char* comma = memchr(q, ',', eol - q);
+      cols[ncols] = q;
+      lens[ncols++] = (comma != NULL ? comma : eol) - q;
+      if (comma == NULL)
+        break;
+      q = comma + 1;
+    }
+
+    type_dbg_entry* e;
+    if (section == SOURCES && file_col >= 0 && file_col < ncols &&
+        (e = dbg_entry(&sources, column_number(index_col, cols, lens, ncols))) != NULL)
+    {
+      e->name = cols[file_col];
+      e->namelen = lens[file_col];
+    }
+    else if (section == BLOCK)
+    {
+      int addr = column_number(start_col, cols, lens, ncols);
+      int lineno = column_number(line_col, cols, lens, ncols);
+      e = dbg_lookup(&sources, column_number(fileidx_col, cols, lens, ncols));
+      if (addr >= 0 && lineno >= 0 && e != NULL)
+        add_line(f, &lsize, addr, lineno, e->name, e->namelen);
+    }
+    else if (section == LABELS && name_col >= 0 && name_col < ncols)
+    {
+      int addr = column_number(addr_col, cols, lens, ncols);
+      if (addr >= 0 && lens[name_col] > 0)
+        add_sym(f, &ssize, addr, cols[name_col], lens[name_col]);
+    }
+  }
+
+  free(sources.entries);
+}
+
+// ld65's and KickAssembler's .dbg files share the extension, but KickAssembler's are XML
+static void parse_dbg(type_list_file* f)
+{
+  const char* p = f->list.data;
+  const char* end = p + f->list.size;
+
+  while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n'))
+    p++;
+  if (p < end && *p == '<')
+    parse_kickass(f);
+  else
+    parse_ca65(f);
+}
+
+static void parse_report(type_list_file* f)
+{
+  static const char source[] = "; ******** Source: ";
+  const char* end = f->list.data + f->list.size;
+  const char* file = NULL;
+  int filelen = 0;
+  int size = 0;
+
+  const char* next;
+  for (const char* p = f->list.data; p < end; p = next)
+  {
+    const char* eol = line_end(p, end, &next);
+
+    if (starts_with(p, eol, source))
+    {
+      file = p + sizeof(source) - 1;
+      for (filelen = eol - file; filelen > 0 && (file[filelen - 1] == ' ' || file[filelen - 1] == '\t'); filelen--)
+        ;
+      continue;
+    }
+
+    // (the address has its own column, two blanks after the line number, left blank if the line made no code)
+    const char* q = skip_blanks(p, eol);
+    int lineno = scan_dec(&q, eol);
+    if (file == NULL || lineno < 0 || eol - q < 3 || q[0] != ' ' || q[1] != ' ')
+      continue;
+
+    q += 2;
+    int addr = scan_hex(&q, eol);
+    if (addr >= 0 && q < eol && *q == ' ')
+      add_line(f, &size, addr, lineno, file, filelen);
+  }
+}
+
+static void parse_labels(type_list_file* f)
+{
+  const char* end = f->map.data + f->map.size;
+  int size = 0;
+
+  const char* next;
+  for (const char* p = f->map.data; p < end; p = next)
+  {
+    const char* eol = line_end(p, end, &next);
+    const char* q = skip_blanks(p, eol);
+    const char* sym;
+    int addr;
+
+    if (starts_with(q, eol, "al "))
+    {
+      // VICE: "al C:080a .sub"
+      q = skip_blanks(q + 3, eol);
+      if (eol - q > 2 && q[1] == ':')
+        q += 2;
+      addr = scan_hex(&q, eol);
+      q = skip_blanks(q, eol);
+      if (q < eol && *q == '.')
+        q++;
+      for (sym = q; q < eol && *q != ' ' && *q != '\t'; q++)
+        ;
+    }
+    else
+    {
+      // ACME: "sub = $80a" (with a "; ?" comment after it if it never got used)
+      if (q == eol || *q == ';')
+        continue;
+      for (sym = q; q < eol && *q != ' ' && *q != '\t' && *q != '='; q++)
+        ;
+      const char* v = skip_blanks(q, eol);
+      if (v == eol || *v != '=')
+        continue;
+      v = skip_blanks(v + 1, eol);
+      const char* vend = v;
+      while (vend < eol && *vend != ' ' && *vend != '\t' && *vend != ';')
+        vend++;
+      addr = parse_number(v, vend - v);
+    }
+
+    if (addr >= 0 && q > sym)
+      add_sym(f, &size, addr, sym, q - sym);
+  }
+}
+
+typedef struct
+{
+  const char* ext;           // the debug-info file's extension
+  const char* map_exts[4];   // the symbol files to look for next to it (the first one there gets read)
+  void (*parse_list)(type_list_file* f);
+  void (*parse_map)(type_list_file* f);
+} type_list_format;
+
+static const type_list_format formats[] =
+{
+  { ".list", { ".map" }, parse_list, parse_map },                      // Ophis
+  { ".dbg", { NULL }, parse_dbg, NULL },                              // ld65 --dbgfile, KickAssembler -debugdump
+  { ".rep", { ".sym", ".lbl", ".vs" }, parse_report, parse_labels },  // ACME --report, with -l or --vicelabels
+};
+
+#define NFORMATS (int)(sizeof(formats) / sizeof(formats[0]))
+
+// the format of a file, going by its extension (-1 if it's none of them)
+static int format_of(const char* name)
+{
+  const char* ext = strrchr(name, '.');
+
+  for (int k = 0; ext != NULL && k < NFORMATS; k++)
+    if (strcmp(ext, formats[k].ext) == 0)
+      return k;
+  return -1;
+}
+
+// the name with its extension swapped for another one (malloc'd)
+static char* swap_extension(const char* name, const char* ext)
+{
+  char* s = malloc(strlen(name) + strlen(ext) + 1);
+  strcpy(s, name);
+  char* dot = strrchr(s, '.');
+  strcpy(dot != NULL ? dot : s + strlen(s), ext);
+  return s;
+}
+
+static void* worker(void* arg)
+{
+  for (;;)
+  {
+    pthread_mutex_lock(&job_lock);
+    int k = next_job++;
+    pthread_mutex_unlock(&job_lock);
+
+    if (k >= job_count)
+      return NULL;
+
+    type_list_file* f = &jobs[k];
+    const type_list_format* fmt = &formats[f->format];
+    if (map_file(&f->list, f->list_name, f->read_in))
+      fmt->parse_list(f);
+    if (f->map_name != NULL && map_file(&f->map, f->map_name, f->read_in))
+      fmt->parse_map(f);
+  }
+}
+
+/**
+ * parses the given files (list_name/map_name filled in, the rest zeroed),
+ * on as many threads as there are cores (or files)
+ */
+void parse_list_files(type_list_file* files, int count)
+{
+  int threads = sysconf(_SC_NPROCESSORS_ONLN);
+  if (threads > count)
+    threads = count;
+  if (threads < 1)
+    return;
+
+  pthread_mutex_lock(&parse_lock);
+  jobs = files;
+  job_count = count;
+  next_job = 0;
+
+  pthread_t* tids = malloc(threads * sizeof(pthread_t));
+  for (int k = 0; k < threads; k++)
+    pthread_create(&tids[k], NULL, worker, NULL);
+  for (int k = 0; k < threads; k++)
+    pthread_join(tids[k], NULL);
+  free(tids);
+  pthread_mutex_unlock(&parse_lock);
+}
+
+// whether a file is one of the debug-info files that get loaded (going by its name)
+bool is_list_file(const char* name)
+{
+  return format_of(name) >= 0;
+}
+
+/**
+ * finds the debug-info file that a file belongs to: either the file itself,
+ * or the one that a symbol file (e.g., a .map file) goes with
+ *
+ * returns:
+ *   its name (malloc'd), or NULL if the file is neither
+ */
+char* list_file_for(const char* name)
+{
+  if (format_of(name) >= 0)
+    return strdup(name);
+
+  const char* ext = strrchr(name, '.');
+  for (int k = 0; ext != NULL && k < NFORMATS; k++)
+    for (int i = 0; formats[k].map_exts[i] != NULL; i++)
+      if (strcmp(ext, formats[k].map_exts[i]) == 0)
+        return swap_extension(name, formats[k].ext);
+  return NULL;
+}
+
+// fills in the name of a debug-info file, and of the symbol file alongside (if there is one)
+void list_file_names(type_list_file* f, const char* list_name)
+{
+  memset(f, 0, sizeof(type_list_file));
+  f->list_name = strdup(list_name);
+  f->format = format_of(list_name);
+  if (f->format < 0)
+    f->format = 0;
+
+  for (int k = 0; f->map_name == NULL && formats[f->format].map_exts[k] != NULL; k++)
+  {
+    char* map = swap_extension(list_name, formats[f->format].map_exts[k]);
+    if (access(map, F_OK) != -1)
+      f->map_name = map;
+    else
+      free(map);
+  }
+}
+
+// lets go of the mapped files (the parsed strings point into them)
+void unmap_list_file(type_list_file* f)
+{
+  if (f->list.heap)
+    free(f->list.data);
+  else if (f->list.data != NULL)
+    munmap(f->list.data, f->list.size);
+  if (f->map.heap)
+    free(f->map.data);
+  else if (f->map.data != NULL)
+    munmap(f->map.data, f->map.size);
+  memset(&f->list, 0, sizeof(type_mapped_file));
+  memset(&f->map, 0, sizeof(type_mapped_file));
+}
+
+void free_list_file(type_list_file* f)
+{
+  unmap_list_file(f);
+  free(f->lines);
+  free(f->syms);
+  free(f->list_name);
+  free(f->map_name);
+  memset(f, 0, sizeof(type_list_file));
+}
@@ -0,0 +1,52 @@
+/**
+ * listfile.h - mmapped parsing of the assemblers' debug-info files (Ophis
+ * .list/.map, ca65 and KickAssembler .dbg, ACME reports), several at a time
+ */
+
+#include <stdbool.h>
+
+// the strings point into the mapped file (and aren't terminated)
+typedef struct
+{
+  int addr;
+  int lineno;
+  const char* file;
+  int filelen;
+} type_list_line;
+
+typedef struct
+{
+  int addr;
+  const char* sym;
+  int symlen;
+  const char* sval;     // (NULL if the file doesn't spell the value out as "$XXXX")
+  int svallen;
+} type_map_line;
+
+typedef struct
+{
+  char* data;
+  long size;
+  bool heap;            // (read into a malloc'd buffer, rather than mapped)
+} type_mapped_file;
+
+typedef struct
+{
+  char* list_name;      // the file with the source lines (and maybe the symbols) in it
+  char* map_name;       // the symbol file alongside, e.g. the .map file (NULL if there's none)
+  int format;           // (an index into the table of formats in listfile.c)
+  bool read_in;         // read the files in rather than mapping them (see map_file in listfile.c)
+  type_mapped_file list;
+  type_mapped_file map;
+  type_list_line* lines;
+  int nlines;
+  type_map_line* syms;
+  int nsyms;
+} type_list_file;
+
+bool is_list_file(const char* name);
+char* list_file_for(const char* name);
+void list_file_names(type_list_file* f, const char* list_name);
+void parse_list_files(type_list_file* files, int count);
+void unmap_list_file(type_list_file* f);
+void free_list_file(type_list_file* f);
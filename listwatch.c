@@ -0,0 +1,268 @@
+/**
+ * listwatch.c - watches the directories that the .list files are in (with
+ * inotify) for .list/.map files (or the other assemblers' debug-info and
+ * symbol files) being written, renamed into place or deleted.
+ * Once they've been left alone for LISTWATCH_SETTLE_MS (an assembler run
+ * writes several files), just the .list files concerned get reparsed, on the
+ * watcher's thread. The results are copied out of the mappings (the next
+ * build may truncate the files under them) and queued up, and the pipe behind
+ * listwatch_fd() becomes readable, for the main loop to take them in between
+ * commands.
+ **/
+
+#define _BSD_SOURCE _BSD_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
+#include "arena.h"
+#include "listfile.h"
+#include "listwatch.h"
+#include "project.h"
+
+#define LISTWATCH_SETTLE_MS 300
+
+static int inotify_fd = -1;
+static int wake_pipe[2] = { -1, -1 };
+static char** watch_dirs = NULL;  // the directory of each watch descriptor
+static int nwatch_dirs = 0;
+static pthread_mutex_t dirs_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static type_list_update* queue = NULL;  // the batches not taken yet (the oldest first)
+
+#ifdef __linux__
+
+// the .list file (or other debug-info file) that a changed file belongs to (NULL if it's unrelated)
+static char* list_name_of(int wd, const char* name)
+{
+  char* list = list_file_for(name);
+  if (list == NULL)
+    return NULL;
+
+  pthread_mutex_lock(&dirs_lock);
+  char* path = wd < nwatch_dirs && watch_dirs[wd] != NULL ? project_path(watch_dirs[wd], list) : NULL;
+  pthread_mutex_unlock(&dirs_lock);
+  free(list);
+  return path;
+}
+
+// copies the parsed strings into the batch's arena, and unmaps the files
+static void copy_out(type_list_file* f, type_arena* a)
+{
+  const char* last = NULL;
+  int lastlen = 0;
+  const char* copy = NULL;
+
+  // (the lines of a source file come in runs, so each run shares one copy of its name)
+  for (int k = 0; k < f->nlines; k++)
+  {
+    type_list_line* l = &f->lines[k];
+    if (last == NULL || l->filelen != lastlen || memcmp(l->file, last, lastlen) != 0)
+    {
+      last = l->file;
+      lastlen = l->filelen;
+      copy = arena_strndup(a, l->file, l->filelen);
+    }
+    l->file = copy;
+  }
+
+  for (int k = 0; k < f->nsyms; k++)
+  {
+    f->syms[k].sym = arena_strndup(a, f->syms[k].sym, f->syms[k].symlen);
+    if (f->syms[k].sval != NULL)
+      f->syms[k].sval = arena_strndup(a, f->syms[k].sval, f->syms[k].svallen);
+  }
+
+  unmap_list_file(f);
+}
+
+// reparses the given .list files (a deleted one comes out empty), and queues the batch up
+static void reparse(char** names, int count)
+{
+  type_list_update* u = calloc(1, sizeof(type_list_update));
+  u->files = malloc(count * sizeof(type_list_file));
+  u->count = count;
+  for (int k = 0; k < count; k++)
+  {
+    list_file_names(&u->files[k], names[k]);
+    u->files[k].read_in = true;   // (the assembler may still be rewriting them)
+  }
+
+  parse_list_files(u->files, count);
+  for (int k = 0; k < count; k++)
+    copy_out(&u->files[k], &u->arena);
+
+  pthread_mutex_lock(&queue_lock);
+  type_list_update** pp = &queue;
+  while (*pp != NULL)
+    pp = &(*pp)->next;
+  *pp = u;
+  pthread_mutex_unlock(&queue_lock);
+
+  char c = 0;
+  write(wake_pipe[1], &c, 1);
+}
+
+static void* watch_thread(void* arg)
+{
+  char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+  char** names = NULL;   // the .list files changed since things settled
+  int count = 0;
+
+  for (;;)
+  {
+    struct pollfd pfd = { inotify_fd, POLLIN, 0 };
+    int ready = poll(&pfd, 1, count > 0 ? LISTWATCH_SETTLE_MS : -1);
+    if (ready < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      return NULL;
+    }
+
+    if (ready == 0)
+    {
+      reparse(names, count);
+      for (int k = 0; k < count; k++)
+        free(names[k]);
+      count = 0;
+      continue;
+    }
+
+    int len = read(inotify_fd, buf, sizeof(buf));
+    for (char* p = buf; len > 0 && p < buf + len; )
+    {
+      struct inotify_event* ev = (struct inotify_event*)p;
+      p += sizeof(struct inotify_event) + ev->len;
+
+      char* list = ev->len > 0 ? list_name_of(ev->wd, ev->name) : NULL;
+      if (list == NULL)
+        continue;
+
+      int k = 0;
+      while (k < count && strcmp(names[k], list) != 0)
+        k++;
+      if (k < count)
+        free(list);
+      else
+      {
+        names = realloc(names, (count + 1) * sizeof(char*));
+        names[count++] = list;
+      }
+    }
+  }
+}
+
+// starts the watcher thread (once)
+static bool start_thread(void)
+{
+  if (inotify_fd >= 0)
+    return true;
+
+  inotify_fd = inotify_init();
+  if (inotify_fd < 0)
+    return false;
+
+  if (pipe(wake_pipe) != 0)
+  {
+    close(inotify_fd);
+    inotify_fd = -1;
+    return false;
+  }
+  fcntl(wake_pipe[0], F_SETFL, O_NONBLOCK);
+
+  // (ctrl-c is for the main thread to catch)
+  sigset_t mask, old;
+  pthread_t tid;
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGINT);
+  pthread_sigmask(SIG_BLOCK, &mask, &old);
+  pthread_create(&tid, NULL, watch_thread, NULL);
+  pthread_detach(tid);
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+  return true;
+}
+
+/**
+ * starts watching the given directories (as well as the ones watched already)
+ *
+ * returns:
+ *   false if nothing can be watched
+ */
+bool listwatch_start(char** dirs, int count)
+{
+  if (!start_thread())
+    return false;
+
+  for (int k = 0; k < count; k++)
+  {
+    int wd = inotify_add_watch(inotify_fd, dirs[k], IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE);
+    if (wd < 0)
+      continue;
+
+    pthread_mutex_lock(&dirs_lock);
+    if (wd >= nwatch_dirs)
+    {
+      watch_dirs = realloc(watch_dirs, (wd + 1) * sizeof(char*));
+      memset(watch_dirs + nwatch_dirs, 0, (wd + 1 - nwatch_dirs) * sizeof(char*));
+      nwatch_dirs = wd + 1;
+    }
+    // (the same directory under another name keeps the name it was watched by first)
+    if (watch_dirs[wd] == NULL)
+      watch_dirs[wd] = strdup(dirs[k]);
+    pthread_mutex_unlock(&dirs_lock);
+  }
+
+  return true;
+}
+
+#else
+
+bool listwatch_start(char** dirs, int count)
+{
+  return false;
+}
+
+#endif
+
+// becomes readable when there are reparsed files to take (-1 if nothing's being watched)
+int listwatch_fd(void)
+{
+  return wake_pipe[0];
+}
+
+// takes the batches reparsed so far (the oldest first, linked by 'next'), or NULL if there are none
+type_list_update* listwatch_take(void)
+{
+  char buf[64];
+
+  if (wake_pipe[0] < 0)
+    return NULL;
+  while (read(wake_pipe[0], buf, sizeof(buf)) > 0)
+    ;
+
+  pthread_mutex_lock(&queue_lock);
+  type_list_update* u = queue;
+  queue = NULL;
+  pthread_mutex_unlock(&queue_lock);
+
+  return u;
+}
+
+// frees a batch (not the ones linked after it)
+void listwatch_free(type_list_update* u)
+{
+  for (int k = 0; k < u->count; k++)
+    free_list_file(&u->files[k]);
+  free(u->files);
+  arena_free(&u->arena);
+  free(u);
+}
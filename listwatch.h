@@ -0,0 +1,20 @@
+/**
+ * listwatch.h - notices rebuilt .list/.map files and reparses them in the background
+ * (include arena.h and listfile.h first)
+ */
+
+#include <stdbool.h>
+
+// a batch of reparsed .list files (with the .map file alongside each)
+typedef struct tlu
+{
+  type_list_file* files;   // (the strings point into 'arena', the files aren't mapped any more)
+  int count;
+  type_arena arena;
+  struct tlu* next;
+} type_list_update;
+
+bool listwatch_start(char** dirs, int count);
+int listwatch_fd(void);
+type_list_update* listwatch_take(void);
+void listwatch_free(type_list_update* u);
@@ -9,20 +9,16 @@
 #include <readline/history.h>
 #include <signal.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <sys/select.h>
 #include "serial.h"
 #include "commands.h"
+#include "gs4510.h"
 
 #define VERSION "v1.00"
 
 char *strInput = NULL;
-
-/**
- * retrieves a command via user input and places it in global strInput
- */
-void get_command(void)
-{
-  strInput = readline("<dbg>");
-}
+bool done = false;
 
 
 void parse_command(void)
@@ -86,29 +82,107 @@ void ctrlc_handler(int s)
 
 char* my_generator(const char* text, int state)
 {
-    static int len;
-    static type_symmap_entry* iter = NULL;
+    static type_symmap_entry** matches;
+    static int count;
+    static int idx;
 
     if( !state )
     {
-        len = strlen(text);
-	iter = lstSymMap;
+        count = find_symbols_by_prefix(text, &matches);
+        idx = 0;
     }
 
-    while(iter != NULL)
-    {
-        if( strncmp(iter->symbol, text, len) == 0 )
-	{
-	  char *s = strdup(iter->symbol);
-	  iter = iter->next;
-	  return s;
-	}
-
-	iter = iter->next;
-    }
+    // (the matches are sorted by name, so duplicates are adjacent)
+    while( idx < count && idx > 0 && strcmp(matches[idx]->symbol, matches[idx-1]->symbol) == 0 )
+        idx++;
+
+    if( idx < count )
+        return strdup(matches[idx++]->symbol);
+
     return((char *)NULL);
 }
 
+/**
+ * called by readline whenever a full command line has been entered
+ */
+void line_handler(char* line)
+{
+  strInput = line;
+
+  if (!strInput ||
+      strcmp(strInput, "exit") == 0 ||
+      strcmp(strInput, "x") == 0 ||
+      strcmp(strInput, "q") == 0)
+  {
+    done = true;
+    rl_callback_handler_remove();
+    return;
+  }
+
+  if (strInput && *strInput)
+    add_history(strInput);
+
+  ctrlcflag = false;
+  serialSetBusy(true);
+  parse_command();
+  serialSetBusy(false);
+}
+
+static char* saved_line = NULL;
+static int saved_point;
+
+// clears the prompt line, to print something while we're sitting at the prompt
+void hide_prompt(void)
+{
+  saved_line = rl_copy_text(0, rl_end);
+  saved_point = rl_point;
+  rl_save_prompt();
+  rl_replace_line("", 0);
+  rl_redisplay();
+}
+
+// brings the prompt back, with what the user was half-way through typing
+void show_prompt(void)
+{
+  rl_restore_prompt();
+  rl_replace_line(saved_line, 0);
+  rl_point = saved_point;
+  rl_forced_update_display();
+  free(saved_line);
+  saved_line = NULL;
+}
+
+/**
+ * shows a breakpoint/watchpoint stop that happened while we were sitting at
+ * the prompt
+ */
+void handle_async_stop(void)
+{
+  static char info[4096];
+
+  if (!serialGetAsyncStop(info, sizeof(info)))
+    return;
+
+  hide_prompt();
+  serialSetBusy(true);
+  show_async_stop(info);
+  serialSetBusy(false);
+  show_prompt();
+}
+
+/**
+ * takes in rebuilt .list/.map files (that have been reparsed in the
+ * background) while we're sitting at the prompt
+ */
+void handle_list_refresh(void)
+{
+  hide_prompt();
+  serialSetBusy(true);
+  listRefresh();
+  serialSetBusy(false);
+  show_prompt();
+}
+
 static char** my_completion(const char * text, int start, int end)
 {
     char **matches;
@@ -145,7 +219,8 @@ int main(int argc, char** argv)
 	strcmp(argv[k], "-h") == 0)
     {
       printf("--help/-h = display this help\n"
-	     "--device/-d </dev/tty*> = select a tty device-name to use as the serial port to communicate with the Nexys hardware\n");
+	     "--device/-d </dev/tty*> = select a tty device-name to use as the serial port to communicate with the Nexys hardware\n"
+	     "--project/-p <dir> = search <dir> (or the search roots in its m65dbg.conf) and all the directories below for .list files, instead of the current directory\n");
       exit(0);
     }
     if (strcmp(argv[k], "--device") == 0 ||
@@ -159,32 +234,57 @@ int main(int argc, char** argv)
       k++;
       strcpy(devSerial, argv[k]);
     }
+    if (strcmp(argv[k], "--project") == 0 ||
+	strcmp(argv[k], "-p") == 0)
+    {
+      if (k+1 >= argc)
+      {
+        printf("Project directory is missing\n");
+	exit(0);
+      }
+      k++;
+      projectDir = argv[k];
+    }
   }
 
   // open the serial port
-  serialOpen(devSerial);
+  if (!serialOpen(devSerial))
+    exit(1);
   printf("- Type 'help' for new commands, '?'/'h' for raw commands.\n");
 
+  init_opcode_desc();
   listSearch();
 
-  while(1)
-  {
-    ctrlcflag = false;
+  rl_attempted_completion_function = my_completion;
+  rl_callback_handler_install("<dbg>", line_handler);
 
-    rl_attempted_completion_function = my_completion;
-
-    get_command();
-
-    if (!strInput ||
-        strcmp(strInput, "exit") == 0 ||
-        strcmp(strInput, "x") == 0 ||
-        strcmp(strInput, "q") == 0)
-      return 0;
-
-    if (strInput && *strInput)
-      add_history(strInput);
-
-    parse_command();
+  int notifyfd = serialNotifyFd();
+  int listfd = listRefreshFd();  // (-1 if the .list files can't be watched)
 
+  while (!done)
+  {
+    fd_set fds;
+    FD_ZERO(&fds);
+    FD_SET(STDIN_FILENO, &fds);
+    FD_SET(notifyfd, &fds);
+    if (listfd >= 0)
+      FD_SET(listfd, &fds);
+
+    int maxfd = notifyfd > STDIN_FILENO ? notifyfd : STDIN_FILENO;
+    if (listfd > maxfd)
+      maxfd = listfd;
+    if (select(maxfd + 1, &fds, NULL, NULL, NULL) < 0)
+      continue; // e.g., interrupted by ctrl-c
+
+    if (FD_ISSET(notifyfd, &fds))
+      handle_async_stop();
+
+    if (listfd >= 0 && FD_ISSET(listfd, &fds))
+      handle_list_refresh();
+
+    if (FD_ISSET(STDIN_FILENO, &fds))
+      rl_callback_read_char();
   }
+
+  return 0;
 }
@@ -0,0 +1,343 @@
+/**
+ * project.c - reads the project directory's m65dbg.conf, and walks the
+ * search roots it names (or just the project directory) for the files
+ * wanted (picked by name), on a pool of threads. Each thread takes a
+ * directory off a shared stack, reads it, and pushes the subdirectories it
+ * found back onto it. The walk is over once the stack is empty and no
+ * thread is still reading. Symlinks to files are followed, but not symlinks
+ * to directories (they could lead back up the tree). A file found more
+ * than once (through overlapping roots, or a symlink) is only kept once:
+ * under its own name rather than a symlink's (the symbol file is looked for
+ * next to it), and otherwise under the first name in name order.
+ *
+ * m65dbg.conf lines look like:
+ *   root build              (a search root, from the project directory)
+ *   ignore *.bak            (a name not to look at: a file or a whole directory)
+ *   ignore assets/music     (with a '/', a path below a search root)
+ * Names starting with '.' (.git and the like) are always skipped.
+ **/
+
+#define _BSD_SOURCE _BSD_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <fnmatch.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "project.h"
+
+#define WALK_MIN_THREADS 4   // (walking mostly waits on the disk, so use at least this many threads)
+
+typedef struct
+{
+  char* path;
+  int rootlen;       // where the path below the search root starts
+} type_walk_dir;
+
+typedef struct
+{
+  dev_t dev;
+  ino_t ino;
+} type_file_id;
+
+static type_project* walk_project;
+static bool (*walk_wanted)(const char* name);
+static type_walk_dir* stack;
+static int nstack, stacksize;
+static int busy;                // directories being read right now
+static char** found;
+static int nfound, foundsize;
+static type_file_id* seen;       // open-addressed hash set of the files kept (a power of two)
+static int nseen, seensize;
+static pthread_mutex_t walk_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t walk_cond = PTHREAD_COND_INITIALIZER;
+
+// joins a directory and a name (leaving the name as it is in the current directory, or if it's absolute)
+char* project_path(const char* dir, const char* name)
+{
+  if (strcmp(dir, ".") == 0 || name[0] == '/')
+    return strdup(name);
+
+  int len = strlen(dir);
+  char* path = malloc(len + strlen(name) + 2);
+  strcpy(path, dir);
+  if (len > 0 && dir[len - 1] != '/')
+    strcat(path, "/");
+  strcat(path, name);
+  return path;
+}
+
+static void add_string(char*** arr, int* n, char* str)
+{
+  *arr = realloc(*arr, (*n + 1) * sizeof(char*));
+  (*arr)[(*n)++] = str;
+}
+
+/**
+ * reads the project directory's m65dbg.conf (if it has one)
+ *
+ * returns:
+ *   false if the project directory isn't there
+ */
+bool project_load(type_project* p, const char* dir)
+{
+  struct stat st;
+  char line[1024];
+
+  memset(p, 0, sizeof(type_project));
+  if (stat(dir, &st) != 0 || !S_ISDIR(st.st_mode))
+  {
+    printf("Project directory \"%s\" not found!\n", dir);
+    return false;
+  }
+
+  char* conf = project_path(dir, PROJECT_CONF_FILE);
+  FILE* f = fopen(conf, "rt");
+  for (int lineno = 1; f != NULL && fgets(line, sizeof(line), f) != NULL; lineno++)
+  {
+    char* key = strtok(line, " \t\r\n");
+    char* value = strtok(NULL, "\r\n");
+    while (value != NULL && (*value == ' ' || *value == '\t'))
+      value++;
+
+    if (key == NULL || key[0] == '#')
+      continue;
+    else if (value == NULL || *value == '\0')
+      printf("%s:%d: missing value for \"%s\"\n", conf, lineno, key);
+    else if (strcmp(key, "root") == 0)
+      add_string(&p->roots, &p->nroots, project_path(dir, value));
+    else if (strcmp(key, "ignore") == 0)
+      add_string(&p->ignores, &p->nignores, strdup(value));
+    else
+      printf("%s:%d: unknown setting \"%s\"\n", conf, lineno, key);
+  }
+  if (f != NULL)
+    fclose(f);
+  free(conf);
+
+  if (p->nroots == 0)
+    add_string(&p->roots, &p->nroots, strdup(dir));
+  return true;
+}
+
+void project_free(type_project* p)
+{
+  for (int k = 0; k < p->nroots; k++)
+    free(p->roots[k]);
+  for (int k = 0; k < p->nignores; k++)
+    free(p->ignores[k]);
+  free(p->roots);
+  free(p->ignores);
+  memset(p, 0, sizeof(type_project));
+}
+
+static bool ignored(const char* name, const char* rel)
+{
+  if (name[0] == '.')
+    return true;
+
+  for (int k = 0; k < walk_project->nignores; k++)
+  {
+    char* pattern = walk_project->ignores[k];
+    if (strchr(pattern, '/') != NULL ? fnmatch(pattern, rel, FNM_PATHNAME) == 0 : fnmatch(pattern, name, 0) == 0)
+      return true;
+  }
+  return false;
+}
+
+// remembers a file as found, returning false if it already was
+static bool first_seen(struct stat* st)
+{
+  if (nseen * 2 >= seensize)
+  {
+    int size = seensize ? seensize * 2 : 256;
+    type_file_id* set = calloc(size, sizeof(type_file_id));
+    for (int k = 0; k < seensize; k++)
+      if (seen[k].ino != 0)
+      {
+        unsigned int h = (unsigned int)(seen[k].ino ^ seen[k].dev) & (size - 1);
+        while (set[h].ino != 0)
+          h = (h + 1) & (size - 1);
+        set[h] = seen[k];
+      }
+    free(seen);
+    seen = set;
+    seensize = size;
+  }
+
+  unsigned int h = (unsigned int)(st->st_ino ^ st->st_dev) & (seensize - 1);
+  while (seen[h].ino != 0)
+  {
+    if (seen[h].ino == st->st_ino && seen[h].dev == st->st_dev)
+      return false;
+    h = (h + 1) & (seensize - 1);
+  }
+  seen[h].dev = st->st_dev;
+  seen[h].ino = st->st_ino;
+  nseen++;
+  return true;
+}
+
+static void push_dir(char* path, int rootlen)
+{
+  if (nstack == stacksize)
+  {
+    stacksize = stacksize ? stacksize * 2 : 64;
+    stack = realloc(stack, stacksize * sizeof(type_walk_dir));
+  }
+  stack[nstack].path = path;
+  stack[nstack].rootlen = rootlen;
+  nstack++;
+}
+
+// reads a directory, then hands over what it found
+static void walk_dir(type_walk_dir* d)
+{
+  struct stat st;
+  struct dirent* ent;
+  type_walk_dir* dirs = NULL;
+  int ndirs = 0;
+  char** files = NULL;
+  int nfiles = 0;
+
+  DIR* dir = opendir(d->path);
+  if (dir == NULL)
+    return;
+
+  while ((ent = readdir(dir)) != NULL)
+  {
+    if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+      continue;
+
+    char* path = project_path(d->path, ent->d_name);
+    int type = ent->d_type;
+    if (type == DT_UNKNOWN && lstat(path, &st) == 0)
+      type = S_ISLNK(st.st_mode) ? DT_LNK : S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+    if (type == DT_LNK && stat(path, &st) == 0 && S_ISREG(st.st_mode))
+      type = DT_REG;
+
+    if (ignored(ent->d_name, path + d->rootlen) ||
+        (type == DT_REG && !walk_wanted(ent->d_name)) ||
+        (type != DT_REG && type != DT_DIR))
+      free(path);
+    else if (type == DT_DIR)
+    {
+      dirs = realloc(dirs, (ndirs + 1) * sizeof(type_walk_dir));
+      dirs[ndirs].path = path;
+      dirs[ndirs].rootlen = d->rootlen;
+      ndirs++;
+    }
+    else
+      add_string(&files, &nfiles, path);
+  }
+  closedir(dir);
+
+  pthread_mutex_lock(&walk_lock);
+  for (int k = 0; k < ndirs; k++)
+    push_dir(dirs[k].path, dirs[k].rootlen);
+  if (nfound + nfiles > foundsize)
+  {
+    foundsize = (nfound + nfiles) * 2;
+    found = realloc(found, foundsize * sizeof(char*));
+  }
+  memcpy(found + nfound, files, nfiles * sizeof(char*));
+  nfound += nfiles;
+  pthread_mutex_unlock(&walk_lock);
+
+  free(dirs);
+  free(files);
+}
+
+static void* walker(void* arg)
+{
+  pthread_mutex_lock(&walk_lock);
+  for (;;)
+  {
+    while (nstack == 0 && busy > 0)
+      pthread_cond_wait(&walk_cond, &walk_lock);
+    if (nstack == 0)
+      break;
+
+    type_walk_dir d = stack[--nstack];
+    busy++;
+    pthread_mutex_unlock(&walk_lock);
+
+    walk_dir(&d);
+    free(d.path);
+
+    pthread_mutex_lock(&walk_lock);
+    busy--;
+    pthread_cond_broadcast(&walk_cond);
+  }
+  pthread_mutex_unlock(&walk_lock);
+
+  return NULL;
+}
+
+static int cmp_path(const void* a, const void* b)
+{
+  return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+/**
+ * finds the files that 'wanted' picks (by their name) under the search roots
+ *
+ * returns:
+ *   their paths (in name order, the array and each path malloc'd)
+ */
+char** project_find(type_project* p, bool (*wanted)(const char* name), int* count)
+{
+  int threads = sysconf(_SC_NPROCESSORS_ONLN);
+  if (threads < WALK_MIN_THREADS)
+    threads = WALK_MIN_THREADS;
+
+  walk_project = p;
+  walk_wanted = wanted;
+  found = NULL;
+  nfound = foundsize = 0;
+  busy = 0;
+  for (int k = 0; k < p->nroots; k++)
+  {
+    char* root = p->roots[k];
+    int len = strlen(root);
+    push_dir(strdup(root), strcmp(root, ".") == 0 ? 0 : len > 0 && root[len - 1] == '/' ? len : len + 1);
+  }
+
+  pthread_t* tids = malloc(threads * sizeof(pthread_t));
+  for (int k = 0; k < threads; k++)
+    pthread_create(&tids[k], NULL, walker, NULL);
+  for (int k = 0; k < threads; k++)
+    pthread_join(tids[k], NULL);
+  free(tids);
+
+  free(stack);
+  stack = NULL;
+  nstack = stacksize = 0;
+
+  qsort(found, nfound, sizeof(char*), cmp_path);
+  bool* keep = calloc(nfound + 1, sizeof(bool));
+  for (int pass = 0; pass < 2; pass++)
+    for (int k = 0; k < nfound; k++)
+    {
+      struct stat st;
+      bool link = lstat(found[k], &st) == 0 && S_ISLNK(st.st_mode);
+      if (link == (pass == 1) && stat(found[k], &st) == 0)
+        keep[k] = first_seen(&st);
+    }
+
+  int n = 0;
+  for (int k = 0; k < nfound; k++)
+    if (keep[k])
+      found[n++] = found[k];
+    else
+      free(found[k]);
+  free(keep);
+  free(seen);
+  seen = NULL;
+  nseen = seensize = 0;
+
+  *count = n;
+  return found;
+}
@@ -0,0 +1,21 @@
+/**
+ * project.h - where the .list files get looked for (the project directory's
+ * m65dbg.conf), and a parallel walk of the directory trees
+ */
+
+#include <stdbool.h>
+
+#define PROJECT_CONF_FILE "m65dbg.conf"
+
+typedef struct
+{
+  char** roots;      // the directories to search (as paths from the current directory)
+  int nroots;
+  char** ignores;    // patterns of names not to look at (or of paths below a root, with a '/')
+  int nignores;
+} type_project;
+
+char* project_path(const char* dir, const char* name);
+bool project_load(type_project* p, const char* dir);
+char** project_find(type_project* p, bool (*wanted)(const char* name), int* count);
+void project_free(type_project* p);
@@ -18,6 +18,10 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <sys/ioctl.h>
+#include <sys/select.h>
+#include <sys/time.h>
+#include <pthread.h>
+#include <stdlib.h>
 #ifdef SUPPORT_UNIX_DOMAIN_SOCKET
 #include <sys/un.h>
 #include <sys/socket.h>
@@ -28,6 +32,27 @@
 
 int fd;
 
+// A background thread owns 'fd' and continuously drains it into a ring
+// buffer, which serialRead()/serialReadChunk() consume. While no command is
+// talking to the monitor, it also looks out for the register display printed
+// when the target hits a breakpoint/watchpoint, and signals the main loop
+// through a pipe so the stop can be shown straight away.
+#define RING_SIZE 65536
+
+static char ring[RING_SIZE];
+static int ring_head = 0;   // where the io thread writes
+static int ring_tail = 0;   // where readers read
+static pthread_mutex_t ring_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ring_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t io_thread;
+
+static bool io_busy = false;      // a command is currently talking to the monitor
+static int notify_pipe[2] = { -1, -1 };
+static char stop_scan[4096];      // unsolicited output, scanned for stop banners
+static int stop_scan_len = 0;
+static char async_stop[4096];     // the last unsolicited stop banner
+static bool async_stop_pending = false;
+
 int set_interface_attribs (int fd, int speed, int parity)
 {
         struct termios tty;
@@ -85,6 +110,163 @@ void set_blocking_serial (int fd, int should_block)
                 error_message ("error %d setting term attributes\n", errno);
 }
 
+// looks for a complete "PC   A  X ..." register display in unsolicited output.
+// called with ring_lock held.
+static void scan_for_stop(char* data, int n)
+{
+  if (stop_scan_len + n >= (int)sizeof(stop_scan))
+  {
+    // keep the tail, in case a banner is split across reads
+    int keep = stop_scan_len > 256 ? 256 : stop_scan_len;
+    memmove(stop_scan, stop_scan + stop_scan_len - keep, keep);
+    stop_scan_len = keep;
+    if (n >= (int)sizeof(stop_scan) - keep)
+      n = sizeof(stop_scan) - keep - 1;
+  }
+  memcpy(stop_scan + stop_scan_len, data, n);
+  stop_scan_len += n;
+  stop_scan[stop_scan_len] = '\0';
+
+  char* banner = strstr(stop_scan, "PC   A");
+  if (banner == NULL)
+    return;
+
+  char* eol = strchr(banner, '\n');
+  if (eol == NULL || (eol = strchr(eol + 1, '\n')) == NULL)
+    return;
+
+  int len = eol + 1 - banner;
+  memcpy(async_stop, banner, len);
+  async_stop[len] = '\0';
+  async_stop_pending = true;
+  stop_scan_len = 0;
+
+  if (write(notify_pipe[1], "s", 1) != 1)
+    error_message("error %d notifying of target stop\n", errno);
+}
+
+static void* io_thread_main(void* arg)
+{
+  char tmp[1024];
+
+  while (1)
+  {
+    fd_set fds;
+    struct timeval tv = { 0, 100000 };
+    FD_ZERO(&fds);
+    FD_SET(fd, &fds);
+
+    if (select(fd+1, &fds, NULL, NULL, &tv) <= 0)
+      continue;
+
+    int n = read(fd, tmp, sizeof(tmp));
+    if (n <= 0)
+    {
+      usleep(10000);
+      continue;
+    }
+
+    pthread_mutex_lock(&ring_lock);
+    if (!io_busy)
+      scan_for_stop(tmp, n);
+    for (int k = 0; k < n; k++)
+    {
+      ring[ring_head] = tmp[k];
+      ring_head = (ring_head + 1) % RING_SIZE;
+      if (ring_head == ring_tail) // overflow, drop the oldest byte
+        ring_tail = (ring_tail + 1) % RING_SIZE;
+    }
+    pthread_cond_broadcast(&ring_cond);
+    pthread_mutex_unlock(&ring_lock);
+  }
+
+  return NULL;
+}
+
+/**
+ * takes whatever has arrived in the ring buffer (up to bufsize bytes),
+ * waiting up to timeout_ms for something to arrive.
+ *
+ * returns the number of bytes taken (0 on timeout)
+ */
+static int ring_read(char* buf, int bufsize, int timeout_ms)
+{
+  int n = 0;
+
+  pthread_mutex_lock(&ring_lock);
+
+  if (ring_head == ring_tail)
+  {
+    struct timeval now;
+    struct timespec until;
+    gettimeofday(&now, NULL);
+    long usec = now.tv_usec + (long)timeout_ms * 1000;
+    until.tv_sec = now.tv_sec + usec / 1000000;
+    until.tv_nsec = (usec % 1000000) * 1000;
+
+    while (ring_head == ring_tail)
+      if (pthread_cond_timedwait(&ring_cond, &ring_lock, &until) != 0)
+        break;
+  }
+
+  while (ring_tail != ring_head && n < bufsize)
+  {
+    buf[n++] = ring[ring_tail];
+    ring_tail = (ring_tail + 1) % RING_SIZE;
+  }
+
+  pthread_mutex_unlock(&ring_lock);
+  return n;
+}
+
+/**
+ * marks whether a command is talking to the monitor. Stop banners are only
+ * reported asynchronously while it isn't.
+ */
+void serialSetBusy(bool busy)
+{
+  pthread_mutex_lock(&ring_lock);
+  io_busy = busy;
+  stop_scan_len = 0;
+  pthread_mutex_unlock(&ring_lock);
+}
+
+/**
+ * returns a file descriptor that becomes readable when the target stopped
+ * while no command was running (for use with select())
+ */
+int serialNotifyFd(void)
+{
+  return notify_pipe[0];
+}
+
+/**
+ * fetches the register display of a stop reported via serialNotifyFd()
+ *
+ * returns:
+ *   true = a stop was pending, and its banner was copied into buf
+ */
+bool serialGetAsyncStop(char* buf, int bufsize)
+{
+  char c;
+  bool pending;
+
+  if (read(notify_pipe[0], &c, 1) != 1)
+    return false;
+
+  pthread_mutex_lock(&ring_lock);
+  pending = async_stop_pending;
+  if (pending)
+  {
+    strncpy(buf, async_stop, bufsize - 1);
+    buf[bufsize - 1] = '\0';
+  }
+  async_stop_pending = false;
+  pthread_mutex_unlock(&ring_lock);
+
+  return pending;
+}
+
 /**
  * opens the desired serial port at the required 230400 bps, or to a unix-domain socket
  *
@@ -123,6 +305,12 @@ bool serialOpen(char* portname)
     set_interface_attribs (fd, B230400, 0);  // set speed to 230,400 bps, 8n1 (no parity)
     set_blocking_serial (fd, 0);	// set no blocking
   }
+
+  if (pipe(notify_pipe) != 0 || pthread_create(&io_thread, NULL, io_thread_main, NULL) != 0)
+  {
+    error_message("error %d starting serial i/o thread: %s\n", errno, strerror (errno));
+    return false;
+  }
   
   return true;
 }
@@ -144,20 +332,11 @@ bool serialClose(void)
 
 void serialFlush(void)
 {
-  // http://stackoverflow.com/questions/13013387/clearing-the-serial-ports-buffer
-  //  sleep(2); //required to make flush work, for some reason (for USB serial ports?)
-//  tcflush(fd,TCIOFLUSH);
-
-  // I'll now try a 'manual' flush, to see if that works for Ralph's mac and my mac...
-  int bytes_available = 0;
-  static char tmp[16384];
-#ifdef FIONREAD
-  ioctl(fd, FIONREAD, &bytes_available);
-#else
-  ioctl(fd, TIOCINQ, &bytes_available);
-#endif
-  if (bytes_available > 0)
-    read(fd, tmp, bytes_available);
+  // discard anything the io thread has collected so far (e.g., stale output
+  // from a previous command), so the next read only sees the new reply
+  pthread_mutex_lock(&ring_lock);
+  ring_tail = ring_head;
+  pthread_mutex_unlock(&ring_lock);
 }
 
 /**
@@ -194,12 +373,9 @@ bool serialRead(char* buf, int bufsize)
   char* secondline = NULL;
   bool foundLF = false;
 
-  while (ptr - buf < bufsize)
+  while (ptr - buf < bufsize - 1)
   {
-    int n = read (fd, ptr, bufsize);  // read up to 'bufsize' characters if ready to read
-
-    if (n == -1)
-      return false;
+    int n = ring_read(ptr, bufsize - 1 - (ptr - buf), 500);  // read up to the space left in 'buf'
 
     // check for "." prompt
     for (int k = 0; k < n; k++)
@@ -228,3 +404,16 @@ bool serialRead(char* buf, int bufsize)
 
   return false;
 }
+
+
+/**
+ * reads whatever serial data arrives within the given timeout (without waiting
+ * for the '.' prompt). Used to poll for output while the target is running.
+ *
+ * returns:
+ *   the number of bytes read (0 on timeout)
+ */
+int serialReadChunk(char* buf, int bufsize, int timeout_ms)
+{
+  return ring_read(buf, bufsize, timeout_ms);
+}
@@ -8,3 +8,7 @@ bool serialOpen(char* portName);
 bool serialClose(void);
 void serialWrite(char* string);
 bool serialRead(char* buf, int bufsize);
+int serialReadChunk(char* buf, int bufsize, int timeout_ms);
+void serialSetBusy(bool busy);
+int serialNotifyFd(void);
+bool serialGetAsyncStop(char* buf, int bufsize);
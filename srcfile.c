@@ -0,0 +1,164 @@
+/**
+ * srcfile.c - keeps the source files that the .list lines refer to mmapped,
+ * so that showing the lines around the current one doesn't read the file
+ * from the top every time. Each file's line offsets get found on the way to
+ * the furthest line asked for so far. A file is mapped again when its
+ * modification time or size changes.
+ **/
+
+#define _BSD_SOURCE _BSD_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "srcfile.h"
+
+static type_source_file* files = NULL;  // (the last one used first)
+
+static void unmap_source(type_source_file* f)
+{
+  if (f->data != NULL)
+    munmap(f->data, f->size);
+  f->data = NULL;
+  f->size = 0;
+  free(f->lines);
+  f->lines = NULL;
+  f->nlines = 0;
+  f->linesize = 0;
+  f->scanned = false;
+}
+
+static bool map_source(type_source_file* f, struct stat* st)
+{
+  int fd = open(f->name, O_RDONLY);
+  if (fd < 0)
+    return false;
+
+  f->mtime = st->st_mtim.tv_sec * 1000000000LL + st->st_mtim.tv_nsec;
+  if (st->st_size > 0)
+  {
+    f->data = mmap(NULL, st->st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (f->data == MAP_FAILED)
+    {
+      f->data = NULL;
+      close(fd);
+      return false;
+    }
+    f->size = st->st_size;
+  }
+  close(fd);
+
+  return true;
+}
+
+/**
+ * finds (or maps) a source file, mapping it again if it has changed
+ *
+ * returns:
+ *   NULL if it can't be read
+ */
+type_source_file* source_open(const char* name)
+{
+  struct stat st;
+  type_source_file** pp = &files;
+
+  while (*pp != NULL && strcmp((*pp)->name, name) != 0)
+    pp = &(*pp)->next;
+  type_source_file* f = *pp;
+
+  if (stat(name, &st) != 0)
+    return NULL;
+
+  if (f == NULL)
+  {
+    f = calloc(1, sizeof(type_source_file));
+    f->name = strdup(name);
+    if (!map_source(f, &st))
+    {
+      free(f->name);
+      free(f);
+      return NULL;
+    }
+  }
+  else
+  {
+    *pp = f->next;
+    if (f->mtime != st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec || f->size != st.st_size)
+    {
+      unmap_source(f);
+      map_source(f, &st);
+    }
+  }
+
+  f->next = files;
+  files = f;
+  return f;
+}
+
+// scans on until line 'lineno' (1-based) has been found, or the file ends
+static void scan_to(type_source_file* f, int lineno)
+{
+  if (f->nlines == 0)
+  {
+    f->linesize = 1024;
+    f->lines = malloc(f->linesize * sizeof(int));
+    f->lines[f->nlines++] = 0;
+  }
+
+  while (!f->scanned && f->nlines < lineno)
+  {
+    int start = f->lines[f->nlines - 1];
+    char* eol = memchr(f->data + start, '\n', f->size - start);
+    if (eol == NULL || eol + 1 == f->data + f->size)
+    {
+      f->scanned = true;
+      break;
+    }
+
+    if (f->nlines == f->linesize)
+    {
+      f->linesize *= 2;
+      f->lines = realloc(f->lines, f->linesize * sizeof(int));
+    }
+    f->lines[f->nlines++] = eol + 1 - f->data;
+  }
+}
+
+/**
+ * gets line 'lineno' (1-based) of a source file (without its line ending)
+ *
+ * returns:
+ *   false if the file is shorter than that
+ */
+bool source_line(type_source_file* f, int lineno, const char** text, int* len)
+{
+  if (lineno < 1 || f->data == NULL)
+    return false;
+
+  scan_to(f, lineno + 1);  // (where the next line starts is where this one ends)
+  if (lineno > f->nlines)
+    return false;
+
+  int start = f->lines[lineno - 1];
+  const char* end = lineno < f->nlines ? f->data + f->lines[lineno] : f->data + f->size;
+  while (end > f->data + start && (end[-1] == '\n' || end[-1] == '\r'))
+    end--;
+
+  *text = f->data + start;
+  *len = end - *text;
+  return true;
+}
+
+void source_close_all(void)
+{
+  while (files != NULL)
+  {
+    type_source_file* next = files->next;
+    unmap_source(files);
+    free(files->name);
+    free(files);
+    files = next;
+  }
+}
@@ -0,0 +1,22 @@
+/**
+ * srcfile.h - source files, mmapped once and indexed by line as far as they're read
+ */
+
+#include <stdbool.h>
+
+typedef struct tsf
+{
+  char* name;
+  char* data;         // the mapping (NULL for an empty file)
+  long size;
+  long long mtime;    // (in ns) when it was mapped
+  int* lines;         // offset of the start of each line, as far as it's been scanned
+  int nlines;
+  int linesize;
+  bool scanned;       // the whole file has been scanned
+  struct tsf* next;
+} type_source_file;
+
+type_source_file* source_open(const char* name);
+bool source_line(type_source_file* f, int lineno, const char** text, int* len);
+void source_close_all(void);
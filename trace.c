@@ -0,0 +1,319 @@
+/**
+ * trace.c - compact binary execution-trace files
+ *
+ * File layout:
+ *   header  : "M65T" <version> <3 bytes padding>
+ *   records : one per instruction
+ *   index   : <instr u32> <offset u32> per keyframe
+ *   footer  : <index offset u32> <index count u32> <instruction count u32> "M65I"
+ *
+ * Each record starts with a flags byte. A keyframe (flags = $80, written
+ * every TRACE_KEYFRAME_INTERVAL instructions) holds the full state:
+ *   <pc lo> <pc hi> <a> <x> <y> <z> <b> <sp lo> <sp hi> <opcode>
+ * Any other record only holds what changed since the previous instruction:
+ *   flags bits 0-5 = a/x/y/z/b/sp changed
+ *   <pc delta, zigzag varint> <opcode> <changed registers...>
+ * so a typical instruction costs 3-4 bytes.
+ **/
+
+#define _BSD_SOURCE _BSD_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "trace.h"
+
+#define TRACE_VERSION 1
+#define HEADER_SIZE 8
+#define FOOTER_SIZE 16
+#define KEYFRAME 0x80
+
+static void put8(type_trace_writer* w, int v)
+{
+  fputc(v & 0xff, w->f);
+  w->offset++;
+}
+
+static void put32(type_trace_writer* w, unsigned int v)
+{
+  for (int k = 0; k < 4; k++)
+    put8(w, v >> (k*8));
+}
+
+static unsigned int get32(unsigned char* p)
+{
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+bool trace_open_write(type_trace_writer* w, char* fname)
+{
+  memset(w, 0, sizeof(type_trace_writer));
+
+  w->f = fopen(fname, "wb");
+  if (w->f == NULL)
+    return false;
+  setvbuf(w->f, NULL, _IOFBF, 1 << 16);
+
+  fwrite("M65T", 1, 4, w->f);
+  w->offset = 4;
+  put8(w, TRACE_VERSION);
+  put8(w, 0);
+  put8(w, 0);
+  put8(w, 0);
+
+  return true;
+}
+
+void trace_write(type_trace_writer* w, type_trace_state* st)
+{
+  if ((w->count % TRACE_KEYFRAME_INTERVAL) == 0)
+  {
+    if ((w->index_count % 256) == 0)
+      w->index = realloc(w->index, (w->index_count + 256) * sizeof(type_trace_index));
+    w->index[w->index_count].instr = w->count;
+    w->index[w->index_count].offset = w->offset;
+    w->index_count++;
+
+    put8(w, KEYFRAME);
+    put8(w, st->pc);
+    put8(w, st->pc >> 8);
+    put8(w, st->a);
+    put8(w, st->x);
+    put8(w, st->y);
+    put8(w, st->z);
+    put8(w, st->b);
+    put8(w, st->sp);
+    put8(w, st->sp >> 8);
+    put8(w, st->opcode);
+  }
+  else
+  {
+    int flags = (st->a != w->last.a ? 0x01 : 0) |
+                (st->x != w->last.x ? 0x02 : 0) |
+                (st->y != w->last.y ? 0x04 : 0) |
+                (st->z != w->last.z ? 0x08 : 0) |
+                (st->b != w->last.b ? 0x10 : 0) |
+                (st->sp != w->last.sp ? 0x20 : 0);
+    put8(w, flags);
+
+    int delta = st->pc - w->last.pc;
+    unsigned int zz = (delta << 1) ^ (delta >> 31);
+    while (zz >= 0x80)
+    {
+      put8(w, (zz & 0x7f) | 0x80);
+      zz >>= 7;
+    }
+    put8(w, zz);
+
+    put8(w, st->opcode);
+    if (flags & 0x01) put8(w, st->a);
+    if (flags & 0x02) put8(w, st->x);
+    if (flags & 0x04) put8(w, st->y);
+    if (flags & 0x08) put8(w, st->z);
+    if (flags & 0x10) put8(w, st->b);
+    if (flags & 0x20)
+    {
+      put8(w, st->sp);
+      put8(w, st->sp >> 8);
+    }
+  }
+
+  w->last = *st;
+  w->count++;
+}
+
+void trace_close_write(type_trace_writer* w)
+{
+  unsigned int index_offset = w->offset;
+
+  for (int k = 0; k < w->index_count; k++)
+  {
+    put32(w, w->index[k].instr);
+    put32(w, w->index[k].offset);
+  }
+
+  put32(w, index_offset);
+  put32(w, w->index_count);
+  put32(w, w->count);
+  fwrite("M65I", 1, 4, w->f);
+  w->offset += 4;   // (so that it ends up as the file's size)
+
+  fclose(w->f);
+  free(w->index);
+  w->f = NULL;
+  w->index = NULL;
+}
+
+bool trace_open_read(type_trace_reader* r, char* fname)
+{
+  struct stat st;
+  memset(r, 0, sizeof(type_trace_reader));
+
+  int fd = open(fname, O_RDONLY);
+  if (fd < 0)
+    return false;
+
+  if (fstat(fd, &st) != 0 || st.st_size < HEADER_SIZE + FOOTER_SIZE)
+  {
+    close(fd);
+    return false;
+  }
+
+  r->size = st.st_size;
+  r->data = mmap(NULL, r->size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (r->data == MAP_FAILED)
+    return false;
+
+  // (the size was checked above, so the footer is within the file)
+  unsigned char* footer = r->data + r->size - FOOTER_SIZE;
+  unsigned int end = get32(footer);
+  unsigned int index_count = get32(footer + 4);
+
+  // the records and the index have to fit between the header and the footer
+  if (memcmp(r->data, "M65T", 4) != 0 || r->data[4] != TRACE_VERSION ||
+      memcmp(footer + 12, "M65I", 4) != 0 || end < HEADER_SIZE ||
+      end + (unsigned long long)index_count * 8 > r->size - FOOTER_SIZE)
+  {
+    munmap(r->data, r->size);
+    return false;
+  }
+
+  r->end = end;
+  r->index_count = index_count;
+  r->count = get32(footer + 8);
+  r->index = malloc((r->index_count + 1) * sizeof(type_trace_index));
+  for (int k = 0; k < r->index_count; k++)
+  {
+    r->index[k].instr = get32(r->data + r->end + k*8);
+    r->index[k].offset = get32(r->data + r->end + k*8 + 4);
+
+    // (keyframes have to be within the records, for trace_seek)
+    if (r->index[k].offset < HEADER_SIZE || r->index[k].offset >= r->end)
+    {
+      trace_close_read(r);
+      return false;
+    }
+  }
+  if (r->count > 0 && r->index_count == 0)
+  {
+    trace_close_read(r);
+    return false;
+  }
+
+  r->pos = HEADER_SIZE;
+  r->instr = 0;
+  return true;
+}
+
+/**
+ * positions the reader so that the next trace_next() returns instruction
+ * number 'instr', starting from the closest keyframe before it
+ */
+bool trace_seek(type_trace_reader* r, unsigned int instr)
+{
+  type_trace_state st;
+
+  if (instr >= r->count)
+    return false;
+
+  int k = instr / TRACE_KEYFRAME_INTERVAL;
+  if (k >= r->index_count)
+    k = r->index_count - 1;
+
+  r->pos = r->index[k].offset;
+  r->instr = r->index[k].instr;
+
+  while (r->instr < instr)
+    if (!trace_next(r, &st))
+      return false;
+
+  return true;
+}
+
+/**
+ * decodes the next instruction's record into 'st'
+ *
+ * returns:
+ *   false at the end of the records, or if the record is cut short or malformed
+ */
+bool trace_next(type_trace_reader* r, type_trace_state* st)
+{
+  unsigned char* p = r->data + r->pos;
+  unsigned char* end = r->data + r->end;
+
+  if (r->instr >= r->count || r->pos >= r->end)
+    return false;
+
+  type_trace_state next;
+  int flags = *p++;
+  if (flags == KEYFRAME)
+  {
+    if (end - p < 10)
+      return false;
+    next.pc = p[0] | (p[1] << 8);
+    next.a = p[2];
+    next.x = p[3];
+    next.y = p[4];
+    next.z = p[5];
+    next.b = p[6];
+    next.sp = p[7] | (p[8] << 8);
+    next.opcode = p[9];
+    p += 10;
+  }
+  else if (flags & 0xc0)
+    return false;
+  else
+  {
+    // (a 32-bit varint takes 5 bytes at most)
+    unsigned int zz = 0;
+    int shift = 0;
+    do
+    {
+      if (p >= end || shift > 28)
+        return false;
+      zz |= (unsigned int)(*p & 0x7f) << shift;
+      shift += 7;
+    } while (*p++ & 0x80);
+    int delta = (zz >> 1) ^ -(int)(zz & 1);
+
+    // the opcode, and a byte for each changed register (two for sp)
+    int n = 1;
+    for (int k = 0; k < 6; k++)
+      if (flags & (1 << k))
+        n += k == 5 ? 2 : 1;
+    if (end - p < n)
+      return false;
+
+    next = r->last;
+    next.pc = r->last.pc + delta;
+    next.opcode = *p++;
+    if (flags & 0x01) next.a = *p++;
+    if (flags & 0x02) next.x = *p++;
+    if (flags & 0x04) next.y = *p++;
+    if (flags & 0x08) next.z = *p++;
+    if (flags & 0x10) next.b = *p++;
+    if (flags & 0x20)
+    {
+      next.sp = p[0] | (p[1] << 8);
+      p += 2;
+    }
+  }
+
+  *st = next;
+  r->last = next;
+  r->pos = p - r->data;
+  r->instr++;
+  return true;
+}
+
+void trace_close_read(type_trace_reader* r)
+{
+  munmap(r->data, r->size);
+  free(r->index);
+  r->data = NULL;
+  r->index = NULL;
+}
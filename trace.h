@@ -0,0 +1,58 @@
+/**
+ * trace.h - compact binary execution-trace files
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+
+#define TRACE_KEYFRAME_INTERVAL 4096
+
+typedef struct
+{
+  int pc;
+  int a;
+  int x;
+  int y;
+  int z;
+  int b;
+  int sp;
+  int opcode;
+} type_trace_state;
+
+typedef struct
+{
+  unsigned int instr;   // instruction number of the keyframe
+  unsigned int offset;  // file offset of the keyframe
+} type_trace_index;
+
+typedef struct
+{
+  FILE* f;
+  unsigned int count;       // instructions written so far
+  unsigned int offset;      // current file offset
+  type_trace_state last;
+  type_trace_index* index;
+  int index_count;
+} type_trace_writer;
+
+typedef struct
+{
+  unsigned char* data;      // the mmapped file
+  unsigned int size;
+  unsigned int count;       // total instructions in the file
+  type_trace_index* index;
+  int index_count;
+  unsigned int pos;         // decode position (file offset)
+  unsigned int instr;       // instruction number at 'pos'
+  unsigned int end;         // file offset where the index starts
+  type_trace_state last;
+} type_trace_reader;
+
+bool trace_open_write(type_trace_writer* w, char* fname);
+void trace_write(type_trace_writer* w, type_trace_state* st);
+void trace_close_write(type_trace_writer* w);
+
+bool trace_open_read(type_trace_reader* r, char* fname);
+bool trace_seek(type_trace_reader* r, unsigned int instr);
+bool trace_next(type_trace_reader* r, type_trace_state* st);
+void trace_close_read(type_trace_reader* r);
@@ -0,0 +1,327 @@
+/**
+ * xref.c - builds a cross-reference index by a linear decode of an image,
+ * held as one array sorted by target address (then by referring address).
+ *
+ * The decode is split into one chunk per core. Each worker starts decoding
+ * at the start of its chunk, which may well be in the middle of an
+ * instruction; afterwards, the decode is redone from where the previous
+ * chunk's last instruction ended, up to the first instruction start the
+ * worker agrees on (which 65xx code reaches within a few instructions), and
+ * the worker's references before that point are replaced.
+ *
+ * File layout: "M65X" <version u32> <count u32>
+ *              (<target u32> <from u32>) * count
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "gs4510.h"
+#include "xref.h"
+
+#define XREF_VERSION 1
+#define MIN_CHUNK 0x1000
+
+char* xref_kind_names[] = { "call", "jump", "branch", "load", "store", "modify" };
+
+typedef struct
+{
+  int start;         // image offsets of the chunk
+  int end;
+  int stop;          // offset just past the last instruction decoded
+  type_xref* refs;   // in decode order
+  int count;
+  int size;
+} type_xref_chunk;
+
+static type_xref* xrefs = NULL;
+static int count = 0;
+
+static unsigned char* image;
+static unsigned char* starts;   // 1 where a worker decoded an instruction start
+static int base;
+static int len;
+
+static void add(type_xref_chunk* c, int target, int from, type_xref_kind kind)
+{
+  if (c->count == c->size)
+  {
+    c->size = c->size ? c->size * 2 : 1024;
+    c->refs = realloc(c->refs, c->size * sizeof(type_xref));
+  }
+  c->refs[c->count].target = target;
+  c->refs[c->count].from = from | ((unsigned int)kind << 28);
+  c->count++;
+}
+
+// what an instruction does with its (non-flow) operand
+static type_xref_kind data_kind(const char* name)
+{
+  static const char* modifiers[] = { "ASL", "ASR", "ASW", "DEC", "DEW", "INC", "INW", "LSR",
+    "ROL", "ROR", "ROW", "TRB", "TSB", "RMB", "SMB", NULL };
+
+  if (strncmp(name, "ST", 2) == 0)
+    return XREF_WRITE;
+  for (int k = 0; modifiers[k] != NULL; k++)
+    if (strncmp(name, modifiers[k], 3) == 0)
+      return XREF_MODIFY;
+  return XREF_READ;
+}
+
+// adds the references of the instruction at image offset 'off', returning its length
+static int decode(type_xref_chunk* c, int off)
+{
+  unsigned char* b = &image[off];
+  const type_opcode_desc* d = decode_opcode(b);
+  type_operand opnd = mode_format[d->mode].operand;
+  int addr = base + off;
+  int bank = addr & ~0xffff;
+
+  if (d->name[0] == '\0')
+    return 1;
+
+  if (opnd == OPND_ZP)
+    add(c, bank | b[d->prefix + 1], addr, data_kind(d->name));
+  else if (opnd == OPND_ZP_REL8)
+    add(c, bank | b[d->prefix + 1], addr, XREF_READ);
+
+  int target = operand_address(addr, b);
+  if (target != -1)
+  {
+    // (indirect jumps/calls read their pointer)
+    type_xref_kind kind = data_kind(d->name);
+    if (d->flags & OPF_BRANCH)
+      kind = XREF_BRANCH;
+    else if ((d->flags & OPF_CALL) && d->mode == M_nnnn)
+      kind = XREF_CALL;
+    else if ((d->flags & OPF_JUMP) && d->mode == M_nnnn)
+      kind = XREF_JUMP;
+    else if (d->flags & (OPF_CALL | OPF_JUMP))
+      kind = XREF_READ;
+    add(c, bank | target, addr, kind);
+  }
+
+  return d->len;
+}
+
+static void* worker(void* arg)
+{
+  type_xref_chunk* c = arg;
+  int off = c->start;
+
+  while (off < c->end)
+  {
+    starts[off] = 1;
+    off += decode(c, off);
+  }
+  c->stop = off;
+
+  return NULL;
+}
+
+// redoes the start of chunk 'c' from 'off' (where the previous one really ended) until it's in step with the worker's decode
+static void resync(type_xref_chunk* c, int off)
+{
+  type_xref_chunk fix = { 0 };
+
+  while (off < c->end && !starts[off])
+    off += decode(&fix, off);
+
+  int keep = 0;
+  while (keep < c->count && XREF_FROM(&c->refs[keep]) - base < off)
+    keep++;
+
+  fix.refs = realloc(fix.refs, (fix.count + c->count - keep + 1) * sizeof(type_xref));
+  memcpy(fix.refs + fix.count, c->refs + keep, (c->count - keep) * sizeof(type_xref));
+  fix.count += c->count - keep;
+
+  free(c->refs);
+  c->refs = fix.refs;
+  c->count = fix.count;
+  if (off >= c->end)
+    c->stop = off;
+}
+
+static int cmp_xref(const void* a, const void* b)
+{
+  const type_xref* x = a;
+  const type_xref* y = b;
+
+  if (x->target != y->target)
+    return x->target < y->target ? -1 : 1;
+  return x->from < y->from ? -1 : x->from > y->from;
+}
+
+/**
+ * rebuilds the index from the code in 'img' (located at 'addr', and padded
+ * by DIS_MAX_LEN bytes), treating all of it as instructions
+ */
+void xref_build(unsigned char* img, int addr, int length)
+{
+  image = img;
+  base = addr;
+  len = length;
+  starts = calloc(len, 1);
+
+  int threads = sysconf(_SC_NPROCESSORS_ONLN);
+  if (threads > len / MIN_CHUNK)
+    threads = len / MIN_CHUNK;
+  if (threads < 1)
+    threads = 1;
+
+  type_xref_chunk* chunks = calloc(threads, sizeof(type_xref_chunk));
+  pthread_t* tids = malloc(threads * sizeof(pthread_t));
+  for (int k = 0; k < threads; k++)
+  {
+    chunks[k].start = (long long)len * k / threads;
+    chunks[k].end = (long long)len * (k + 1) / threads;
+    pthread_create(&tids[k], NULL, worker, &chunks[k]);
+  }
+  for (int k = 0; k < threads; k++)
+    pthread_join(tids[k], NULL);
+
+  for (int k = 1; k < threads; k++)
+    resync(&chunks[k], chunks[k - 1].stop);
+
+  xref_clear();
+  for (int k = 0; k < threads; k++)
+    count += chunks[k].count;
+  xrefs = malloc((count + 1) * sizeof(type_xref));
+  count = 0;
+  for (int k = 0; k < threads; k++)
+  {
+    memcpy(xrefs + count, chunks[k].refs, chunks[k].count * sizeof(type_xref));
+    count += chunks[k].count;
+    free(chunks[k].refs);
+  }
+  qsort(xrefs, count, sizeof(type_xref), cmp_xref);
+
+  free(chunks);
+  free(tids);
+  free(starts);
+}
+
+void xref_clear(void)
+{
+  free(xrefs);
+  xrefs = NULL;
+  count = 0;
+}
+
+int xref_count(void)
+{
+  return count;
+}
+
+/**
+ * finds the references to 'target'
+ *
+ * returns:
+ *   the number of them (with *first pointing to the first)
+ */
+int xref_find(int target, type_xref** first)
+{
+  int lo = 0, hi = count;
+
+  while (lo < hi)
+  {
+    int mid = (lo + hi) / 2;
+    if (xrefs[mid].target < target)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  *first = &xrefs[lo];
+  int n = 0;
+  while (lo + n < count && xrefs[lo + n].target == target)
+    n++;
+  return n;
+}
+
+static void put32(FILE* f, unsigned int v)
+{
+  for (int k = 0; k < 4; k++)
+    fputc((v >> (k*8)) & 0xff, f);
+}
+
+static bool get32(FILE* f, unsigned int* v)
+{
+  unsigned char b[4];
+
+  if (fread(b, 1, 4, f) != 4)
+    return false;
+  *v = b[0] | (b[1] << 8) | (b[2] << 16) | ((unsigned int)b[3] << 24);
+  return true;
+}
+
+bool xref_save(char* fname)
+{
+  FILE* f = fopen(fname, "wb");
+  if (f == NULL)
+    return false;
+
+  fwrite("M65X", 1, 4, f);
+  put32(f, XREF_VERSION);
+  put32(f, count);
+  for (int k = 0; k < count; k++)
+  {
+    put32(f, xrefs[k].target);
+    put32(f, xrefs[k].from);
+  }
+
+  return fclose(f) == 0;
+}
+
+bool xref_load(char* fname)
+{
+  char magic[4];
+  unsigned int version, n;
+
+  FILE* f = fopen(fname, "rb");
+  if (f == NULL)
+    return false;
+
+  if (fread(magic, 1, 4, f) != 4 || memcmp(magic, "M65X", 4) != 0 ||
+      !get32(f, &version) || version != XREF_VERSION || !get32(f, &n))
+  {
+    fclose(f);
+    return false;
+  }
+
+  // (the count has to fit in what's left of the file, at 8 bytes per entry)
+  long start = ftell(f);
+  if (fseek(f, 0, SEEK_END) != 0 || n >= INT_MAX || (long long)n * 8 > ftell(f) - start ||
+      fseek(f, start, SEEK_SET) != 0)
+  {
+    fclose(f);
+    return false;
+  }
+
+  type_xref* loaded = malloc((n + 1) * sizeof(type_xref));
+  if (loaded == NULL)
+  {
+    fclose(f);
+    return false;
+  }
+  for (unsigned int k = 0; k < n; k++)
+  {
+    unsigned int target;
+    if (!get32(f, &target) || !get32(f, &loaded[k].from))
+    {
+      free(loaded);
+      fclose(f);
+      return false;
+    }
+    loaded[k].target = target;
+  }
+  fclose(f);
+
+  xref_clear();
+  xrefs = loaded;
+  count = n;
+  return true;
+}
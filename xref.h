@@ -0,0 +1,26 @@
+/**
+ * xref.h - cross-reference index of the addresses an image's code refers to
+ */
+
+#include <stdbool.h>
+
+typedef enum { XREF_CALL, XREF_JUMP, XREF_BRANCH, XREF_READ, XREF_WRITE, XREF_MODIFY } type_xref_kind;
+
+// 8 bytes per reference: the kind lives in the top bits of 'from' (addresses are 28-bit)
+typedef struct
+{
+  int target;
+  unsigned int from;
+} type_xref;
+
+#define XREF_FROM(x) ((int)((x)->from & 0x0fffffff))
+#define XREF_KIND(x) ((type_xref_kind)((x)->from >> 28))
+
+extern char* xref_kind_names[];
+
+void xref_build(unsigned char* image, int base, int len);
+void xref_clear(void);
+int xref_count(void);
+int xref_find(int target, type_xref** first);
+bool xref_save(char* fname);
+bool xref_load(char* fname);